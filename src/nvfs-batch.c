@@ -55,6 +55,11 @@
 
 #include <linux/ktime.h>
 #include <linux/delay.h>
+#include <linux/cred.h>
+#include <linux/nodemask.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/refcount.h>
 
 #include "nvfs-core.h"
 #include "nvfs-dma.h"
@@ -66,58 +71,415 @@
 #include "nvfs-batch.h"
 
 
+static struct kmem_cache *nvfs_batch_cache;
+
+#define NVFS_BATCH_CTX_HASH_BITS 6
+static DEFINE_HASHTABLE(nvfs_batch_ctx_hash, NVFS_BATCH_CTX_HASH_BITS);
+static DEFINE_SPINLOCK(nvfs_batch_ctx_lock);
+
+static inline u32 nvfs_batch_ctx_key(pid_t tgid, uint64_t ctx_id)
+{
+	return hash_64(ctx_id ^ ((u64)tgid << 32), NVFS_BATCH_CTX_HASH_BITS);
+}
+
+/*
+ * Look up the batch context of the calling process, creating it if
+ * @create is set. Returns a referenced context or NULL.
+ */
+static struct nvfs_batch_ctx *nvfs_batch_ctx_get(uint64_t ctx_id, bool create)
+{
+	struct nvfs_batch_ctx *bctx, *new = NULL;
+	pid_t tgid = current->tgid;
+	u32 key = nvfs_batch_ctx_key(tgid, ctx_id);
+	unsigned long flags;
+
+retry:
+	spin_lock_irqsave(&nvfs_batch_ctx_lock, flags);
+	hash_for_each_possible(nvfs_batch_ctx_hash, bctx, hash, key) {
+		if (bctx->tgid == tgid && bctx->ctx_id == ctx_id) {
+			refcount_inc(&bctx->ref);
+			spin_unlock_irqrestore(&nvfs_batch_ctx_lock, flags);
+			kfree(new);
+			return bctx;
+		}
+	}
+	if (new) {
+		hash_add(nvfs_batch_ctx_hash, &new->hash, key);
+		spin_unlock_irqrestore(&nvfs_batch_ctx_lock, flags);
+		return new;
+	}
+	spin_unlock_irqrestore(&nvfs_batch_ctx_lock, flags);
+
+	if (!create)
+		return NULL;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (new == NULL)
+		return NULL;
+	new->tgid = tgid;
+	new->ctx_id = ctx_id;
+	refcount_set(&new->ref, 1);
+	spin_lock_init(&new->lock);
+	INIT_LIST_HEAD(&new->ios);
+	init_waitqueue_head(&new->wq);
+	goto retry;
+}
+
+static void nvfs_batch_ctx_put(struct nvfs_batch_ctx *bctx)
+{
+	unsigned long flags;
+
+	if (!refcount_dec_and_lock_irqsave(&bctx->ref, &nvfs_batch_ctx_lock, &flags))
+		return;
+	hash_del(&bctx->hash);
+	spin_unlock_irqrestore(&nvfs_batch_ctx_lock, flags);
+	kfree(bctx);
+}
+
+static void nvfs_batch_io_attach(struct nvfs_batch_ctx *bctx, nvfs_io_t *nvfsio)
+{
+	unsigned long flags;
+
+	refcount_inc(&bctx->ref);
+	nvfsio->batch_ctx = bctx;
+	spin_lock_irqsave(&bctx->lock, flags);
+	list_add_tail(&nvfsio->batch_node, &bctx->ios);
+	spin_unlock_irqrestore(&bctx->lock, flags);
+}
+
+/*
+ * Called by nvfs_io_free() for every IO, from any context. Returns true if
+ * the IO was cancelled and its completion has to be dropped.
+ */
+bool nvfs_batch_io_detach(nvfs_io_t *nvfsio)
+{
+	struct nvfs_batch_ctx *bctx = nvfsio->batch_ctx;
+	unsigned long flags;
+	bool cancelled, empty;
+
+	if (bctx == NULL)
+		return false;
+
+	spin_lock_irqsave(&bctx->lock, flags);
+	list_del(&nvfsio->batch_node);
+	cancelled = nvfsio->cancelled;
+	empty = list_empty(&bctx->ios);
+	spin_unlock_irqrestore(&bctx->lock, flags);
+	nvfsio->batch_ctx = NULL;
+
+	if (empty)
+		wake_up_all(&bctx->wq);
+	nvfs_batch_ctx_put(bctx);
+	return cancelled;
+}
+
+static bool nvfs_batch_ctx_idle(struct nvfs_batch_ctx *bctx)
+{
+	unsigned long flags;
+	bool empty;
+
+	spin_lock_irqsave(&bctx->lock, flags);
+	empty = list_empty(&bctx->ios);
+	spin_unlock_irqrestore(&bctx->lock, flags);
+	return empty;
+}
+
+/*
+ * In-kernel kiocbs have no cancellation hook that reaches the block layer,
+ * an IO already issued always runs to completion. Cancelling marks the IOs
+ * so that their completion is dropped and chained IOs are not continued.
+ */
+long nvfs_batch_cancel(nvfs_ioctl_batch_cancel_args_t *args)
+{
+	struct nvfs_batch_ctx *bctx;
+	nvfs_io_t *nvfsio;
+	unsigned long flags;
+	uint64_t n = 0;
+	long ret = 0;
+
+	args->ncancelled = 0;
+	if (!args->flags || (args->flags & ~(NVFS_BATCH_CANCEL_IO | NVFS_BATCH_CANCEL_WAIT)))
+		return -EINVAL;
+
+	bctx = nvfs_batch_ctx_get(args->ctx_id, false);
+	if (bctx == NULL)
+		return 0;
+
+	if (args->flags & NVFS_BATCH_CANCEL_IO) {
+		spin_lock_irqsave(&bctx->lock, flags);
+		list_for_each_entry(nvfsio, &bctx->ios, batch_node) {
+			if (!nvfsio->cancelled) {
+				WRITE_ONCE(nvfsio->cancelled, true);
+				n++;
+			}
+		}
+		spin_unlock_irqrestore(&bctx->lock, flags);
+		args->ncancelled = n;
+		nvfs_stat64_add(n, &nvfs_n_batch_cancelled);
+	}
+
+	if (args->flags & NVFS_BATCH_CANCEL_WAIT) {
+		if (wait_event_interruptible(bctx->wq, nvfs_batch_ctx_idle(bctx)))
+			ret = -ERESTARTSYS;
+	}
+
+	nvfs_batch_ctx_put(bctx);
+	return ret;
+}
+
+// descriptor followed by the copy of the user entries
+static inline size_t nvfs_batch_size(uint64_t nents)
+{
+	return struct_size((nvfs_batch_io_t *)NULL, entries, nents) +
+		nents * sizeof(nvfs_ioctl_ioargs_t);
+}
+
+int nvfs_batch_cache_init(void)
+{
+	nvfs_batch_cache = kmem_cache_create("nvfs_batch",
+				nvfs_batch_size(NVFS_BATCH_CACHE_ENTRIES),
+				0, 0, NULL);
+	if (!nvfs_batch_cache)
+		return -ENOMEM;
+	return 0;
+}
+
+void nvfs_batch_cache_destroy(void)
+{
+	kmem_cache_destroy(nvfs_batch_cache);
+	nvfs_batch_cache = NULL;
+}
+
+static nvfs_batch_io_t *nvfs_batch_alloc(uint64_t nents)
+{
+	nvfs_batch_io_t *nvfs_batch;
+
+	if (nents <= NVFS_BATCH_CACHE_ENTRIES)
+		nvfs_batch = kmem_cache_alloc(nvfs_batch_cache, GFP_KERNEL);
+	else
+		nvfs_batch = kvmalloc(nvfs_batch_size(nents), GFP_KERNEL);
+	if (nvfs_batch == NULL)
+		return NULL;
+
+	// the entry copies are filled in by copy_from_user
+	memset(nvfs_batch, 0, struct_size(nvfs_batch, entries, nents));
+	nvfs_batch->nents = nents;
+	nvfs_batch->io_args = (nvfs_ioctl_ioargs_t *)&nvfs_batch->entries[nents];
+	return nvfs_batch;
+}
+
+static void nvfs_batch_free(nvfs_batch_io_t *nvfs_batch)
+{
+	if (nvfs_batch->bctx)
+		nvfs_batch_ctx_put(nvfs_batch->bctx);
+	if (nvfs_batch->nents <= NVFS_BATCH_CACHE_ENTRIES)
+		kmem_cache_free(nvfs_batch_cache, nvfs_batch);
+	else
+		kvfree(nvfs_batch);
+}
+
+/*
+ * Copy all the entries in one go. If that faults, find out which entries
+ * are readable so that only the others are rejected.
+ */
+static void nvfs_batch_copy_entries(nvfs_batch_io_t *nvfs_batch,
+				    nvfs_ioctl_ioargs_t __user *io_entries)
+{
+	uint64_t i;
+
+	if (!copy_from_user(nvfs_batch->io_args, io_entries,
+			    nvfs_batch->nents * sizeof(nvfs_ioctl_ioargs_t)))
+		return;
+
+	for (i = 0; i < nvfs_batch->nents; i++) {
+		if (copy_from_user(&nvfs_batch->io_args[i], &io_entries[i],
+				   sizeof(nvfs_ioctl_ioargs_t))) {
+			nvfs_err("%s:%d copy_from_user failed\n", __func__, __LINE__);
+			nvfs_batch->entries[i].status = -EFAULT;
+		}
+	}
+}
+
+/*
+ * Entries can share one IO if they target the same file and shadow buffer
+ * with the same flags and metapage, and @next follows @prev both in the file and in the
+ * GPU buffer.
+ */
+static bool nvfs_batch_can_merge(nvfs_ioctl_ioargs_t *prev, nvfs_ioctl_ioargs_t *next)
+{
+	return prev->optype == next->optype &&
+	       prev->fd == next->fd &&
+	       prev->cpuvaddr == next->cpuvaddr &&
+	       prev->sync == next->sync &&
+	       prev->hipri == next->hipri &&
+	       prev->allowreads == next->allowreads &&
+	       prev->use_rkeys == next->use_rkeys &&
+	       prev->fence_idx == next->fence_idx &&
+	       !memcmp(&prev->file_args, &next->file_args,
+		       offsetof(nvfs_file_args_t, devptroff)) &&
+	       prev->offset + prev->size == next->offset &&
+	       prev->file_args.devptroff + prev->size == next->file_args.devptroff;
+}
+
+/*
+ * Fold the run of contiguous entries starting at @i into @merged. Returns
+ * the number of entries folded in after @i, 0 if there is nothing to merge.
+ * The end fence of the merged IO is the highest of the run.
+ */
+static unsigned int nvfs_batch_coalesce(nvfs_batch_io_t *nvfs_batch, uint64_t i,
+					nvfs_ioctl_ioargs_t *merged)
+{
+	nvfs_ioctl_ioargs_t *io_args = nvfs_batch->io_args;
+	unsigned int j, n = 0;
+
+	while (i + n + 1 < nvfs_batch->nents &&
+	       !nvfs_batch->entries[i + n + 1].status &&
+	       nvfs_batch_can_merge(&io_args[i + n], &io_args[i + n + 1]))
+		n++;
+
+	if (n == 0)
+		return 0;
+
+	*merged = io_args[i];
+	for (j = 1; j <= n; j++) {
+		merged->size += io_args[i + j].size;
+		merged->end_fence_value = max(merged->end_fence_value,
+					      io_args[i + j].end_fence_value);
+	}
+
+	return n;
+}
+
+/*
+ * Hand the result of a merged IO back to the entries it was built from:
+ * an error or an async submission applies to all of them, the bytes done
+ * by a sync IO are split in entry order.
+ */
+static void nvfs_batch_fan_out(nvfs_batch_io_t *nvfs_batch, uint64_t i)
+{
+	struct nvfs_batch_entry *entries = &nvfs_batch->entries[i];
+	s64 done = entries[0].status;
+	unsigned int j;
+
+	for (j = 0; j <= entries[0].nmerged; j++) {
+		if (done <= 0) {
+			entries[j].status = done;
+			continue;
+		}
+		entries[j].status = min_t(s64, done, nvfs_batch->io_args[i + j].size);
+		done -= entries[j].status;
+	}
+}
+
+/* Release the IOs set up for a batch which is not going to be started */
+static void nvfs_batch_release_entries(nvfs_batch_io_t *nvfs_batch)
+{
+	uint64_t i;
+
+	for (i = 0; i < nvfs_batch->nents; i++) {
+		if (nvfs_batch->entries[i].nvfsio) {
+			nvfs_io_free(nvfs_batch->entries[i].nvfsio, -EINVAL);
+			nvfs_batch->entries[i].nvfsio = NULL;
+		}
+	}
+}
+
+/* First error of the entries, 0 if there is none */
+static long nvfs_batch_first_error(nvfs_batch_io_t *nvfs_batch)
+{
+	uint64_t i;
+
+	for (i = 0; i < nvfs_batch->nents; i++) {
+		if (nvfs_batch->entries[i].status < 0)
+			return nvfs_batch->entries[i].status;
+	}
+	return 0;
+}
+
 /*
  * Setup nvfsio for reach READ/WRITE IOCTL operation.
+ * @with_status: the caller used NVFS_IOCTL_BATCH_IO_STATUS, only then is the
+ * status field of the batch args initialized. A rejected entry gets its
+ * errno in the status array and does not fail the other entries.
+ * NVFS_IOCTL_BATCH_IO callers cannot tell which entries are running, so
+ * their batch is rejected as a whole before any entry is started.
  */
-nvfs_batch_io_t *nvfs_io_batch_init(nvfs_ioctl_param_union *input_param)
+nvfs_batch_io_t *nvfs_io_batch_init(nvfs_ioctl_param_union *input_param, bool with_status)
 {
 	nvfs_ioctl_batch_ioargs_t *batch_args = &(input_param->batch_ioargs);
 	nvfs_batch_io_t *nvfs_batch = NULL;
+	uint64_t max_entries = min_t(uint64_t, nvfs_max_batch_entries,
+				     NVFS_MAX_BATCH_ENTRIES);
 	int i, ret = -EINVAL;
 	bool rw_stats_enabled = 0;
 
 	if (nvfs_rw_stats_enabled > 0)
 		rw_stats_enabled = 1;
 
-	if (batch_args->nents <= 0 || batch_args->nents > NVFS_MAX_BATCH_ENTRIES) {
+	if (batch_args->nents <= 0 || batch_args->nents > max_entries) {
 		nvfs_err("number of batch entries exceeds max supported entries %lld\n", batch_args->nents);
 		return ERR_PTR(ret);
 	}
 
-	nvfs_batch = kzalloc(sizeof(nvfs_batch_io_t), GFP_KERNEL);
+	nvfs_batch = nvfs_batch_alloc(batch_args->nents);
 	if (nvfs_batch == NULL)
 		return ERR_PTR(-ENOMEM);
 	nvfs_batch->ctx_id = batch_args->ctx_id;
+	nvfs_batch->bctx = nvfs_batch_ctx_get(batch_args->ctx_id, true);
+	if (nvfs_batch->bctx == NULL) {
+		nvfs_batch_free(nvfs_batch);
+		return ERR_PTR(-ENOMEM);
+	}
 	nvfs_batch->start_io = ktime_get();
-	nvfs_batch->nents = batch_args->nents;
+	nvfs_batch->ustatus = with_status ? batch_args->status : NULL;
+	nvfs_batch->partial = with_status;
 
 	nvfs_dbg("batch_submit ctx_id:%lld  nents:%lld\n", batch_args->ctx_id, batch_args->nents);
-	for (i = 0; i < batch_args->nents; i++) {
-		nvfs_ioctl_ioargs_t __user *io_entry_p;
-		nvfs_ioctl_ioargs_t io_entry;
+	nvfs_batch_copy_entries(nvfs_batch, batch_args->io_entries);
+	if (!nvfs_batch->partial && nvfs_batch_first_error(nvfs_batch)) {
+		ret = nvfs_batch_first_error(nvfs_batch);
+		goto cleanup;
+	}
 
-		io_entry_p = &(batch_args->io_entries[i]);
-		if (copy_from_user((void *) &io_entry, (void *) io_entry_p,
-				    sizeof(nvfs_ioctl_ioargs_t))) {
-			nvfs_err("%s:%d copy_from_user failed\n", __func__, __LINE__);
-			ret = -EFAULT;
-			goto cleanup;
-		}
+	for (i = 0; i < nvfs_batch->nents; i++) {
+		nvfs_ioctl_ioargs_t merged, *io_entry = &nvfs_batch->io_args[i];
+		nvfs_io_t *nvfsio = NULL;
+		unsigned int j, nmerged;
+
+		nvfs_batch->entries[i].node = NUMA_NO_NODE;
+		if (nvfs_batch->entries[i].status)
+			continue;
 
 		nvfs_dbg("%d) op: %d, cpuvaddr = 0x%llx foffset= 0x%llx size=0x%llx, sync:%d\\n",
-			 i, io_entry.optype, io_entry.cpuvaddr, io_entry.offset, io_entry.size, io_entry.sync);
+			 i, io_entry->optype, io_entry->cpuvaddr, io_entry->offset, io_entry->size, io_entry->sync);
 		nvfs_dbg("hipri: %d, allow_reads = %d use_rkeys= %d\\n",
-			 io_entry.hipri, io_entry.allowreads, io_entry.use_rkeys);
+			 io_entry->hipri, io_entry->allowreads, io_entry->use_rkeys);
 		nvfs_dbg("fd: %d inum: %ld, generation: %d  majdev:0x%x, mindev:0x%x, devptr_off: 0x%llx\\n",
-			 io_entry.fd, io_entry.file_args.inum, io_entry.file_args.generation, io_entry.file_args.majdev,
-			 io_entry.file_args.mindev, io_entry.file_args.devptroff);
+			 io_entry->fd, io_entry->file_args.inum, io_entry->file_args.generation, io_entry->file_args.majdev,
+			 io_entry->file_args.mindev, io_entry->file_args.devptroff);
 
-		nvfs_batch->nvfsio[i] = nvfs_io_init(io_entry.optype, &io_entry);
-		if (IS_ERR(nvfs_batch->nvfsio[i])) {
-			ret = PTR_ERR(nvfs_batch->nvfsio[i]);
-			goto cleanup;
+		nmerged = nvfs_batch_coalesce(nvfs_batch, i, &merged);
+		if (nmerged) {
+			nvfsio = nvfs_io_init(io_entry->optype, &merged);
+			if (IS_ERR(nvfsio)) {
+				nvfs_dbg("%s:%d merged entries %d-%d rejected: %ld, retrying them one by one\n",
+					 __func__, __LINE__, i, i + nmerged, PTR_ERR(nvfsio));
+				nmerged = 0;
+			}
+		}
+		if (nmerged == 0)
+			nvfsio = nvfs_io_init(io_entry->optype, io_entry);
+		if (IS_ERR(nvfsio)) {
+			nvfs_dbg("%s:%d batch entry %d rejected: %ld\n",
+				 __func__, __LINE__, i, PTR_ERR(nvfsio));
+			nvfs_batch->entries[i].status = PTR_ERR(nvfsio);
+			if (!nvfs_batch->partial) {
+				ret = PTR_ERR(nvfsio);
+				goto cleanup;
+			}
+			continue;
 		}
-		if (io_entry.optype == READ) {
+		if (io_entry->optype == READ) {
 			if (rw_stats_enabled) {
 				nvfs_stat64(&nvfs_n_reads);
 				nvfs_stat(&nvfs_n_op_reads);
@@ -128,50 +490,188 @@ nvfs_batch_io_t *nvfs_io_batch_init(nvfs_ioctl_param_union *input_param)
 				nvfs_stat(&nvfs_n_op_writes);
 			}
 		}
-		nvfs_batch->nvfsio[i]->rw_stats_enabled = rw_stats_enabled;
+		nvfsio->rw_stats_enabled = rw_stats_enabled;
+		nvfs_batch->entries[i].nvfsio = nvfsio;
+		nvfs_batch->entries[i].node = nvfsio->nvfs_mgroup->gpu_info.numa_node;
+		nvfs_batch->entries[i].nmerged = nmerged;
+		if (nmerged) {
+			nvfs_dbg("%s:%d entries %d-%d merged, size 0x%llx\n",
+				 __func__, __LINE__, i, i + nmerged, merged.size);
+			nvfs_stat64_add(nmerged, &nvfs_n_batch_coalesced);
+			for (j = 1; j <= nmerged; j++)
+				nvfs_batch->entries[i + j].node = NUMA_NO_NODE;
+			i += nmerged;
+		}
 	}
 
 	return nvfs_batch;
 
 cleanup:
-	if (nvfs_batch) {
-		for (i = 0; i < nvfs_batch->nents; i++) {
-			if (nvfs_batch->nvfsio[i] && !IS_ERR(nvfs_batch->nvfsio[i]))
-				nvfs_io_free(nvfs_batch->nvfsio[i], -EINVAL);
-		}
-		kfree(nvfs_batch);
-	}
+	nvfs_batch_release_entries(nvfs_batch);
+	nvfs_batch_free(nvfs_batch);
 	return ERR_PTR(ret);
 }
 
+static void nvfs_batch_start_entry(nvfs_batch_io_t *nvfs_batch, unsigned int i)
+{
+	struct nvfs_batch_entry *entry = &nvfs_batch->entries[i];
+
+	// an NVFS_IOCTL_BATCH_IO batch stops at the first entry failing to start
+	if (!nvfs_batch->partial && READ_ONCE(nvfs_batch->aborted)) {
+		nvfs_io_free(entry->nvfsio, -ECANCELED);
+		entry->nvfsio = NULL;
+		entry->status = -ECANCELED;
+		if (entry->nmerged)
+			nvfs_batch_fan_out(nvfs_batch, i);
+		return;
+	}
+
+	// tracked before the start, the IO can complete right away
+	nvfs_batch_io_attach(nvfs_batch->bctx, entry->nvfsio);
+	entry->status = nvfs_io_start_op(entry->nvfsio);
+	// the IO belongs to the completion path now
+	entry->nvfsio = NULL;
+	if (entry->status < 0) {
+		nvfs_err("%s:%d failed to start nvfs batch io entry: %d ret: %lld\n",
+			 __func__, __LINE__, i, entry->status);
+		WRITE_ONCE(nvfs_batch->aborted, true);
+	}
+	if (entry->nmerged)
+		nvfs_batch_fan_out(nvfs_batch, i);
+}
+
+struct nvfs_batch_node_work {
+	struct work_struct work;
+	nvfs_batch_io_t *nvfs_batch;
+	int node;
+};
+
+/*
+ * Start the entries whose GPU sits on @node. Runs from an unbound worker
+ * on that node, on behalf of the submitter which waits for it.
+ */
+static void nvfs_batch_node_work_fn(struct work_struct *work)
+{
+	struct nvfs_batch_node_work *nw =
+		container_of(work, struct nvfs_batch_node_work, work);
+	nvfs_batch_io_t *nvfs_batch = nw->nvfs_batch;
+	const struct cred *old_creds;
+	unsigned int i;
+
+	old_creds = override_creds(nvfs_batch->cred);
+	nvfs_use_mm(nvfs_batch->mm);
+	for (i = 0; i < nvfs_batch->nents; ++i) {
+		if (nvfs_batch->entries[i].nvfsio &&
+		    nvfs_batch->entries[i].node == nw->node)
+			nvfs_batch_start_entry(nvfs_batch, i);
+	}
+	nvfs_unuse_mm(nvfs_batch->mm);
+	revert_creds(old_creds);
+
+	if (atomic_dec_and_test(&nvfs_batch->pending))
+		complete(&nvfs_batch->done);
+}
+
+/*
+ * Hand the entries of every remote GPU numa node to a worker on that node
+ * and start the local ones from here. Returns false if the batch has to
+ * be submitted serially instead.
+ */
+static bool nvfs_batch_submit_parallel(nvfs_batch_io_t *nvfs_batch)
+{
+	struct nvfs_batch_node_work *nw;
+	nodemask_t nodes = NODE_MASK_NONE;
+	int local = numa_node_id();
+	int node, nr_nodes, n = 0;
+	unsigned int i;
+
+	for (i = 0; i < nvfs_batch->nents; ++i) {
+		node = nvfs_batch->entries[i].node;
+		if (nvfs_batch->entries[i].nvfsio && node != NUMA_NO_NODE &&
+		    node != local && node_online(node))
+			node_set(node, nodes);
+	}
+
+	nr_nodes = nodes_weight(nodes);
+	if (nr_nodes == 0)
+		return false;
+
+	nw = kcalloc(nr_nodes, sizeof(*nw), GFP_KERNEL);
+	if (nw == NULL)
+		return false;
+
+	nvfs_batch->mm = current->mm;
+	nvfs_batch->cred = current_cred();
+	atomic_set(&nvfs_batch->pending, nr_nodes);
+	init_completion(&nvfs_batch->done);
+
+	for_each_node_mask(node, nodes) {
+		INIT_WORK(&nw[n].work, nvfs_batch_node_work_fn);
+		nw[n].nvfs_batch = nvfs_batch;
+		nw[n].node = node;
+#ifdef HAVE_QUEUE_WORK_NODE
+		queue_work_node(node, system_unbound_wq, &nw[n].work);
+#else
+		queue_work_on(cpumask_any_and(cpumask_of_node(node), cpu_online_mask),
+			      system_unbound_wq, &nw[n].work);
+#endif
+		n++;
+	}
+
+	for (i = 0; i < nvfs_batch->nents; ++i) {
+		node = nvfs_batch->entries[i].node;
+		if (nvfs_batch->entries[i].nvfsio &&
+		    (node == NUMA_NO_NODE || !node_isset(node, nodes)))
+			nvfs_batch_start_entry(nvfs_batch, i);
+	}
+
+	wait_for_completion(&nvfs_batch->done);
+	kfree(nw);
+	return true;
+}
+
+/*
+ * Start every entry accepted by nvfs_io_batch_init(). A failing entry is
+ * freed by nvfs_io_start_op() itself. With NVFS_IOCTL_BATCH_IO_STATUS it
+ * does not affect the others, NVFS_IOCTL_BATCH_IO releases the entries not
+ * started yet with -ECANCELED.
+ * Returns 0 if all the entries were submitted, else the first error.
+ */
 long nvfs_io_batch_submit(nvfs_batch_io_t *nvfs_batch)
 {
 	unsigned int i;
 	long ret = 0;
 
-	for (i = 0; i < nvfs_batch->nents; ++i) {
-		ret = nvfs_io_start_op(nvfs_batch->nvfsio[i]);
-		if (ret < 0) {
-			nvfs_err("%s:%d failed to start nvfs batch io entry: %d\n", __func__, __LINE__, i);
-			nvfs_batch->nvfsio[i] = NULL;
-			goto cleanup;
+	if (!nvfs_batch_parallel_submit ||
+	    !nvfs_batch_submit_parallel(nvfs_batch)) {
+		for (i = 0; i < nvfs_batch->nents; ++i) {
+			if (nvfs_batch->entries[i].nvfsio)
+				nvfs_batch_start_entry(nvfs_batch, i);
 		}
 	}
 
+	ret = nvfs_batch_first_error(nvfs_batch);
+
 	nvfs_update_batch_latency(ktime_us_delta(ktime_get(),
 						  nvfs_batch->start_io),
+				  nvfs_batch->nents,
 				  &nvfs_batch_submit_latency_per_sec);
-	kfree(nvfs_batch);
-	return ret;
 
-cleanup:
-	for (i = 0; i < nvfs_batch->nents; i++) {
-		if (nvfs_batch->nvfsio[i] && !IS_ERR(nvfs_batch->nvfsio[i]))
-			nvfs_io_free(nvfs_batch->nvfsio[i], -EINVAL);
+	if (nvfs_batch->ustatus) {
+		// the entry copies are no longer needed, gather the results there
+		s64 *status = (s64 *)nvfs_batch->io_args;
+
+		for (i = 0; i < nvfs_batch->nents; ++i)
+			status[i] = nvfs_batch->entries[i].status;
+
+		if (copy_to_user(nvfs_batch->ustatus, status,
+				 nvfs_batch->nents * sizeof(s64))) {
+			nvfs_err("%s:%d copy_to_user failed\n", __func__, __LINE__);
+			ret = -EFAULT;
+		}
 	}
-	/* XXX: wait for the ongoing ops, or cancel them. */
-	kfree(nvfs_batch);
-	return ret;
 
+	nvfs_batch_free(nvfs_batch);
+	return ret;
 }
 #endif
@@ -26,15 +26,57 @@
 #include "nvfs-core.h"
 #include "nvfs-mmap.h"
 
-#define NVFS_MAX_BATCH_ENTRIES 256
+#define NVFS_MAX_BATCH_ENTRIES 16384	/* upper bound of max_batch_entries */
+#define NVFS_DEFAULT_BATCH_ENTRIES 4096
+#define NVFS_BATCH_CACHE_ENTRIES 256	/* batches up to this size use nvfs_batch_cache */
+
+struct nvfs_batch_entry {
+	nvfs_io_t *nvfsio;		/* NULL for rejected entries */
+	s64 status;			/* start_op return or -errno */
+	int node;			/* numa node of the entry GPU */
+	unsigned int nmerged;		/* following entries folded into this IO */
+};
+
+/*
+ * IOs in flight for a (process, ctx_id) pair, for batch cancel and drain.
+ * Every batch and every tracked IO holds a reference.
+ */
+struct nvfs_batch_ctx {
+	struct hlist_node hash;
+	pid_t tgid;
+	uint64_t ctx_id;
+	refcount_t ref;
+	spinlock_t lock;		/* protects ios */
+	struct list_head ios;
+	wait_queue_head_t wq;		/* woken up when ios gets empty */
+};
 
 typedef struct nvfs_batch_io {
 	uint64_t ctx_id;
+	struct nvfs_batch_ctx *bctx;
 	ktime_t start_io;		/* Start time of IO for latency calculation */
 	uint64_t nents;
-	nvfs_io_t *nvfsio[NVFS_MAX_BATCH_ENTRIES];
+	s64 __user *ustatus;		/* user per-entry results, optional */
+	bool partial;			/* NVFS_IOCTL_BATCH_IO_STATUS: entries fail independently */
+	bool aborted;			/* !partial: an entry failed to start, start no more */
+	struct mm_struct *mm;		/* submitter mm and creds for the node workers */
+	const struct cred *cred;
+	atomic_t pending;		/* node workers still submitting */
+	struct completion done;
+	nvfs_ioctl_ioargs_t *io_args;	/* copy of the user entries, after entries[] */
+	struct nvfs_batch_entry entries[];
 } nvfs_batch_io_t;
 
-nvfs_batch_io_t *nvfs_io_batch_init(nvfs_ioctl_param_union *input_param);
+#ifdef NVFS_BATCH_SUPPORT
+nvfs_batch_io_t *nvfs_io_batch_init(nvfs_ioctl_param_union *input_param, bool with_status);
 long nvfs_io_batch_submit(nvfs_batch_io_t *nvfs_batch);
+int nvfs_batch_cache_init(void);
+void nvfs_batch_cache_destroy(void);
+bool nvfs_batch_io_detach(nvfs_io_t *nvfsio);
+long nvfs_batch_cancel(nvfs_ioctl_batch_cancel_args_t *args);
+#else
+static inline int nvfs_batch_cache_init(void) { return 0; }
+static inline void nvfs_batch_cache_destroy(void) { }
+static inline bool nvfs_batch_io_detach(nvfs_io_t *nvfsio) { return false; }
+#endif
 #endif
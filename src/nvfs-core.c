@@ -51,12 +51,15 @@
 #include <linux/security.h>
 #include <linux/ktime.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/cred.h>
 
 #include <linux/ktime.h>
 #include <linux/delay.h>
 
 #include "nvfs-core.h"
 #include "nvfs-batch.h"
+#include "nvfs-ring.h"
 #include "nvfs-dma.h"
 #include "nvfs-pci.h"
 #include "nvfs-stat.h"
@@ -69,6 +72,13 @@
 #include "nvfs-vers.h"
 
 #include <linux/magic.h>
+#ifdef HAVE_URING_CMD
+#ifdef HAVE_IO_URING_CMD_H
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+#endif
 
 // module exit (ms)
 #define NVFS_HOLD_TIME 200
@@ -106,6 +116,12 @@ int nvfs_rw_stats_enabled;
 int nvfs_peer_stats_enabled;
 unsigned int nvfs_max_devices = MAX_NVFS_DEVICES;
 int nvfs_use_legacy_p2p_allocation = 1;
+unsigned int nvfs_max_io_slots = 8;
+unsigned int nvfs_max_batch_entries = NVFS_DEFAULT_BATCH_ENTRIES;
+unsigned int nvfs_batch_parallel_submit;
+unsigned int nvfs_premap_peers;
+unsigned int nvfs_folio_pool_max = NVFS_DEFAULT_FOLIO_POOL_MAX;
+unsigned int nvfs_max_shadow_buf_mb = NVFS_DEFAULT_MAX_SHADOW_BUF_MB;
 
 /* For storing real device count */
 static unsigned int nvfs_curr_devices = 1;
@@ -144,18 +160,40 @@ unsigned int nvfs_get_device_count(void)
 	return nvfs_curr_devices;
 }
 
-static inline bool nvfs_transit_state(struct nvfs_gpu_args *gpu_info,
-				       bool sync, int from, int to)
+/*
+ * IO state could not move on, termination was requested while the IO was
+ * in flight. Finish the termination on behalf of the requester.
+ */
+static void nvfs_transit_state_failed(struct nvfs_gpu_args *gpu_info, bool sync)
 {
-	bool io_transit = true;
-
 	nvfs_mgroup_ptr_t nvfs_mgroup = container_of(gpu_info,
 						     struct nvfs_io_mgroup,
 						     gpu_info);
-	nvfs_io_t *nvfsio = &nvfs_mgroup->nvfsio;
 
-	nvfs_dbg("IO Transit requested from %s->%s nvfsio :%p\n",
-		 nvfs_io_state_status(from), nvfs_io_state_status(to), nvfsio);
+	/*
+	 * free the nvfs_mgroup if the io thread is sync and callback
+	 * has not taken ownership
+	 */
+	if (sync && atomic_cmpxchg(&gpu_info->io_state,
+				   IO_TERMINATE_REQ,
+				   IO_TERMINATED) == IO_TERMINATE_REQ) {
+		wake_up_all(&gpu_info->callback_wq);
+		nvfs_mgroup_put(nvfs_mgroup);
+	} else {
+		atomic_set(&gpu_info->io_state, IO_CALLBACK_END);
+		wake_up_all(&gpu_info->callback_wq);
+	}
+	nvfs_err("Set current state to %s\n",
+		 nvfs_io_state_status(atomic_read(&gpu_info->io_state)));
+}
+
+static inline bool nvfs_transit_state(struct nvfs_gpu_args *gpu_info,
+				       bool sync, int from, int to)
+{
+	bool io_transit = true;
+
+	nvfs_dbg("IO Transit requested from %s->%s gpu_info :%p\n",
+		 nvfs_io_state_status(from), nvfs_io_state_status(to), gpu_info);
 
 #ifdef CONFIG_FAULT_INJECTION
 	if (nvfs_fault_trigger(&nvfs_io_transit_state_fail)) {
@@ -192,26 +230,12 @@ static inline bool nvfs_transit_state(struct nvfs_gpu_args *gpu_info,
 			 nvfs_io_state_status(to),
 			 nvfs_io_state_status(from),
 			 nvfs_io_state_status(IO_TERMINATED));
-		/*
-		 * free the nvfs_mgroup if the io thread is sync and callback
-		 * has not taken ownership
-		 */
-		if (sync && atomic_cmpxchg(&gpu_info->io_state,
-					   IO_TERMINATE_REQ,
-					   IO_TERMINATED) == IO_TERMINATE_REQ) {
-			wake_up_all(&gpu_info->callback_wq);
-			nvfs_mgroup_put(nvfs_mgroup);
-		} else {
-			atomic_set(&gpu_info->io_state, IO_CALLBACK_END);
-			wake_up_all(&gpu_info->callback_wq);
-		}
-		nvfs_err("Set current state to %s\n",
-			 nvfs_io_state_status(atomic_read(&gpu_info->io_state)));
+		nvfs_transit_state_failed(gpu_info, sync);
 		return io_transit;
 	}
 
-	nvfs_dbg("IO Transit success %s->%s nvfsio :%p\n",
-		 nvfs_io_state_status(from), nvfs_io_state_status(to), nvfsio);
+	nvfs_dbg("IO Transit success %s->%s gpu_info :%p\n",
+		 nvfs_io_state_status(from), nvfs_io_state_status(to), gpu_info);
 	return io_transit;
 }
 
@@ -274,10 +298,10 @@ static void nvfs_io_terminate(struct nvfs_gpu_args *gpu_info, bool callback)
 		if (nvfs_io_terminate_requested(gpu_info, callback)) {
 			nvfs_mgroup_ptr_t nvfs_mgroup = container_of(gpu_info, struct nvfs_io_mgroup,
 						gpu_info);
-			nvfs_io_t *nvfsio = &nvfs_mgroup->nvfsio;
 
-			nvfs_err("%s:%d Waiting for IO to be terminated nvfsio :%p\n",
-				 __func__, __LINE__, nvfsio);
+			nvfs_err("%s:%d Waiting for IO to be terminated mgroup :%p active IOs :%u\n",
+				 __func__, __LINE__, nvfs_mgroup,
+				 READ_ONCE(nvfs_mgroup->nvfs_io_active));
 
 			do {
 				if (atomic_read(&gpu_info->io_state) == IO_CALLBACK_REQ) {
@@ -298,6 +322,51 @@ static void nvfs_io_terminate(struct nvfs_gpu_args *gpu_info, bool callback)
 	}
 }
 
+/*
+ * Map the metapage @io_fence of NVFS_MAP_IO_FENCES, or the buffer metapage
+ * if @io_fence is negative. Release with kunmap_local().
+ */
+static nvfs_ioctl_metapage_ptr_t nvfs_metapage_map(struct nvfs_gpu_args *gpu_info, int io_fence)
+{
+	struct page *page = gpu_info->end_fence_page;
+	u32 offset = gpu_info->offset_in_page;
+
+	if (io_fence >= 0) {
+		offset += io_fence * NVFS_BLOCK_SIZE;
+		page = gpu_info->io_fence_pages[offset >> PAGE_SHIFT];
+		offset &= ~PAGE_MASK;
+	}
+
+	return (nvfs_ioctl_metapage_ptr_t)((char *)kmap_local_page(page) + offset);
+}
+
+static void nvfs_put_pci_dev_mapping(struct pci_dev_mapping *pci_dev_mapping)
+{
+	if (refcount_dec_and_test(&pci_dev_mapping->ref)) {
+		kfree(pci_dev_mapping->runs);
+		kfree_rcu(pci_dev_mapping, rcu);
+	}
+}
+
+/*
+ * Buffer teardown runs with no IO in flight, a placeholder still being mapped
+ * for a peer is waited for so that its mapping gets released with the others.
+ */
+static void nvfs_settle_pci_dev_mapping(struct pci_dev_mapping *pci_dev_mapping)
+{
+	if (smp_load_acquire(&pci_dev_mapping->ready) || READ_ONCE(pci_dev_mapping->err))
+		return;
+	WARN_ON_ONCE(1);
+	wait_for_completion(&pci_dev_mapping->done);
+}
+
+/* drop the hash table reference of a mapping, lookups may still hold it under rcu */
+static void nvfs_unhash_pci_dev_mapping(struct pci_dev_mapping *pci_dev_mapping)
+{
+	hash_del_rcu(&pci_dev_mapping->hentry);
+	nvfs_put_pci_dev_mapping(pci_dev_mapping);
+}
+
 /*
  * This callback gets invoked:
  * 1: If the userspace program explicitly deallocates corresponding GPU memory
@@ -314,6 +383,7 @@ static void nvfs_get_pages_free_callback(void *data)
 	struct pci_dev_mapping *pci_dev_mapping;
 	nvfs_ioctl_metapage_ptr_t nvfs_ioctl_mpage_ptr;
 	void *kaddr, *orig_kaddr;
+	int i;
 
 	nvfs_stat(&nvfs_n_callbacks);
 
@@ -344,15 +414,16 @@ static void nvfs_get_pages_free_callback(void *data)
 	// hash tables
 	hash_for_each_safe(gpu_info->buckets, bkt, tmp, pci_dev_mapping,
 				hentry) {
-		BUG_ON(pci_dev_mapping->dma_mapping == NULL);
-		ret = nvfs_nvidia_p2p_free_dma_mapping(
-				pci_dev_mapping->dma_mapping);
-		if (ret)
-			nvfs_err("Error when freeing dma mapping\n");
+		nvfs_settle_pci_dev_mapping(pci_dev_mapping);
+		// negative entries of peers that failed to map hold no mapping
+		if (pci_dev_mapping->dma_mapping) {
+			ret = nvfs_nvidia_p2p_free_dma_mapping(
+					pci_dev_mapping->dma_mapping);
+			if (ret)
+				nvfs_err("Error when freeing dma mapping\n");
+		}
 
-		hash_del(&pci_dev_mapping->hentry);
-		kfree(pci_dev_mapping);
-		pci_dev_mapping = NULL;
+		nvfs_unhash_pci_dev_mapping(pci_dev_mapping);
 	}
 	nvfs_update_free_gpustat(gpu_info);
 
@@ -370,6 +441,13 @@ static void nvfs_get_pages_free_callback(void *data)
 	nvfs_ioctl_mpage_ptr = (nvfs_ioctl_metapage_ptr_t) kaddr;
 	WRITE_ONCE(nvfs_ioctl_mpage_ptr->state, NVFS_IO_META_DIED);
 	kunmap_local(orig_kaddr);
+
+	// IOs polling their own metapage must see the buffer die as well
+	for (i = 0; gpu_info->io_fence_pages && i < NVFS_MAX_IO_FENCES; i++) {
+		nvfs_ioctl_mpage_ptr = nvfs_metapage_map(gpu_info, i);
+		WRITE_ONCE(nvfs_ioctl_mpage_ptr->state, NVFS_IO_META_DIED);
+		kunmap_local(nvfs_ioctl_mpage_ptr);
+	}
 	nvfs_dbg("%s: marking end fence state dead\n", __func__);
 
 	// Reference taken during nvfs_map()
@@ -380,10 +458,63 @@ static void nvfs_get_pages_free_callback(void *data)
  * Retrieve DMA Addresses through nvidia_p2p_dma_map_pages.
  * This will map the GPU BAR pages into device I/O address space.
  */
+/*
+ * Collapse the DMA addresses of the mapping into runs of contiguous GPU
+ * pages, looked up by nvfs_get_dma() instead of walking the pages.
+ */
+static struct nvfs_dma_run *
+nvfs_build_dma_runs(struct nvidia_p2p_dma_mapping *dma_mapping, int n_runs,
+		    unsigned int gpu_page_shift)
+{
+	struct nvfs_dma_run *runs, *run;
+	int i;
+
+	runs = kmalloc_array(n_runs, sizeof(*runs), GFP_KERNEL);
+	if (!runs)
+		return NULL;
+
+	run = runs;
+	run->gpu_index = 0;
+	run->npages = 1;
+	run->dma_addr = dma_mapping->dma_addresses[0];
+	for (i = 1; i < dma_mapping->entries; i++) {
+		if (dma_mapping->dma_addresses[i - 1] + (1ULL << gpu_page_shift) ==
+		    dma_mapping->dma_addresses[i]) {
+			run->npages++;
+			continue;
+		}
+		run++;
+		run->gpu_index = i;
+		run->npages = 1;
+		run->dma_addr = dma_mapping->dma_addresses[i];
+	}
+	BUG_ON(run - runs + 1 != n_runs);
+	return runs;
+}
+
+static const struct nvfs_dma_run *
+nvfs_find_dma_run(const struct nvfs_dma_run *runs, int n_runs, unsigned long gpu_index)
+{
+	int lo = 0, hi = n_runs - 1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (gpu_index < runs[mid].gpu_index)
+			hi = mid - 1;
+		else if (gpu_index >= runs[mid].gpu_index + runs[mid].npages)
+			lo = mid + 1;
+		else
+			return &runs[mid];
+	}
+	return NULL;
+}
+
 static int
 nvfs_get_dma_address(nvfs_io_t *nvfsio,
 		struct pci_dev *peer,
-		struct nvidia_p2p_dma_mapping **dma_mapping, int *n_dma_chunks)
+		struct nvidia_p2p_dma_mapping **dma_mapping, int *n_dma_chunks,
+		struct nvfs_dma_run **runs)
 {
 	int ret;
 	struct nvfs_gpu_args *gpu_info;
@@ -392,7 +523,7 @@ nvfs_get_dma_address(nvfs_io_t *nvfsio,
 	int i;
 	int ndmachunks = 1;
 
-	nvfs_mgroup = container_of(nvfsio, struct nvfs_io_mgroup, nvfsio);
+	nvfs_mgroup = nvfsio->nvfs_mgroup;
 	gpu_info = &nvfs_mgroup->gpu_info;
 	page_table = gpu_info->page_table;
 
@@ -432,7 +563,7 @@ nvfs_get_dma_address(nvfs_io_t *nvfsio,
 		nvfs_dbg("%d DMA Addr: 0x%016llx PHY Addr: 0x%016llx\n", i,
 			 (*dma_mapping)->dma_addresses[i],
 			 page_table->pages[i]->physical_address);
-		if ((*dma_mapping)->dma_addresses[i] + GPU_PAGE_SIZE !=
+		if ((*dma_mapping)->dma_addresses[i] + (1ULL << gpu_info->gpu_page_shift) !=
 			(*dma_mapping)->dma_addresses[i + 1])
 			ndmachunks += 1;
 	}
@@ -476,13 +607,27 @@ nvfs_get_dma_address(nvfs_io_t *nvfsio,
 			nvfs_stat(&nvfs_n_err_dma_map);
 			nvfs_err("DMA Address chunks %d != GPU Physical address chunks %d\n",
 				 ndmachunks, gpu_info->n_phys_chunks);
-			return -1;
+			nvfs_nvidia_p2p_dma_unmap_pages(peer, page_table, *dma_mapping);
+			*dma_mapping = NULL;
+			return -ERANGE;
 		}
 	}
 
+	*runs = nvfs_build_dma_runs(*dma_mapping, ndmachunks,
+				    gpu_info->gpu_page_shift);
+	if (*runs == NULL) {
+		nvfs_err("%s:%d unable to allocate %d DMA runs\n",
+			 __func__, __LINE__, ndmachunks);
+		if (nvfs_nvidia_p2p_dma_unmap_pages(peer, page_table, *dma_mapping))
+			nvfs_err("%s:%d error while invoking unmap pages\n",
+				 __func__, __LINE__);
+		*dma_mapping = NULL;
+		return -ENOMEM;
+	}
+
 	return 0;
 out:
-	return -1;
+	return ret;
 }
 
 static struct pci_dev_mapping *nvfs_get_pci_dev_mapping(
@@ -499,115 +644,179 @@ static struct pci_dev_mapping *nvfs_get_pci_dev_mapping(
 	return NULL;
 }
 
+/*
+ * Backoff before a peer that failed to map is tried again: doubles with
+ * every consecutive failure, from NVFS_P2P_MAP_BACKOFF_MIN_MS up to
+ * NVFS_P2P_MAP_BACKOFF_MAX_MS.
+ */
+static unsigned long nvfs_p2p_map_backoff(unsigned int nfails)
+{
+	unsigned long ms = NVFS_P2P_MAP_BACKOFF_MIN_MS;
+
+	while (--nfails && ms < NVFS_P2P_MAP_BACKOFF_MAX_MS)
+		ms <<= 1;
+	return msecs_to_jiffies(min_t(unsigned long, ms, NVFS_P2P_MAP_BACKOFF_MAX_MS));
+}
+
+static inline bool nvfs_p2p_map_backoff_pending(struct pci_dev_mapping *pci_dev_mapping)
+{
+	return READ_ONCE(pci_dev_mapping->err) &&
+		time_before(jiffies, READ_ONCE(pci_dev_mapping->retry_at));
+}
+
+/*
+ * Mappings are created per peer: a placeholder entry is hashed while the
+ * buffer gets mapped for the peer, IOs to the same peer wait for its
+ * completion while mappings for other peers proceed in parallel.
+ *
+ * A peer that fails to map stays hashed as a negative entry holding the
+ * error, IOs to it fail fast until its backoff expires and the next IO
+ * replaces it with a new placeholder to map the peer again.
+ */
 struct nvidia_p2p_dma_mapping*
 nvfs_get_p2p_dma_mapping(struct pci_dev *peer, struct nvfs_gpu_args *gpu_info,
-			 struct nvfs_io *nvfsio, int *n_dma_chunks)
+			 struct nvfs_io *nvfsio, int *n_dma_chunks,
+			 const struct nvfs_dma_run **runs)
 {
 	struct nvidia_p2p_dma_mapping *dma_mapping = NULL;
-	struct pci_dev_mapping *pci_dev_mapping;
+	struct pci_dev_mapping *pci_dev_mapping, *new = NULL;
+	struct nvfs_dma_run *new_runs = NULL;
+	int pci_devid = NVFS_GET_PCI_DEVID(peer);
+	int ret;
 	*n_dma_chunks = 0;
+	*runs = NULL;
 retry:
 	rcu_read_lock();
-	pci_dev_mapping = nvfs_get_pci_dev_mapping(gpu_info,
-			NVFS_GET_PCI_DEVID(peer));
-	rcu_read_unlock();
-	if (pci_dev_mapping) {
+	pci_dev_mapping = nvfs_get_pci_dev_mapping(gpu_info, pci_devid);
+	if (pci_dev_mapping && smp_load_acquire(&pci_dev_mapping->ready)) {
 		*n_dma_chunks = pci_dev_mapping->n_dma_chunks;
-		return pci_dev_mapping->dma_mapping;
+		*runs = pci_dev_mapping->runs;
+		dma_mapping = pci_dev_mapping->dma_mapping;
+		rcu_read_unlock();
+		kfree(new);
+		return dma_mapping;
 	}
+	if (pci_dev_mapping && nvfs_p2p_map_backoff_pending(pci_dev_mapping)) {
+		rcu_read_unlock();
+		goto fail_fast;
+	}
+	rcu_read_unlock();
 
-	if (atomic_cmpxchg(&gpu_info->dma_mapping_in_progress, 0, 1) == 0) {
-		struct pci_dev_mapping *pci_mapping = NULL;
-
-		pci_dev_mapping = kmalloc(sizeof(struct pci_dev_mapping), GFP_KERNEL);
-		if (!pci_dev_mapping)
-			goto done;
-
-		/* Check if we are not racing with someone else */
-		pci_mapping = nvfs_get_pci_dev_mapping(gpu_info, NVFS_GET_PCI_DEVID(peer));
-		if (pci_mapping) {
-			kfree(pci_dev_mapping);
-			pci_dev_mapping = NULL;
-			dma_mapping = pci_mapping->dma_mapping;
-			*n_dma_chunks = pci_mapping->n_dma_chunks;
-			goto done;
-		}
-
-		if (nvfs_get_dma_address(nvfsio, peer, &dma_mapping, n_dma_chunks)) {
-			kfree(pci_dev_mapping);
-			pci_dev_mapping = NULL;
-			dma_mapping = NULL;
-			goto done;
+	if (new == NULL) {
+		new = kzalloc(sizeof(struct pci_dev_mapping), GFP_KERNEL);
+		if (!new)
+			return NULL;
+		new->pci_dev = peer;
+		init_completion(&new->done);
+		refcount_set(&new->ref, 1);
+	}
+
+	spin_lock(&gpu_info->dma_mapping_lock);
+	/* Check if we are not racing with someone else */
+	pci_dev_mapping = nvfs_get_pci_dev_mapping(gpu_info, pci_devid);
+	if (pci_dev_mapping && !pci_dev_mapping->err) {
+		refcount_inc(&pci_dev_mapping->ref);
+		spin_unlock(&gpu_info->dma_mapping_lock);
+		wait_for_completion(&pci_dev_mapping->done);
+		ret = READ_ONCE(pci_dev_mapping->err);
+		nvfs_put_pci_dev_mapping(pci_dev_mapping);
+		// the peer failed to map meanwhile, don't map it again
+		if (ret)
+			goto fail_fast;
+		goto retry;
+	}
+	if (pci_dev_mapping) {
+		if (nvfs_p2p_map_backoff_pending(pci_dev_mapping)) {
+			spin_unlock(&gpu_info->dma_mapping_lock);
+			goto fail_fast;
 		}
+		// backoff expired, replace the negative entry and map again
+		new->nfails = pci_dev_mapping->nfails;
+		hash_del_rcu(&pci_dev_mapping->hentry);
+		nvfs_put_pci_dev_mapping(pci_dev_mapping);
+	}
+	hash_add_rcu(gpu_info->buckets, &new->hentry, pci_devid);
+	atomic_inc(&gpu_info->dma_mapping_in_progress);
+	spin_unlock(&gpu_info->dma_mapping_lock);
+	pci_dev_mapping = new;
 
-		pci_dev_mapping->pci_dev = peer;
-		pci_dev_mapping->dma_mapping = dma_mapping;
-		pci_dev_mapping->n_dma_chunks = *n_dma_chunks;
-
-		nvfs_dbg("Adding to hash-table gpu_info-nvfsio: %p-%p PCI_DEVID %d\n",
-			 gpu_info, nvfsio, NVFS_GET_PCI_DEVID(peer));
-
-		nvfs_dbg("nvfs dma device affinity gpu:"PCI_INFO_FMT" peer: %04x:%02x:%02x:%d\n",
+	ret = nvfs_get_dma_address(nvfsio, peer, &dma_mapping, n_dma_chunks, &new_runs);
+	if (ret) {
+		pci_dev_mapping->nfails++;
+		WRITE_ONCE(pci_dev_mapping->retry_at,
+			   jiffies + nvfs_p2p_map_backoff(pci_dev_mapping->nfails));
+		WRITE_ONCE(pci_dev_mapping->err, ret);
+		atomic_dec(&gpu_info->dma_mapping_in_progress);
+
+		nvfs_stat(&nvfs_n_p2p_map_err);
+		nvfs_update_peer_map_err(gpu_info->gpu_hash_index, nvfs_pdevinfo(peer));
+		nvfs_err("%s:%d unable to map gpu:"PCI_INFO_FMT" for peer: %04x:%02x:%02x:%d error %d, retry in %u ms\n",
+			 __func__, __LINE__,
 			 PCI_INFO_DOMAIN(gpu_info->pdevinfo), PCI_INFO_BUS(gpu_info->pdevinfo),
 			 PCI_INFO_SLOT(gpu_info->pdevinfo), PCI_INFO_FUNC(gpu_info->pdevinfo),
 			 peer->bus ? pci_domain_nr(peer->bus) : 0,
 			 peer->bus ? peer->bus->number : 0,
-			 PCI_SLOT(peer->devfn),
-			 PCI_FUNC(peer->devfn));
-
-		hash_add_rcu(gpu_info->buckets,
-			     &pci_dev_mapping->hentry,
-			     NVFS_GET_PCI_DEVID(peer));
-	} else {
-		wait_event(gpu_info->callback_wq, (atomic_read(&gpu_info->dma_mapping_in_progress) == 0));
-		goto retry;
+			 PCI_SLOT(peer->devfn), PCI_FUNC(peer->devfn), ret,
+			 jiffies_to_msecs(nvfs_p2p_map_backoff(pci_dev_mapping->nfails)));
+		// last access, a buffer teardown waiting for it may free the entry
+		complete_all(&pci_dev_mapping->done);
+		*n_dma_chunks = 0;
+		return NULL;
 	}
-done:
-	atomic_set(&gpu_info->dma_mapping_in_progress, 0);
-	wake_up_all(&gpu_info->callback_wq);
+
+	pci_dev_mapping->dma_mapping = dma_mapping;
+	pci_dev_mapping->n_dma_chunks = *n_dma_chunks;
+	pci_dev_mapping->runs = new_runs;
+	*runs = new_runs;
+	atomic_dec(&gpu_info->dma_mapping_in_progress);
+	smp_store_release(&pci_dev_mapping->ready, true);
+	complete_all(&pci_dev_mapping->done);
+
+	nvfs_dbg("Adding to hash-table gpu_info-nvfsio: %p-%p PCI_DEVID %d\n",
+		 gpu_info, nvfsio, pci_devid);
+
+	nvfs_dbg("nvfs dma device affinity gpu:"PCI_INFO_FMT" peer: %04x:%02x:%02x:%d\n",
+		 PCI_INFO_DOMAIN(gpu_info->pdevinfo), PCI_INFO_BUS(gpu_info->pdevinfo),
+		 PCI_INFO_SLOT(gpu_info->pdevinfo), PCI_INFO_FUNC(gpu_info->pdevinfo),
+		 peer->bus ? pci_domain_nr(peer->bus) : 0,
+		 peer->bus ? peer->bus->number : 0,
+		 PCI_SLOT(peer->devfn),
+		 PCI_FUNC(peer->devfn));
+
 	return dma_mapping;
+
+fail_fast:
+	kfree(new);
+	nvfs_stat64(&nvfs_n_p2p_map_fail_fast);
+	return NULL;
 }
 
 /*
- * Get the DMA address. This function gets invoked for each 4k pages
- * in the block I/O request
+ * Get the DMA address of a shadow page of @nvfs_mgroup for @peer. The caller
+ * holds the mgroup references.
  */
-int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_length)
+static int __nvfs_get_dma(struct pci_dev *peer, struct page *page,
+			  nvfs_mgroup_ptr_t nvfs_mgroup,
+			  void **gpu_base_dma, int dma_length)
 {
 	struct nvidia_p2p_dma_mapping *dma_mapping;
-	struct pci_dev *peer = device;
-	struct folio *folio = NULL;
+	struct folio *folio = page_folio(page);
 	dma_addr_t dma_base_addr, dma_start_addr;
 	unsigned long gpu_page_index = ULONG_MAX;
+	unsigned long table_index;
 	struct nvfs_io *nvfsio;
 	pgoff_t pgoff = 0;
-	nvfs_mgroup_ptr_t nvfs_mgroup;
+	u64 table_off;
 	struct nvfs_gpu_args *gpu_info;
 	uint64_t pdevinfo;
 	int n_dma_chunks;
-
-	if (gpu_base_dma == NULL)
-		goto bad_request;
-
-	*gpu_base_dma = NULL;
-
-	// Check and get the metadata in page if in correct state,
-	// otherwise bailout.
-
-	folio = page_folio(page);
-	nvfs_mgroup = nvfs_mgroup_from_folio(folio);
-
-	if (nvfs_mgroup == NULL)
-		goto bad_request;
-
-	if (IS_ERR(nvfs_mgroup))
-		goto exit;
+	const struct nvfs_dma_run *runs, *run;
 
 	// Get the gpu_index and page offset within the gpu page
 	// for this shadow page.
-	nvfs_mgroup_get_gpu_index_and_off_folio(nvfs_mgroup, folio,
+	nvfs_mgroup_get_gpu_index_and_off(nvfs_mgroup, page,
 				&gpu_page_index, &pgoff);
-	nvfsio = &nvfs_mgroup->nvfsio;
+	nvfsio = nvfs_mgroup_folio_to_io(nvfs_mgroup, folio);
 	gpu_info = &nvfs_mgroup->gpu_info;
 
 	// Peer affinity stat.
@@ -615,10 +824,11 @@ int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_l
 	if (nvfs_peer_stats_enabled)
 		nvfs_update_peer_usage(gpu_info->gpu_hash_index, pdevinfo);
 
-	dma_mapping = nvfs_get_p2p_dma_mapping(peer, gpu_info, nvfsio, &n_dma_chunks);
+	dma_mapping = nvfs_get_p2p_dma_mapping(peer, gpu_info, nvfsio, &n_dma_chunks, &runs);
 
+	// failures to map the peer are logged once per attempt
 	if (dma_mapping == NULL)
-		goto exit;
+		return NVFS_IO_ERR;
 
 	nvfs_dbg("Found GPU Mapping for folio index %lx, %lx gpu_page_index %lu/%u page_offset %lx\n",
 		 folio->index,
@@ -626,13 +836,19 @@ int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_l
 		 (dma_mapping->entries - 1),
 		 (unsigned long) pgoff);
 
-	// GPU page aligned, 64K
-	if (unlikely(gpu_page_index >= dma_mapping->entries)) {
-		pr_err("gpu_page_index :%lu dma_mapping->entries :%u\n",
-		       gpu_page_index, dma_mapping->entries);
+	// GPU page aligned, 64K, within a page table entry of the GPU page size
+	table_index = nvfs_gpu_table_index(gpu_info, gpu_page_index);
+	table_off = nvfs_gpu_table_offset(gpu_info, gpu_page_index);
+	if (unlikely(table_index >= dma_mapping->entries)) {
+		pr_err("gpu_page_index :%lu table_index :%lu dma_mapping->entries :%u\n",
+		       gpu_page_index, table_index, dma_mapping->entries);
 		BUG();
 	}
-	dma_base_addr = dma_mapping->dma_addresses[gpu_page_index];
+	run = nvfs_find_dma_run(runs, n_dma_chunks, table_index);
+	BUG_ON(run == NULL);
+	dma_base_addr = run->dma_addr +
+		((u64)(table_index - run->gpu_index) << gpu_info->gpu_page_shift) +
+		table_off;
 	BUG_ON(dma_base_addr == 0);
 
 	// 4K page-level offset
@@ -644,9 +860,6 @@ int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_l
 	dma_start_addr = dma_base_addr + DMA_DISCONTIG_OFF;
 #endif
 
-	atomic_inc(&nvfs_mgroup->dma_ref);
-	// The mgroup reference is dropped in nvfs_dma_unmap call
-
 	/*
 	 * nvidia_p2p_get_page() get the GPU Physical address (BAR Memory). When this physical address
 	 * is mapped per PCI Device to get the DMA Address using nvidia_p2p_dma_map_pages(), we may or
@@ -674,37 +887,24 @@ int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_l
 	 * 128k-160k and 192k-224k -> which maps to 128k-192k GPU Phys address
 	 *
 	 * We may have a SG entry with 64k as segment size, but the DMA addresses for the entire 64k segment
-	 * are not contiguous.
+	 * are not contiguous. The whole sg has to fit in the DMA run of its first GPU page.
 	 */
 	if ((dma_length > GPU_PAGE_SIZE) && (n_dma_chunks > 1)) {
-		dma_addr_t start_addr = dma_start_addr;
-		int gpu_iter_index = gpu_page_index;
-		size_t sg_length = dma_length;
-
-		while (dma_length > 0) {
-			if (dma_length > GPU_PAGE_SIZE) {
-				dma_length -= GPU_PAGE_SIZE;
-				start_addr += GPU_PAGE_SIZE;
-				gpu_iter_index += 1;
-
-				// If this is true, then sg->length isn't right
-				if (gpu_iter_index >= dma_mapping->entries) {
-					nvfs_err("Invalid sg->length %ld set as it is beyond the DMA address range\n",
-						 sg_length);
-					goto exit;
-				}
+		unsigned long last_index = table_index +
+			((table_off + pgoff + dma_length - 1) >> gpu_info->gpu_page_shift);
+
+		// If this is true, then sg->length isn't right
+		if (last_index >= dma_mapping->entries) {
+			nvfs_err("Invalid sg->length %d set as it is beyond the DMA address range\n",
+				 dma_length);
+			goto exit;
+		}
 
-				if (start_addr != dma_mapping->dma_addresses[gpu_iter_index]) {
-					nvfs_err("DMA Address range are not contiguous for the give sg->length. sg->length %ld gpu_iter_index %ld dma_length %ld start_addr %ld next_addr %ld n_dma_chunks %d\n",
-						 (unsigned long) sg_length, (unsigned long) gpu_iter_index,
-						 (unsigned long) dma_length, (unsigned long) start_addr,
-						 (unsigned long) dma_mapping->dma_addresses[gpu_iter_index],
-						 n_dma_chunks);
-					goto exit;
-				}
-			} else {
-				break;
-			}
+		if (last_index >= run->gpu_index + run->npages) {
+			nvfs_err("DMA Address range are not contiguous for the give sg->length. sg->length %d table_index %lu run %lu-%lu n_dma_chunks %d\n",
+				 dma_length, table_index, run->gpu_index,
+				 run->gpu_index + run->npages - 1, n_dma_chunks);
+			goto exit;
 		}
 	}
 
@@ -715,23 +915,63 @@ int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_l
 	return 0;
 
 exit:
-	if (nvfs_mgroup && !IS_ERR(nvfs_mgroup))
-		nvfs_mgroup_put_dma(nvfs_mgroup);
-
 	nvfs_err("Unable to obtain dma_mapping for %lx\n", gpu_page_index);
 	return NVFS_IO_ERR;
-bad_request:
-	return NVFS_BAD_REQ;
 }
 
-nvfs_io_sparse_dptr_t nvfs_io_map_sparse_data(nvfs_mgroup_ptr_t nvfs_mgroup)
+/*
+ * Get the DMA address. This function gets invoked for each 4k pages
+ * in the block I/O request
+ */
+int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_length)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup;
+	int ret;
+
+	if (gpu_base_dma == NULL)
+		return NVFS_BAD_REQ;
+
+	*gpu_base_dma = NULL;
+
+	// Check and get the metadata in page if in correct state,
+	// otherwise bailout.
+	nvfs_mgroup = nvfs_mgroup_from_folio(page_folio(page));
+
+	if (nvfs_mgroup == NULL)
+		return NVFS_BAD_REQ;
+
+	if (IS_ERR(nvfs_mgroup))
+		return NVFS_IO_ERR;
+
+	ret = __nvfs_get_dma(device, page, nvfs_mgroup, gpu_base_dma, dma_length);
+	if (ret) {
+		nvfs_mgroup_put_dma(nvfs_mgroup);
+		return ret;
+	}
+
+	atomic_inc(&nvfs_mgroup->dma_ref);
+	// The mgroup reference is dropped in nvfs_dma_unmap call
+	return 0;
+}
+
+/*
+ * Get the DMA address of a page of a request for which the caller already
+ * holds the mgroup and dma references, see nvfs_dma_map_sg_attrs_internal().
+ */
+int nvfs_get_dma_held(void *device, struct page *page, nvfs_mgroup_ptr_t nvfs_mgroup,
+		      void **gpu_base_dma, int dma_length)
+{
+	*gpu_base_dma = NULL;
+	return __nvfs_get_dma(device, page, nvfs_mgroup, gpu_base_dma, dma_length);
+}
+
+nvfs_io_sparse_dptr_t nvfs_io_map_sparse_data(nvfs_io_t *nvfsio)
 {
 	nvfs_ioctl_metapage_ptr_t nvfs_ioctl_mpage_ptr;
 	nvfs_io_sparse_dptr_t sparse_ptr;
-	void *kaddr = kmap_local_page(nvfs_mgroup->gpu_info.end_fence_page);
 
-	kaddr = (void *)((char *)kaddr + nvfs_mgroup->gpu_info.offset_in_page);
-	nvfs_ioctl_mpage_ptr = (nvfs_ioctl_metapage_ptr_t) kaddr;
+	nvfs_ioctl_mpage_ptr = nvfs_metapage_map(&nvfsio->nvfs_mgroup->gpu_info,
+						 nvfsio->io_fence);
 	sparse_ptr = &nvfs_ioctl_mpage_ptr->sparse_data;
 	sparse_ptr->nvfs_start_magic = NVFS_START_MAGIC;
 	sparse_ptr->nvfs_meta_version = 1;
@@ -751,11 +991,19 @@ void nvfs_io_unmap_sparse_data(nvfs_io_sparse_dptr_t ptr,
 
 void nvfs_io_free(nvfs_io_t *nvfsio, long res)
 {
-	nvfs_mgroup_ptr_t nvfs_mgroup = container_of(nvfsio,
-						     struct nvfs_io_mgroup,
-						     nvfsio);
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
 	struct nvfs_gpu_args *gpu_info = &nvfs_mgroup->gpu_info;
 	bool sync = 0;
+	bool teardown;
+	u64 end_fence_value;
+	struct mm_struct *chain_mm;
+	const struct cred *chain_cred;
+	nvfs_io_done_t io_done;
+	void *io_done_data;
+	u64 user_data;
+	enum nvfs_metastate state;
+	bool cancelled, end_fence;
+	int io_fence;
 
 	nvfs_dbg("%s:%d IO State %s nvfsio :%p\n",
 		 __func__,
@@ -790,43 +1038,84 @@ void nvfs_io_free(nvfs_io_t *nvfsio, long res)
 
 	/* Because the below combination of mgroup put and transit state can
 	 * free up the mgroup, it's better to catch the sync state in a local variable
-	 * so that we do not access any junk memory.
+	 * so that we do not access any junk memory. The IO slot can be reused
+	 * by another IO as soon as it is released.
 	 */
 	sync = nvfsio->sync;
-
+	end_fence_value = nvfsio->end_fence_value;
+	chain_mm = nvfsio->chain_mm;
+	chain_cred = nvfsio->chain_cred;
+	io_done = nvfsio->io_done;
+	io_done_data = nvfsio->io_done_data;
+	user_data = nvfsio->user_data;
+	state = nvfsio->state;
+	io_fence = nvfsio->io_fence;
+	cancelled = nvfs_batch_io_detach(nvfsio);
+	end_fence = !sync && !io_done && !cancelled;
+
+	// an end fence IO keeps its metapage until the end fence is written
+	if (io_fence >= 0 && !end_fence)
+		clear_bit_unlock(io_fence, &gpu_info->io_fences_busy);
+
+	/* Do not use nvfsio object after the slot is released */
+	teardown = nvfs_mgroup_io_slot_put(nvfsio);
 	nvfs_mgroup_put(nvfs_mgroup);
-	nvfs_transit_state(gpu_info, sync, IO_IN_PROGRESS, IO_READY);
+	// last IO in flight, finish the termination requested meanwhile
+	if (teardown)
+		nvfs_transit_state_failed(gpu_info, sync);
 
-	/* Do not use nvfsio object after we update the end fence page
-	 * for user-space.
-	 */
+	// the IO owner reaps the completion instead of polling the end fence
+	if (io_done)
+		io_done(io_done_data, user_data, res, state);
 
 	/* For Async case, it's certain that mgroup wouldn't have been freed and hence
 	 * we can mark the state Async state as Done after mgroup put as well.
+	 * Nobody waits for the end fence of a cancelled batch IO.
 	 */
-	if (!sync) {
-		nvfs_ioctl_metapage_ptr_t mpage_ptr;
-		void *kaddr = kmap_local_page(gpu_info->end_fence_page);
-		void *orig_kaddr = kaddr;
-
-		kaddr = (void *)((char *) kaddr + gpu_info->offset_in_page);
-		mpage_ptr = (nvfs_ioctl_metapage_ptr_t) kaddr;
+	if (end_fence) {
+		nvfs_ioctl_metapage_ptr_t mpage_ptr = nvfs_metapage_map(gpu_info, io_fence);
 
 		// User space library is polling on these values.
 		WRITE_ONCE(mpage_ptr->result, res);
 
 		// Use memory barrier to sync free pages
 		wmb();
-		nvfs_dbg("freeing nvfs io end_fence_page: %llx and offset in page : %u in kernel\n",
-				(u64)gpu_info->end_fence_page, gpu_info->offset_in_page);
+		nvfs_dbg("freeing nvfs io end_fence_page: %llx and offset in page : %u io fence %d in kernel\n",
+				(u64)gpu_info->end_fence_page, gpu_info->offset_in_page, io_fence);
 
-		WRITE_ONCE(mpage_ptr->end_fence_val, nvfsio->end_fence_value);
+		WRITE_ONCE(mpage_ptr->end_fence_val, end_fence_value);
 
-		kunmap_local(orig_kaddr);
+		kunmap_local(mpage_ptr);
+		if (io_fence >= 0)
+			clear_bit_unlock(io_fence, &gpu_info->io_fences_busy);
 
 		nvfs_dbg("Async - nvfs_io complete. res %ld\n",
 				res);
 	}
+
+	// chained IO is always freed from process context
+	if (chain_mm)
+		mmdrop(chain_mm);
+	if (chain_cred)
+		put_cred(chain_cred);
+}
+
+static void nvfs_io_chain_work(struct work_struct *work);
+
+/*
+ * Bytes issued per direct IO: the shadow window, capped for fragmented GPU
+ * buffers so that each block request fits in NVME_MAX_SEGS sg entries.
+ */
+static unsigned long nvfs_io_chunk_size(nvfs_io_t *nvfsio)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
+	unsigned long size = min(nvfsio->window_nfolios << NVFS_BLOCKS_PER_FOLIO_SHIFT,
+				 nvfs_mgroup->nvfs_blocks_count) * NVFS_BLOCK_SIZE;
+
+	// rdma IOs don't go through block requests
+	if (nvfs_mgroup->gpu_info.max_io_size && !nvfsio->use_rkeys)
+		size = min_t(unsigned long, size, nvfs_mgroup->gpu_info.max_io_size);
+	return size;
 }
 
 /*
@@ -839,13 +1128,11 @@ static void nvfs_io_complete(struct kiocb *kiocb, long res)
 #endif
 {
 	nvfs_io_t *nvfsio = container_of(kiocb, struct nvfs_io, common);
-	nvfs_mgroup_ptr_t nvfs_mgroup = container_of(nvfsio,
-						struct nvfs_io_mgroup,
-						nvfsio);
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
 
 	nvfsio->ret = res;
 
-	nvfs_mgroup_check_and_set(nvfs_mgroup, NVFS_IO_DONE, res >= 0, true);
+	nvfs_mgroup_check_and_set(nvfs_mgroup, nvfsio, NVFS_IO_DONE, res >= 0, true);
 
 	res = nvfsio->ret;
 
@@ -884,8 +1171,16 @@ static void nvfs_io_complete(struct kiocb *kiocb, long res)
 		}
 	}
 
-	if (!nvfsio->sync)
-		nvfs_io_free(nvfsio, res);
+	if (!nvfsio->sync) {
+		if (nvfsio->chain_mm) {
+			// next chunk is issued from process context
+			nvfsio->chain_res = res;
+			nvfs_get_ops();
+			queue_work(system_unbound_wq, &nvfsio->chain_work);
+		} else {
+			nvfs_io_free(nvfsio, res);
+		}
+	}
 
 	nvfs_put_ops();
 	nvfs_dbg("%s %ld\n", __func__, res);
@@ -1115,6 +1410,9 @@ out:
 
 static int nvfs_close(struct inode *inode, struct file *file)
 {
+#ifdef NVFS_RING_SUPPORT
+	nvfs_ring_release(file);
+#endif
 	mutex_lock(&nvfs_module_mutex);
 	nvfs_put_ops();
 	if (nvfs_count_ops() == 0) {
@@ -1133,8 +1431,27 @@ static void nvfs_remove(int pid, struct mm_struct *mm)
 	nvfs_dbg("%s: Remove callback\n", __func__);
 }
 
+static void nvfs_put_io_fence_pages(struct page **pages, unsigned int npages)
+{
+#ifdef HAVE_PIN_USER_PAGES_FAST
+	unpin_user_pages(pages, npages);
+#else
+	unsigned int i;
+
+	for (i = 0; i < npages; i++)
+		put_page(pages[i]);
+#endif
+}
+
 static void nvfs_free_put_endfence_page(struct nvfs_gpu_args *gpu_info)
 {
+	if (gpu_info->io_fence_pages) {
+		nvfs_put_io_fence_pages(gpu_info->io_fence_pages, gpu_info->nr_io_fence_pages);
+		kfree(gpu_info->io_fence_pages);
+		gpu_info->io_fence_pages = NULL;
+		gpu_info->nr_io_fence_pages = 0;
+	}
+
 	if (gpu_info->end_fence_page) {
 #ifdef HAVE_PIN_USER_PAGES_FAST
 		unpin_user_page(gpu_info->end_fence_page);
@@ -1145,10 +1462,50 @@ static void nvfs_free_put_endfence_page(struct nvfs_gpu_args *gpu_info)
 	}
 }
 
+/*
+ * Pin the NVFS_MAX_IO_FENCES metapages of NVFS_MAP_IO_FENCES, one per IO in
+ * flight on the buffer.
+ */
+static int nvfs_get_io_fence_pages(void *end_fence, struct nvfs_gpu_args *gpu_info)
+{
+	unsigned int npages = DIV_ROUND_UP(offset_in_page(end_fence) +
+					   NVFS_MAX_IO_FENCES * NVFS_BLOCK_SIZE, PAGE_SIZE);
+	struct page **pages;
+	int ret;
+
+	BUILD_BUG_ON(NVFS_MAX_IO_FENCES > BITS_PER_LONG);
+	// the metapages are 4K apart, holes included
+	BUILD_BUG_ON(offsetof(struct nvfs_ioctl_metapage, sparse_data.hole) +
+		     NVFS_MAX_HOLE_REGIONS * sizeof(struct nvfs_io_hole) > NVFS_BLOCK_SIZE);
+
+	pages = kcalloc(npages, sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+#ifdef HAVE_PIN_USER_PAGES_FAST
+	ret = pin_user_pages_fast((unsigned long) end_fence, npages, 1, pages);
+#else
+	ret = get_user_pages_fast((unsigned long) end_fence, npages, 1, pages);
+#endif
+	if (ret != npages) {
+		nvfs_err("%s:%d unable to pin %u io fence pages ret = %d\n",
+			 __func__, __LINE__, npages, ret);
+		if (ret > 0)
+			nvfs_put_io_fence_pages(pages, ret);
+		kfree(pages);
+		return ret < 0 ? ret : -EFAULT;
+	}
+
+	gpu_info->io_fence_pages = pages;
+	gpu_info->nr_io_fence_pages = npages;
+	gpu_info->io_fences_busy = 0;
+	return 0;
+}
+
 /*
  * setup end_fence buffer for Async IO operations
  */
-static int nvfs_get_endfence_page(nvfs_ioctl_map_t *input_param,
+static int nvfs_get_endfence_page(nvfs_ioctl_map_t *input_param, u32 flags,
 	struct nvfs_gpu_args *gpu_info)
 {
 	int ret = -EINVAL;
@@ -1191,6 +1548,19 @@ static int nvfs_get_endfence_page(nvfs_ioctl_map_t *input_param,
 
 	gpu_info->offset_in_page = (u32)((u64)end_fence % PAGE_SIZE);
 	nvfs_dbg("successfully pinned end fence address : %llx, end_fence_page : %llx offset in page : %ux in kernel\n", (u64)end_fence, (u64)gpu_info->end_fence_page, gpu_info->offset_in_page);
+
+	if (flags & NVFS_MAP_IO_FENCES) {
+		ret = nvfs_get_io_fence_pages(end_fence, gpu_info);
+		if (ret) {
+#ifdef HAVE_PIN_USER_PAGES_FAST
+			unpin_user_page(gpu_info->end_fence_page);
+#else
+			put_page(gpu_info->end_fence_page);
+#endif
+			gpu_info->end_fence_page = NULL;
+			goto out;
+		}
+	}
 	return 0;
 out:
 	return ret;
@@ -1215,23 +1585,22 @@ static int nvfs_unpin_gpu_pages(struct nvfs_gpu_args *gpu_info)
 		 */
 		hash_for_each_safe(gpu_info->buckets, bkt, tmp,
 					pci_dev_mapping, hentry) {
-			BUG_ON(pci_dev_mapping->dma_mapping == NULL);
-			BUG_ON((
-			atomic_read(&gpu_info->dma_mapping_in_progress) != 0));
-
-			ret = nvfs_nvidia_p2p_dma_unmap_pages(
-					pci_dev_mapping->pci_dev,
-					gpu_info->page_table,
-					pci_dev_mapping->dma_mapping);
-			if (ret) {
-				nvfs_err("%s:%d error while invoking unmap pages\n",
-					 __func__, __LINE__);
-				return ret;
+			nvfs_settle_pci_dev_mapping(pci_dev_mapping);
+			WARN_ON_ONCE(atomic_read(&gpu_info->dma_mapping_in_progress) != 0);
+
+			if (pci_dev_mapping->dma_mapping) {
+				ret = nvfs_nvidia_p2p_dma_unmap_pages(
+						pci_dev_mapping->pci_dev,
+						gpu_info->page_table,
+						pci_dev_mapping->dma_mapping);
+				if (ret) {
+					nvfs_err("%s:%d error while invoking unmap pages\n",
+						 __func__, __LINE__);
+					return ret;
+				}
 			}
 
-			hash_del(&pci_dev_mapping->hentry);
-			kfree(pci_dev_mapping);
-			pci_dev_mapping = NULL;
+			nvfs_unhash_pci_dev_mapping(pci_dev_mapping);
 		}
 
 		if (gpu_info->page_table && gpu_page_start) {
@@ -1259,6 +1628,27 @@ static int nvfs_unpin_gpu_pages(struct nvfs_gpu_args *gpu_info)
 	return ret;
 }
 
+/*
+ * log2 of a P2P page table page size, 0 for sizes nvfs cannot handle: the
+ * shadow buffer maps GPU memory in 64KB GPU pages which have to fit in one
+ * page table entry.
+ */
+static unsigned int nvfs_p2p_page_shift(int page_size)
+{
+	switch (page_size) {
+	case NVIDIA_P2P_PAGE_SIZE_64KB:
+		return 16;
+	case NVIDIA_P2P_PAGE_SIZE_128KB:
+		return 17;
+#ifdef HAVE_NVIDIA_P2P_PAGE_SIZE_2MB
+	case NVIDIA_P2P_PAGE_SIZE_2MB:
+		return 21;
+#endif
+	default:
+		return 0;
+	}
+}
+
 static int nvfs_pin_gpu_pages(nvfs_ioctl_map_t *input_param,
 		struct nvfs_gpu_args *gpu_info)
 {
@@ -1323,6 +1713,7 @@ static int nvfs_pin_gpu_pages(nvfs_ioctl_map_t *input_param,
 					true : false;
 
 	atomic_set(&gpu_info->dma_mapping_in_progress, 0);
+	spin_lock_init(&gpu_info->dma_mapping_lock);
 	hash_init(gpu_info->buckets);
 
 
@@ -1361,23 +1752,6 @@ static int nvfs_pin_gpu_pages(nvfs_ioctl_map_t *input_param,
 
 	nvfs_dbg("GPU page table entries: %d\n", gpu_info->page_table->entries);
 
-	for (i = 0; i < gpu_info->page_table->entries - 1; i++) {
-		nvfs_dbg("GPU Physical page[%d]=0x%016llx\n",
-			 i, gpu_info->page_table->pages[i]->physical_address);
-
-		/* Create a new segment when the physical addresses are non contiguous
-		 * or force a new segment at physical address boundary of (4G - 64k)
-		 * to handle possible SMMU mappings being non-contiguous.
-		 */
-		if ((gpu_info->page_table->pages[i]->physical_address + GPU_PAGE_SIZE) !=
-				gpu_info->page_table->pages[i + 1]->physical_address)
-			n_phys_chunks += 1;
-		else if (i > 0 && (i % NVFS_P2P_MAX_CONTIG_GPU_PAGES == 0))
-			n_phys_chunks += 1;
-	}
-
-	gpu_info->n_phys_chunks = n_phys_chunks;
-
 #ifdef CONFIG_FAULT_INJECTION
 	if (nvfs_fault_trigger(&nvfs_invalid_p2p_get_page)) {
 		ret = -EFAULT;
@@ -1387,9 +1761,19 @@ static int nvfs_pin_gpu_pages(nvfs_ioctl_map_t *input_param,
 		is_invalid_page_table_version =
 			(!NVIDIA_P2P_PAGE_TABLE_VERSION_COMPATIBLE(
 					gpu_info->page_table));
-		// We are not ready for a different page size
-		is_invalid_page_size = (gpu_info->page_table->page_size !=
-						NVIDIA_P2P_PAGE_SIZE_64KB);
+		// The page table can be in pages of 64KB or larger
+		gpu_info->gpu_page_shift = nvfs_p2p_page_shift(
+					gpu_info->page_table->page_size);
+		is_invalid_page_size = (gpu_info->gpu_page_shift == 0);
+		// Entries have to start at gpu_virt_start for the GPU page index math
+		if (!is_invalid_page_size &&
+		    ((gpu_virt_start | rounded_size) &
+		     ((1ULL << gpu_info->gpu_page_shift) - 1))) {
+			nvfs_err("%s:%d gpu buffer 0x%llx/0x%lx not aligned on GPU page size 0x%llx\n",
+				 __func__, __LINE__, gpu_virt_start, rounded_size,
+				 1ULL << gpu_info->gpu_page_shift);
+			is_invalid_page_size = true;
+		}
 		ret = -EINVAL;
 	}
 
@@ -1401,11 +1785,11 @@ static int nvfs_pin_gpu_pages(nvfs_ioctl_map_t *input_param,
 				 gpu_info->page_table->version);
 		else if (is_invalid_page_size) {
 			if (gpu_info->use_legacy_p2p_allocation) {
-				nvfs_err("%s:%d nvidia_p2p_get_pages assumption of 64KB pages failed size_id=%d\n",
+				nvfs_err("%s:%d nvidia_p2p_get_pages unsupported page size size_id=%d\n",
 					 __func__, __LINE__,
 					 gpu_info->page_table->page_size);
 			} else {
-				nvfs_err("%s:%d nvidia_p2p_get_pages_persistent assumption of 64KB pages failed size_id=%d\n",
+				nvfs_err("%s:%d nvidia_p2p_get_pages_persistent unsupported page size size_id=%d\n",
 					 __func__, __LINE__,
 					 gpu_info->page_table->page_size);
 			}
@@ -1416,6 +1800,36 @@ static int nvfs_pin_gpu_pages(nvfs_ioctl_map_t *input_param,
 		goto unpin_gpu_pages;
 	}
 
+	for (i = 0; i < gpu_info->page_table->entries - 1; i++) {
+		nvfs_dbg("GPU Physical page[%d]=0x%016llx\n",
+			 i, gpu_info->page_table->pages[i]->physical_address);
+
+		/* Create a new segment when the physical addresses are non contiguous
+		 * or force a new segment at physical address boundary of (4G - 64k)
+		 * to handle possible SMMU mappings being non-contiguous.
+		 */
+		if ((gpu_info->page_table->pages[i]->physical_address +
+		     (1ULL << gpu_info->gpu_page_shift)) !=
+				gpu_info->page_table->pages[i + 1]->physical_address)
+			n_phys_chunks += 1;
+		else if (nvfs_gpu_table_contig_split(gpu_info, i))
+			n_phys_chunks += 1;
+	}
+
+	gpu_info->n_phys_chunks = n_phys_chunks;
+
+	/*
+	 * A block request is mapped to at most NVME_MAX_SEGS sg entries, see
+	 * nvfs_blk_rq_map_sg_internal(). If the buffer is fragmented enough for
+	 * an IO to need more, IOs are issued in chunks touching at most
+	 * NVME_MAX_SEGS GPU pages. One chunk is kept spare for the IO start
+	 * not being aligned on a (4G - 64K) split.
+	 */
+	if (n_phys_chunks + 1 >= NVME_MAX_SEGS)
+		gpu_info->max_io_size = (NVME_MAX_SEGS - 1) * GPU_PAGE_SIZE;
+	else
+		gpu_info->max_io_size = 0;
+
 	nvfs_update_alloc_gpustat(gpu_info);
 	nvfs_dbg("GPU pages pinned successfully gpu_info %p\n", gpu_info);
 	return 0;
@@ -1486,12 +1900,12 @@ bool nvfs_free_gpu_info(struct nvfs_gpu_args *gpu_info, bool from_dma)
 	return 0;
 }
 
-static int nvfs_map_gpu_info(nvfs_ioctl_map_t *input_param,
+static int nvfs_map_gpu_info(nvfs_ioctl_map_t *input_param, u32 flags,
 		struct nvfs_gpu_args *gpu_info)
 {
 	int ret;
 
-	ret = nvfs_get_endfence_page(input_param, gpu_info);
+	ret = nvfs_get_endfence_page(input_param, flags, gpu_info);
 	if (ret) {
 		nvfs_err("%s:%d Error nvfs_get_endfence_page: %d\n",
 				__func__, __LINE__, ret);
@@ -1510,12 +1924,69 @@ out:
 	return ret;
 }
 
-static int nvfs_map(nvfs_ioctl_map_t *input_param)
+/*
+ * Create the P2P DMA mappings of the closest peers up front so that the
+ * first IO to each of them does not map the buffer from the dma_map path.
+ * Failures are not fatal, the IO path maps the buffer on demand.
+ */
+static void nvfs_premap_peers_dma(nvfs_mgroup_ptr_t nvfs_mgroup, unsigned int npeers)
+{
+	struct nvfs_gpu_args *gpu_info = &nvfs_mgroup->gpu_info;
+	uint64_t peers[NVFS_MAX_PREMAP_PEERS];
+	const struct nvfs_dma_run *runs;
+	nvfs_io_t *nvfsio;
+	unsigned int i, n;
+	int n_dma_chunks;
+
+	if (gpu_info->gpu_hash_index == UINT_MAX)
+		return;
+
+	n = nvfs_get_gpu_ranked_peers(gpu_info->gpu_hash_index, peers,
+				      min_t(unsigned int, npeers, NVFS_MAX_PREMAP_PEERS));
+	if (n == 0)
+		return;
+
+	// the mappings are added as for an IO, the free callback waits for it
+	nvfsio = nvfs_mgroup_io_slot_get(nvfs_mgroup);
+	if (IS_ERR(nvfsio))
+		return;
+
+	for (i = 0; i < n; i++) {
+		struct pci_dev *peer = nvfs_get_pdev_from_pdevinfo(peers[i]);
+
+		if (peer == NULL)
+			continue;
+
+		if (nvfs_get_p2p_dma_mapping(peer, gpu_info, nvfsio, &n_dma_chunks, &runs))
+			nvfs_dbg("premapped gpu_info %p for peer %04x:%02x:%02x:%d\n",
+				 gpu_info, pci_domain_nr(peer->bus), peer->bus->number,
+				 PCI_SLOT(peer->devfn), PCI_FUNC(peer->devfn));
+		else
+			nvfs_info("unable to premap gpu_info %p for peer %04x:%02x:%02x:%d\n",
+				  gpu_info, pci_domain_nr(peer->bus), peer->bus->number,
+				  PCI_SLOT(peer->devfn), PCI_FUNC(peer->devfn));
+		pci_dev_put(peer);
+	}
+
+	if (nvfs_mgroup_io_slot_put(nvfsio))
+		nvfs_transit_state_failed(gpu_info, true);
+}
+
+/*
+ * @flags is 0 for NVFS_IOCTL_MAP, NVFS_IOCTL_MAP_EXT callers pass NVFS_MAP_*.
+ */
+static int nvfs_map(nvfs_ioctl_map_t *input_param, u32 flags)
 {
 	int ret = -EINVAL;
 	nvfs_mgroup_ptr_t nvfs_mgroup = NULL;
 	struct nvfs_gpu_args *gpu_info;
 
+	if (flags & ~NVFS_MAP_FLAGS_MASK) {
+		nvfs_err("%s:%d unknown map flags 0x%x\n", __func__, __LINE__,
+			 flags);
+		return -EINVAL;
+	}
+
 	nvfs_get_ops();
 
 	nvfs_mgroup = nvfs_mgroup_pin_shadow_pages(input_param->cpuvaddr,
@@ -1534,8 +2005,9 @@ static int nvfs_map(nvfs_ioctl_map_t *input_param)
 	// This is mainly for peer stats, does not have any bearing on IO path
 	if (gpu_info->gpu_hash_index == UINT_MAX)
 		nvfs_warn("Invalid pci device info for mapping buffer\n");
+	gpu_info->numa_node = nvfs_get_numa_node_from_pdevinfo(gpu_info->pdevinfo);
 
-	ret = nvfs_map_gpu_info(input_param, gpu_info);
+	ret = nvfs_map_gpu_info(input_param, flags, gpu_info);
 	if (ret)
 		goto error;
 
@@ -1552,6 +2024,11 @@ static int nvfs_map(nvfs_ioctl_map_t *input_param)
 		 atomic_read(&nvfs_mgroup->ref),
 		 nvfs_io_state_status(atomic_read(&gpu_info->io_state)));
 
+	if (nvfs_premap_peers)
+		nvfs_premap_peers_dma(nvfs_mgroup, nvfs_premap_peers);
+	else if (flags & NVFS_MAP_PREMAP_PEERS)
+		nvfs_premap_peers_dma(nvfs_mgroup, NVFS_DEFAULT_PREMAP_PEERS);
+
 	return 0;
 
 error:
@@ -1589,8 +2066,14 @@ static inline int nvfs_check_file_permissions(int op, struct file *file, bool al
 
 /*
  * Setup nvfsio for reach READ/WRITE IOCTL operation.
+ *
+ * fixed_file, if set, is used instead of ioargs->fd and must be kept alive
+ * by the caller until the IO is freed. io_done, if set, reports the IO
+ * completion instead of the end fence metapage.
  */
-struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
+struct nvfs_io *nvfs_io_init_ext(int op, nvfs_ioctl_ioargs_t *ioargs,
+				 struct file *fixed_file,
+				 nvfs_io_done_t io_done, void *io_done_data)
 {
 	int ret = -EINVAL;
 	struct nvfs_io *nvfsio = NULL;
@@ -1629,7 +2112,16 @@ struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
 		return ERR_PTR(ret);
 	}
 
-	fd = fdget(ioargs->fd);
+	if (fixed_file) {
+		// borrowed reference, fdput() is a no-op on it
+#ifdef HAVE_STRUCT_FD_FILE_PARAM
+		fd = (struct fd){ .file = fixed_file, .flags = 0 };
+#else
+		fd = (struct fd){ .word = (unsigned long)fixed_file };
+#endif
+	} else {
+		fd = fdget(ioargs->fd);
+	}
 
 #ifdef HAVE_STRUCT_FD_FILE_PARAM
 	file = fd.file;
@@ -1706,20 +2198,14 @@ struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
 	}
 
 	gpu_info = &nvfs_mgroup->gpu_info;
-	if (!nvfs_transit_state(gpu_info, (ioargs->sync == 1), IO_READY, IO_IN_PROGRESS)) {
+	// Grab a free IO slot, moves the IO state to IO_IN_PROGRESS
+	nvfsio = nvfs_mgroup_io_slot_get(nvfs_mgroup);
+	if (IS_ERR(nvfsio)) {
 		ret = -EBUSY;
-		nvfs_dbg("Teardown in progress\n");
-		goto mgroup_put;
+		nvfs_dbg("Teardown in progress or no free IO slot\n");
+		goto put_only;
 	}
-
-	nvfs_dbg("%s:%d IO State moved from %s->%s\n",
-		 __func__, __LINE__,
-		 nvfs_io_state_status(IO_READY),
-		 nvfs_io_state_status(IO_IN_PROGRESS));
-
-	// Initialize nvfsio structure
-	nvfsio = &nvfs_mgroup->nvfsio;
-	memset(nvfsio, 0, sizeof(struct nvfs_io));
+	nvfsio->io_fence = -1;
 
 	nvfsio->start_io = ktime_get();
 	nvfsio->cpuvaddr = (char __user *) ioargs->cpuvaddr;
@@ -1727,6 +2213,8 @@ struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
 	nvfsio->hipri = (ioargs->hipri == 1);
 	nvfsio->use_rkeys = (ioargs->use_rkeys == 1);
 	nvfsio->op  = op;
+	nvfsio->io_done = io_done;
+	nvfsio->io_done_data = io_done_data;
 
 #ifndef SIMULATE_INLINE_READS
 	if ((file->f_flags & O_DIRECT) == 0) {
@@ -1748,7 +2236,7 @@ struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
 	nvfs_dbg("nvfsio init nvfsio :0x%p fd_offset :%llu use rkey: %d\n",
 		 nvfsio, ioargs->offset, nvfsio->use_rkeys);
 
-	if (!nvfsio->sync) {
+	if (!nvfsio->sync && !nvfsio->io_done) {
 		if (ioargs->end_fence_value == 0) {
 			nvfs_err("end_fence_value should be positive\n");
 			ret = -EINVAL;
@@ -1759,6 +2247,27 @@ struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
 			 ioargs->end_fence_value);
 	}
 
+	/*
+	 * Every IO of an NVFS_MAP_IO_FENCES buffer owns the metapage it names.
+	 * fence_idx used to be padding, it is only read on buffers whose owner
+	 * opted in through NVFS_IOCTL_MAP_EXT.
+	 */
+	if (gpu_info->io_fence_pages) {
+		if (ioargs->fence_idx >= NVFS_MAX_IO_FENCES) {
+			nvfs_err("%s:%d invalid fence_idx %u\n",
+				 __func__, __LINE__, ioargs->fence_idx);
+			ret = -EINVAL;
+			goto mgroup_put;
+		}
+		if (test_and_set_bit_lock(ioargs->fence_idx, &gpu_info->io_fences_busy)) {
+			nvfs_dbg("%s:%d fence_idx %u in use\n",
+				 __func__, __LINE__, ioargs->fence_idx);
+			ret = -EBUSY;
+			goto mgroup_put;
+		}
+		nvfsio->io_fence = ioargs->fence_idx;
+	}
+
 	nvfsio->retrycnt = 0;
 
 	gpu_virt_start  = (gpu_info->gpuvaddr & GPU_PAGE_MASK);
@@ -1807,6 +2316,31 @@ struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
 	if (!file_args->devptroff)
 		BUG_ON(nvfsio->cur_gpu_base_index != 0);
 
+	/*
+	 * Rkey based IO relies on the rdma segment layout of the whole shadow
+	 * buffer, it runs exclusive. So do end fence completions and sparse
+	 * reads unless the IO has its own metapage (NVFS_MAP_IO_FENCES), the
+	 * buffer metapage is shared by all of them. Other IOs share the buffer.
+	 */
+	ret = nvfs_mgroup_io_window_get(nvfsio,
+			DIV_ROUND_UP(nvfsio->gpu_page_offset + ioargs->size, GPU_PAGE_SIZE),
+			nvfsio->use_rkeys ||
+			(nvfsio->io_fence < 0 &&
+			 ((!nvfsio->sync && !nvfsio->io_done) ||
+			  (op == READ && nvfs_is_sparse(file)))));
+	if (ret) {
+		nvfs_dbg("%s:%d no free shadow window\n", __func__, __LINE__);
+		goto mgroup_put;
+	}
+
+	// async requests larger than one chunk are chained
+	if (!nvfsio->sync && ioargs->size > nvfs_io_chunk_size(nvfsio)) {
+		nvfsio->chain_mm = current->mm;
+		mmgrab(nvfsio->chain_mm);
+		nvfsio->chain_cred = get_current_cred();
+		INIT_WORK(&nvfsio->chain_work, nvfs_io_chain_work);
+	}
+
 #ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
 	// If use_rkey is set, then set the appropriate segments for this IO
 	if (nvfsio->use_rkeys) {
@@ -1820,12 +2354,14 @@ struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
 	return nvfsio;
 
 mgroup_put:
-	nvfs_dbg("%s:%d IO State moved from %s->%s\n",
-		 __func__, __LINE__,
-		 nvfs_io_state_status(IO_IN_PROGRESS),
-		 nvfs_io_state_status(IO_READY));
-	nvfs_transit_state(gpu_info, (ioargs->sync == 1), IO_IN_PROGRESS, IO_READY);
-
+	nvfs_dbg("%s:%d releasing IO slot %u\n",
+		 __func__, __LINE__, nvfsio->slot);
+	if (nvfsio->io_fence >= 0)
+		clear_bit_unlock(nvfsio->io_fence, &gpu_info->io_fences_busy);
+	if (nvfs_mgroup_io_slot_put(nvfsio))
+		nvfs_transit_state_failed(gpu_info, (ioargs->sync == 1));
+
+put_only:
 	nvfs_dbg("%s has failed. Put calling ref %d\n", __func__,
 		 atomic_read(&nvfs_mgroup->ref));
 	nvfs_mgroup_put(nvfs_mgroup);
@@ -1834,6 +2370,11 @@ fd_put:
 	return ERR_PTR(ret);
 }
 
+struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs)
+{
+	return nvfs_io_init_ext(op, ioargs, NULL, NULL, NULL);
+}
+
 static int flush_dirty_pages(struct file *file,
 		loff_t offset, size_t size, nvfs_io_t *nvfsio)
 {
@@ -1940,70 +2481,43 @@ static inline bool nvfs_need_fallocate(struct inode *inode)
 		(magic != LUSTRE_SUPER_MAGIC) && (magic != BEEGFS_SUPER_MAGIC));
 }
 
-long nvfs_io_start_op(nvfs_io_t *nvfsio)
+static inline void nvfs_io_advance_gpu_offset(nvfs_io_t *nvfsio, size_t bytes_issued)
 {
-	nvfs_mgroup_ptr_t nvfs_mgroup = container_of(nvfsio,
-						struct nvfs_io_mgroup, nvfsio);
+	u64 va_offset =  nvfsio->gpu_page_offset + bytes_issued;
+
+	nvfsio->gpu_page_offset = va_offset & (GPU_PAGE_SIZE - 1);
+	nvfsio->cur_gpu_base_index += va_offset >> GPU_PAGE_SHIFT;
+#ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
+	// clear the rdma_seg_offset
+	if (nvfsio->use_rkeys)
+		nvfsio->rdma_seg_offset = 0;
+#endif
+}
+
+/*
+ * Issue the IO in chunks of nvfs_io_chunk_size(). A sync IO loops over all the
+ * chunks here. An async IO issues one chunk, its completion queues the next
+ * one, see nvfs_io_chain_next().
+ */
+static long nvfs_io_submit(nvfs_io_t *nvfsio)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
 	struct nvfs_gpu_args  *gpu_info = &nvfs_mgroup->gpu_info;
-	ssize_t ret = 0, bytes_done = 0, bytes_left = nvfsio->length;
+	ssize_t ret = 0, bytes_done = 0;
+	ssize_t bytes_left = nvfsio->length - nvfsio->chain_bytes_done;
+	/* the IO can be freed by its completion as soon as it is issued */
+	bool sync = nvfsio->sync;
 #ifdef HAVE_STRUCT_FD_FILE_PARAM
 	struct file *f = nvfsio->fd.file;
 #else
 	struct file *f = fd_file(nvfsio->fd);
 #endif
-
-	struct inode *inode = file_inode(f);
 	loff_t fd_offset = nvfsio->fd_offset;
-	u64 va_offset = 0;
 	int op = nvfsio->op;
-	unsigned long shadow_buf_size = (nvfs_mgroup->nvfs_blocks_count) *
-						NVFS_BLOCK_SIZE;
+	// IO is looped over its shadow window, in chunks of at most max_io_size
+	unsigned long shadow_buf_size = nvfs_io_chunk_size(nvfsio);
 	ssize_t rdma_seg_offset = 0;
 
-	nvfs_dbg("Ring %s: m_pDBuffer=%lx BufferSize=%lu TotalRWSize:%ld fileOffset:%lld gpu_page_offset %llu GPU page entries=%u cur_gpu_base_index=%ld mode :%s nvfsio :%p\n",
-		 opstr(op),
-		 (unsigned long)nvfsio->cpuvaddr,
-		 shadow_buf_size,
-		 bytes_left,
-		 fd_offset,
-		 nvfsio->gpu_page_offset,
-		 gpu_info->page_table->entries,
-		 nvfsio->cur_gpu_base_index,
-		 nvfsio->sync ? "sync" : "async",
-		 nvfsio);
-
-	if (op == WRITE) {
-		bool file_is_bdev = S_ISBLK(file_inode(f)->i_mode);
-
-		// skip fallocate check for raw block device files and some file systems
-		if (!file_is_bdev && nvfs_need_fallocate(file_inode(f))) {
-			if (!f->f_op->fallocate) {
-				ret = -EIO;
-				nvfs_err("%s fallocate failed :%ld\n", opstr(op), ret);
-				nvfs_io_free(nvfsio, ret);
-				goto failed;
-			}
-
-			/* fallocate if the file size is 0*/
-			if (i_size_read(inode) == 0) {
-				ret = f->f_op->fallocate(f, 0, 0, 1);
-				if (ret < 0) {
-					nvfs_err("%s fallocate failed :%ld\n", opstr(op), ret);
-					nvfs_io_free(nvfsio, ret);
-					goto failed;
-				}
-				nvfs_dbg("fallocate success\n");
-			}
-		}
-
-		ret = flush_dirty_pages(f, fd_offset, bytes_left, nvfsio);
-		if (ret) {
-			nvfs_err("%s unable to flush dirty pages :%ld\n",
-				 opstr(op), ret);
-			nvfs_io_free(nvfsio, ret);
-			goto failed;
-		}
-	}
 #ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
 	//If this is a read operation for RDMA based file system,
 	//then set the segment offset in the RDMA Buffer
@@ -2036,7 +2550,7 @@ long nvfs_io_start_op(nvfs_io_t *nvfsio)
 			 nr_blocks, bytes_left, opstr(op), bytes_issued, nvfsio,
 			 rdma_seg_offset, nvfsio->use_rkeys);
 
-		ret = nvfs_mgroup_fill_mpages(nvfs_mgroup, nr_blocks);
+		ret = nvfs_mgroup_fill_mpages(nvfsio, nr_blocks);
 		// Check if there are any callbacks or munmaps
 		if (ret < 0) {
 			nvfs_err("%s:%d shadow buffer misaligned for gpu page_offset: 0x%llx bytes_issued: %ld bytes returning -EIO\n",
@@ -2048,6 +2562,7 @@ long nvfs_io_start_op(nvfs_io_t *nvfsio)
 
 		nvfsio->state = NVFS_IO_META_CLEAN;
 		nvfsio->ret = -EINVAL;
+		nvfsio->chain_bytes_issued = bytes_issued;
 		if (op == READ && nvfs_is_sparse(f)) {
 			nvfsio->check_sparse = true;
 			nvfs_stat64(&nvfs_n_reads_sparse_files);
@@ -2076,7 +2591,7 @@ long nvfs_io_start_op(nvfs_io_t *nvfsio)
 			goto err;
 		} else if (ret == -EIOCBQUEUED) {
 			nvfs_dbg("%s IO is enqueued\n", opstr(op));
-			if (nvfsio->sync) {
+			if (sync) {
 				nvfs_err("%s detected async IO for sync request\n", opstr(op));
 				goto err;
 			} else {
@@ -2085,6 +2600,12 @@ long nvfs_io_start_op(nvfs_io_t *nvfsio)
 			}
 		}
 
+		if (!sync) {
+			// completed inline, nvfs_io_complete() took over the IO
+			ret = 0;
+			break;
+		}
+
 		if (ret >= 0) {
 			bytes_done += ret;
 			bytes_left -= ret;
@@ -2106,29 +2627,20 @@ long nvfs_io_start_op(nvfs_io_t *nvfsio)
 
 			/* update the offset for next batch if bytes_left for sync use case */
 			if (bytes_left) {
-				BUG_ON(!nvfsio->sync);
+				BUG_ON(!sync);
 				/* advance the gpu offsets */
-				va_offset =  nvfsio->gpu_page_offset + bytes_issued;
-				nvfsio->gpu_page_offset = va_offset & (GPU_PAGE_SIZE - 1);
-				nvfsio->cur_gpu_base_index += va_offset >> GPU_PAGE_SHIFT;
-
-#ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
-				// clear the rdma_seg_offset
-				if (nvfsio->use_rkeys) {
-					rdma_seg_offset = 0;
-					nvfsio->rdma_seg_offset = 0;
-				}
-#endif
+				nvfs_io_advance_gpu_offset(nvfsio, bytes_issued);
+				rdma_seg_offset = 0;
 			}
 		}
 	}
 
-	if (nvfsio->sync) {
+	if (sync) {
 		nvfs_dbg("IO %s complete for size %lu. Number of GPU Entries DMA'ed %d\n",
 			 opstr(op), bytes_done, gpu_info->page_table->entries);
 	} else {
-		nvfs_dbg("IO %s queued for size %lu. Number of GPU Entries DMA'ed %d\n",
-			 opstr(op), bytes_done, gpu_info->page_table->entries);
+		nvfs_dbg("IO %s queued. Number of GPU Entries DMA'ed %d\n",
+			 opstr(op), gpu_info->page_table->entries);
 	}
 
 #ifdef SIMULATE_LESS_BYTES
@@ -2139,7 +2651,7 @@ long nvfs_io_start_op(nvfs_io_t *nvfsio)
 #endif
 
 err:
-	if (nvfsio->sync)
+	if (sync)
 		nvfs_io_free(nvfsio, bytes_done);
 
 failed:
@@ -2149,6 +2661,153 @@ failed:
 		return bytes_done;
 }
 
+/*
+ * Chained async IO: if the chunk completed in full and the request has
+ * bytes left, advance the IO past it. Returns false if the request is done.
+ *
+ * Chunks run one after the other in the shadow window of the IO. A request
+ * is only chained when it is larger than that window, which then spans the
+ * whole buffer: there is no free window left to run another chunk in, and
+ * splitting the window would not put more bytes in flight. Serial chunks
+ * also keep the completed byte count a prefix of the request, so a short
+ * chunk or a hole ends the request like a short read or write, with
+ * nothing issued past it.
+ */
+static bool nvfs_io_chain_next(nvfs_io_t *nvfsio, long res)
+{
+	struct nvfs_gpu_args *gpu_info = &nvfsio->nvfs_mgroup->gpu_info;
+
+	if (res < 0 || res != nvfsio->chain_bytes_issued)
+		return false;
+
+	// holes are reported for this chunk, let user space resume from here
+	if (nvfsio->state == NVFS_IO_META_SPARSE)
+		return false;
+
+	if (nvfsio->chain_bytes_done + res >= nvfsio->length)
+		return false;
+
+	if (atomic_read(&gpu_info->io_state) != IO_IN_PROGRESS)
+		return false;
+
+	// batch cancelled, give the shadow window back now
+	if (READ_ONCE(nvfsio->cancelled))
+		return false;
+
+	nvfsio->chain_bytes_done += res;
+	nvfsio->fd_offset += res;
+	nvfs_io_advance_gpu_offset(nvfsio, res);
+
+	nvfs_dbg("chained %s nvfsio :%p bytes_done :%ld of %ld\n",
+		 opstr(nvfsio->op), nvfsio, nvfsio->chain_bytes_done,
+		 nvfsio->length);
+	nvfs_stat64(&nvfs_n_chained_io);
+	return true;
+}
+
+/*
+ * Queued by nvfs_io_complete() for chained async IO. Issues the next chunk
+ * under the submitter mm, or frees the IO with a single end fence update
+ * for the whole request.
+ */
+static void nvfs_io_chain_work(struct work_struct *work)
+{
+	nvfs_io_t *nvfsio = container_of(work, struct nvfs_io, chain_work);
+	struct mm_struct *mm = nvfsio->chain_mm;
+	long res = nvfsio->chain_res;
+	const struct cred *old_creds;
+
+	if (nvfs_io_chain_next(nvfsio, res)) {
+		if (mmget_not_zero(mm)) {
+			// file permission, LSM and quota checks see the submitter
+			old_creds = override_creds(nvfsio->chain_cred);
+			nvfs_use_mm(mm);
+			(void)nvfs_io_submit(nvfsio);
+			nvfs_unuse_mm(mm);
+			revert_creds(old_creds);
+			mmput(mm);
+		} else {
+			// submitter is exiting
+			nvfs_io_free(nvfsio, -EIO);
+		}
+	} else {
+		if (res >= 0)
+			res += nvfsio->chain_bytes_done;
+		nvfs_io_free(nvfsio, res);
+	}
+
+	// drop the ops reference taken by nvfs_io_complete()
+	nvfs_put_ops();
+}
+
+long nvfs_io_start_op(nvfs_io_t *nvfsio)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
+	struct nvfs_gpu_args  *gpu_info = &nvfs_mgroup->gpu_info;
+	ssize_t ret = 0, bytes_left = nvfsio->length;
+#ifdef HAVE_STRUCT_FD_FILE_PARAM
+	struct file *f = nvfsio->fd.file;
+#else
+	struct file *f = fd_file(nvfsio->fd);
+#endif
+
+	struct inode *inode = file_inode(f);
+	loff_t fd_offset = nvfsio->fd_offset;
+	int op = nvfsio->op;
+	unsigned long shadow_buf_size = min(nvfsio->window_nfolios << NVFS_BLOCKS_PER_FOLIO_SHIFT,
+					    nvfs_mgroup->nvfs_blocks_count) * NVFS_BLOCK_SIZE;
+
+	nvfs_dbg("Ring %s: m_pDBuffer=%lx BufferSize=%lu TotalRWSize:%ld fileOffset:%lld gpu_page_offset %llu GPU page entries=%u cur_gpu_base_index=%ld mode :%s nvfsio :%p\n",
+		 opstr(op),
+		 (unsigned long)nvfsio->cpuvaddr,
+		 shadow_buf_size,
+		 bytes_left,
+		 fd_offset,
+		 nvfsio->gpu_page_offset,
+		 gpu_info->page_table->entries,
+		 nvfsio->cur_gpu_base_index,
+		 nvfsio->sync ? "sync" : "async",
+		 nvfsio);
+
+	if (op == WRITE) {
+		bool file_is_bdev = S_ISBLK(file_inode(f)->i_mode);
+
+		// skip fallocate check for raw block device files and some file systems
+		if (!file_is_bdev && nvfs_need_fallocate(file_inode(f))) {
+			if (!f->f_op->fallocate) {
+				ret = -EIO;
+				nvfs_err("%s fallocate failed :%ld\n", opstr(op), ret);
+				nvfs_io_free(nvfsio, ret);
+				goto failed;
+			}
+
+			/* fallocate if the file size is 0*/
+			if (i_size_read(inode) == 0) {
+				ret = f->f_op->fallocate(f, 0, 0, 1);
+				if (ret < 0) {
+					nvfs_err("%s fallocate failed :%ld\n", opstr(op), ret);
+					nvfs_io_free(nvfsio, ret);
+					goto failed;
+				}
+				nvfs_dbg("fallocate success\n");
+			}
+		}
+
+		ret = flush_dirty_pages(f, fd_offset, bytes_left, nvfsio);
+		if (ret) {
+			nvfs_err("%s unable to flush dirty pages :%ld\n",
+				 opstr(op), ret);
+			nvfs_io_free(nvfsio, ret);
+			goto failed;
+		}
+	}
+
+	return nvfs_io_submit(nvfsio);
+
+failed:
+	return ret;
+}
+
 static inline int get_rwop(unsigned int ioctl_num)
 {
 	if (ioctl_num == NVFS_IOCTL_READ)
@@ -2156,7 +2815,8 @@ static inline int get_rwop(unsigned int ioctl_num)
 	else if (ioctl_num == NVFS_IOCTL_WRITE)
 		return WRITE;
 #ifdef NVFS_BATCH_SUPPORT
-	else if (ioctl_num == NVFS_IOCTL_BATCH_IO)
+	else if (ioctl_num == NVFS_IOCTL_BATCH_IO ||
+		 ioctl_num == NVFS_IOCTL_BATCH_IO_STATUS)
 		return READ;
 #endif
 	return -1;
@@ -2253,6 +2913,7 @@ static long nvfs_ioctl(struct file *file, unsigned int ioctl_num,
 	}
 #ifdef NVFS_BATCH_SUPPORT
 	case NVFS_IOCTL_BATCH_IO:
+	case NVFS_IOCTL_BATCH_IO_STATUS:
 	{
 		nvfs_batch_io_t *nvfs_batch = NULL;
 		bool rw_stats_enabled = 0;
@@ -2265,7 +2926,8 @@ static long nvfs_ioctl(struct file *file, unsigned int ioctl_num,
 			nvfs_stat64(&nvfs_n_batches);
 			nvfs_stat(&nvfs_n_op_batches);
 		}
-		nvfs_batch = nvfs_io_batch_init(&local_param);
+		nvfs_batch = nvfs_io_batch_init(&local_param,
+						ioctl_num == NVFS_IOCTL_BATCH_IO_STATUS);
 
 		if (IS_ERR(nvfs_batch)) {
 			local_param.ioargs.ioctl_return = PTR_ERR(nvfs_batch);
@@ -2303,15 +2965,62 @@ static long nvfs_ioctl(struct file *file, unsigned int ioctl_num,
 
 		return ((local_param.ioargs.ioctl_return < 0) ? -1 : 0);
 	}
+	case NVFS_IOCTL_BATCH_CANCEL:
+	{
+		long ret;
+
+		ret = nvfs_batch_cancel(&local_param.batch_cancel_args);
+		local_param.batch_cancel_args.ioctl_return = ret;
+		if (copy_to_user((void *) ioctl_param, (void *) &local_param,
+				sizeof(nvfs_ioctl_batch_cancel_args_t))) {
+			nvfs_err("%s:%d copy_to_user failed\n", __func__, __LINE__);
+			return -EFAULT;
+		}
+		nvfs_dbg("nvfs batch cancel ctx_id:%llu ret = %ld\n",
+			 local_param.batch_cancel_args.ctx_id, ret);
+		return ((ret < 0) ? -1 : 0);
+	}
+#endif
+#ifdef NVFS_RING_SUPPORT
+	case NVFS_IOCTL_RING_SETUP:
+	{
+		long ret;
+
+		ret = nvfs_ring_setup(file, &local_param.ring_setup_args);
+		local_param.ring_setup_args.ioctl_return = ret;
+		if (copy_to_user((void *) ioctl_param, (void *) &local_param,
+				sizeof(nvfs_ioctl_ring_setup_args_t))) {
+			nvfs_err("%s:%d copy_to_user failed\n", __func__, __LINE__);
+			return -EFAULT;
+		}
+		nvfs_dbg("nvfs ring setup ret = %ld\n", ret);
+		return ((ret < 0) ? -1 : 0);
+	}
+	case NVFS_IOCTL_RING_ENTER:
+	{
+		long ret;
+
+		ret = nvfs_ring_enter(file, &local_param.ring_enter_args);
+		local_param.ring_enter_args.ioctl_return = ret;
+		if (copy_to_user((void *) ioctl_param, (void *) &local_param,
+				sizeof(nvfs_ioctl_ring_enter_args_t))) {
+			nvfs_err("%s:%d copy_to_user failed\n", __func__, __LINE__);
+			return -EFAULT;
+		}
+		return ((ret < 0) ? -1 : 0);
+	}
 #endif
 	case NVFS_IOCTL_MAP:
+	case NVFS_IOCTL_MAP_EXT:
 	{
 		int ret;
 
 		nvfs_stat64(&nvfs_n_maps);
 		nvfs_stat(&nvfs_n_op_maps);
 
-		ret = nvfs_map(&(local_param.map_args));
+		ret = nvfs_map(&(local_param.map_args),
+			       ioctl_num == NVFS_IOCTL_MAP_EXT ?
+			       local_param.map_ext_args.flags : 0);
 		if (ret) {
 			local_param.ioargs.ioctl_return = ret;
 			if (copy_to_user((void *) ioctl_param,
@@ -2402,12 +3111,147 @@ static long nvfs_ioctl(struct file *file, unsigned int ioctl_num,
 	return 0;
 }
 
+#ifdef HAVE_URING_CMD
+struct nvfs_uring_pdu {
+	long res;
+	enum nvfs_metastate state;
+};
+
+static inline struct nvfs_uring_pdu *nvfs_uring_cmd_pdu(struct io_uring_cmd *cmd)
+{
+	BUILD_BUG_ON(sizeof(struct nvfs_uring_pdu) > sizeof(cmd->pdu));
+	return (struct nvfs_uring_pdu *)cmd->pdu;
+}
+
+static void nvfs_uring_cmd_done(struct io_uring_cmd *cmd, unsigned int issue_flags)
+{
+	struct nvfs_uring_pdu *pdu = nvfs_uring_cmd_pdu(cmd);
+
+	io_uring_cmd_done(cmd, pdu->res, pdu->state, issue_flags);
+}
+
+/*
+ * io_done hook of the uring_cmd IOs, called from nvfs_io_free() and possibly
+ * in interrupt context. The CQE is posted from the submitter task.
+ */
+static void nvfs_uring_io_done(void *data, u64 user_data, long res,
+			       enum nvfs_metastate state)
+{
+	struct io_uring_cmd *cmd = data;
+	struct nvfs_uring_pdu *pdu = nvfs_uring_cmd_pdu(cmd);
+
+	pdu->res = res;
+	pdu->state = state;
+	io_uring_cmd_complete_in_task(cmd, nvfs_uring_cmd_done);
+}
+
+static int nvfs_uring_cmd_ioargs(struct io_uring_cmd *cmd, unsigned int issue_flags,
+				 nvfs_ioctl_ioargs_t *ioargs)
+{
+#ifdef HAVE_IO_URING_SQE_CMD
+	const void *cmd_data = io_uring_sqe_cmd(cmd->sqe);
+#else
+	const void *cmd_data = cmd->cmd;
+#endif
+	u64 uptr;
+
+	BUILD_BUG_ON(sizeof(*ioargs) > NVFS_URING_SQE128_CMD_SIZE);
+
+	// a big SQE has room for the IO arguments
+	if (issue_flags & IO_URING_F_SQE128) {
+		memcpy(ioargs, cmd_data, sizeof(*ioargs));
+		return 0;
+	}
+
+	memcpy(&uptr, cmd_data, sizeof(uptr));
+	if (copy_from_user(ioargs, u64_to_user_ptr(uptr), sizeof(*ioargs))) {
+		nvfs_err("%s:%d copy_from_user failed\n", __func__, __LINE__);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/*
+ * IORING_OP_URING_CMD entry, READ/WRITE through the ioctl IO path with the
+ * completion posted to the io_uring CQ instead of the end fence metapage.
+ */
+static int nvfs_uring_cmd(struct io_uring_cmd *cmd, unsigned int issue_flags)
+{
+	nvfs_ioctl_ioargs_t ioargs;
+	nvfs_io_t *nvfsio;
+	int op = get_rwop(cmd->cmd_op);
+	bool rw_stats_enabled = 0;
+	int ret;
+
+	if (atomic_read(&nvfs_shutdown) == 1)
+		return -EINVAL;
+
+	if (cmd->cmd_op != NVFS_IOCTL_READ && cmd->cmd_op != NVFS_IOCTL_WRITE)
+		return -ENOTTY;
+
+	// both ops pin pages, may map the GPU buffer and issue direct IO inline,
+	// write prep may also flush the page cache: run them from io-wq
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	ret = nvfs_uring_cmd_ioargs(cmd, issue_flags, &ioargs);
+	if (ret)
+		return ret;
+
+	// the CQE result is an int
+	if (ioargs.size > INT_MAX)
+		return -EINVAL;
+
+	// the CQE is the completion, sync IO would block the io_uring issuer
+	ioargs.sync = 0;
+
+	if (nvfs_rw_stats_enabled > 0)
+		rw_stats_enabled = 1;
+
+	if (rw_stats_enabled) {
+		if (op == READ) {
+			nvfs_stat64(&nvfs_n_reads);
+			nvfs_stat(&nvfs_n_op_reads);
+		} else {
+			nvfs_stat64(&nvfs_n_writes);
+			nvfs_stat(&nvfs_n_op_writes);
+		}
+	}
+	nvfs_stat64(&nvfs_n_uring_cmds);
+
+	nvfsio = nvfs_io_init_ext(op, &ioargs, NULL, nvfs_uring_io_done, cmd);
+	if (IS_ERR(nvfsio)) {
+		if (op == READ) {
+			nvfs_stat(&nvfs_n_read_err);
+			if (rw_stats_enabled)
+				nvfs_stat_d(&nvfs_n_op_reads);
+		} else {
+			nvfs_stat(&nvfs_n_write_err);
+			if (rw_stats_enabled)
+				nvfs_stat_d(&nvfs_n_op_writes);
+		}
+		nvfs_stat(&nvfs_n_uring_cmd_err);
+		nvfs_dbg("nvfs uring cmd %s ret = %ld\n",
+			 opstr(op), PTR_ERR(nvfsio));
+		return PTR_ERR(nvfsio);
+	}
+	nvfsio->rw_stats_enabled = rw_stats_enabled;
+
+	// errors past this point are reported through nvfs_uring_io_done()
+	(void)nvfs_io_start_op(nvfsio);
+	return -EIOCBQUEUED;
+}
+#endif
+
 const struct file_operations nvfs_dev_fops = {
 	.compat_ioctl = nvfs_ioctl,
 	.unlocked_ioctl = nvfs_ioctl,
 	.open = nvfs_open,
 	.release = nvfs_close,
 	.mmap = nvfs_mgroup_mmap,
+#ifdef HAVE_URING_CMD
+	.uring_cmd = nvfs_uring_cmd,
+#endif
 	.owner = THIS_MODULE,
 };
 
@@ -2481,10 +3325,27 @@ static int __init nvfs_init(void)
 
 	pr_info("nvidia_fs: Initializing nvfs driver module\n");
 
+	// the device can be opened as soon as it is registered
+	if (nvfs_batch_cache_init()) {
+		nvfs_err("nvidia_fs: Failed to create the batch cache\n");
+		return -ENOMEM;
+	}
+
+	if (nvfs_mgroup_cache_init()) {
+		nvfs_err("nvidia_fs: Failed to create the shadow buffer caches\n");
+		nvfs_batch_cache_destroy();
+		return -ENOMEM;
+	}
+
+	// initialize meta group data structures
+	nvfs_mgroup_init();
+
 	major_number = register_chrdev(0, DEVICE_NAME, &nvfs_dev_fops);
 
 	if (major_number < 0) {
 		nvfs_err("%s: failed to register a major number\n", __func__);
+		nvfs_mgroup_cache_destroy();
+		nvfs_batch_cache_destroy();
 		return major_number;
 	}
 
@@ -2499,6 +3360,8 @@ static int __init nvfs_init(void)
 
 	if (IS_ERR(nvfs_class)) {
 		unregister_chrdev(major_number, DEVICE_NAME);
+		nvfs_mgroup_cache_destroy();
+		nvfs_batch_cache_destroy();
 		nvfs_err("nvidia_fs: Failed to register device class\n");
 		return PTR_ERR(nvfs_class);
 	}
@@ -2523,8 +3386,6 @@ static int __init nvfs_init(void)
 		}
 	}
 
-	// initialize meta group data structures
-	nvfs_mgroup_init();
 	atomic_set(&nvfs_shutdown, 0);
 	init_waitqueue_head(&wq);
 	nvfs_proc_init();
@@ -2544,6 +3405,8 @@ error:
 		device_destroy(nvfs_class, MKDEV(major_number, i));
 		i -= 1;
 	}
+	nvfs_mgroup_cache_destroy();
+	nvfs_batch_cache_destroy();
 
 	return -1;
 }
@@ -2559,6 +3422,8 @@ static void __exit nvfs_exit(void)
 			msecs_to_jiffies(NVFS_HOLD_TIME));
 			nvfs_dbg("count_ops :%lu\n", nvfs_count_ops());
 	} while (nvfs_count_ops());
+	nvfs_batch_cache_destroy();
+	nvfs_mgroup_cache_destroy();
 	nvfs_proc_cleanup();
 #ifdef CONFIG_FAULT_INJECTION
 	nvfs_free_debugfs();
@@ -2576,6 +3441,21 @@ static void __exit nvfs_exit(void)
 module_init(nvfs_init);
 module_exit(nvfs_exit);
 
+// lowering folio_pool_max frees the folios pooled above the new limit
+static int nvfs_folio_pool_max_set(const char *val, const struct kernel_param *kp)
+{
+	int ret = param_set_uint(val, kp);
+
+	if (!ret)
+		nvfs_folio_pool_trim();
+	return ret;
+}
+
+static const struct kernel_param_ops nvfs_folio_pool_max_ops = {
+	.set = nvfs_folio_pool_max_set,
+	.get = param_get_uint,
+};
+
 MODULE_VERSION(TO_STR(MOD_VERS(NVFS_DRIVER_MAJOR_VERSION, NVFS_DRIVER_MINOR_VERSION, NVFS_DRIVER_PATCH_VERSION)));
 MODULE_LICENSE("GPL v2");
 MODULE_DESCRIPTION("NVIDIA GPUDirect Storage");
@@ -2591,3 +3471,15 @@ module_param_named(rw_stats_enabled, nvfs_rw_stats_enabled, uint, 0644);
 MODULE_PARM_DESC(nvfs_rw_stats_enabled, "enable read-write stats");
 module_param_named(use_legacy_p2p_allocation, nvfs_use_legacy_p2p_allocation, uint, 0644);
 MODULE_PARM_DESC(nvfs_use_legacy_p2p_allocation, "Use legacy p2p allocation");
+module_param_named(max_io_slots, nvfs_max_io_slots, uint, 0644);
+MODULE_PARM_DESC(nvfs_max_io_slots, "max concurrent in-flight IOs per shadow buffer");
+module_param_named(max_batch_entries, nvfs_max_batch_entries, uint, 0644);
+MODULE_PARM_DESC(nvfs_max_batch_entries, "max entries per batch IO, up to 16384");
+module_param_named(batch_parallel_submit, nvfs_batch_parallel_submit, uint, 0644);
+MODULE_PARM_DESC(nvfs_batch_parallel_submit, "submit batch entries from workers on the GPU numa node");
+module_param_named(premap_peers, nvfs_premap_peers, uint, 0644);
+MODULE_PARM_DESC(nvfs_premap_peers, "DMA map GPU buffers for this many closest peers at registration, up to 16");
+module_param_cb(folio_pool_max, &nvfs_folio_pool_max_ops, &nvfs_folio_pool_max, 0644);
+MODULE_PARM_DESC(nvfs_folio_pool_max, "free shadow buffer folios kept per numa node for reuse, 0 to disable, lowering it frees the excess");
+module_param_named(max_shadow_buf_mb, nvfs_max_shadow_buf_mb, uint, 0644);
+MODULE_PARM_DESC(nvfs_max_shadow_buf_mb, "max shadow buffer size in MB, 16 by default, up to 1024");
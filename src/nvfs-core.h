@@ -31,6 +31,8 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/compiler.h>
+#include <linux/kthread.h>
+#include <linux/mmu_context.h>
 #include "nvfs-mmap.h"
 #include "config-host.h"
 
@@ -84,6 +86,12 @@ extern int nvfs_info_enabled;
 
 extern int nvfs_rw_stats_enabled;
 extern int nvfs_peer_stats_enabled;
+extern unsigned int nvfs_max_io_slots;
+extern unsigned int nvfs_max_batch_entries;
+extern unsigned int nvfs_batch_parallel_submit;
+extern unsigned int nvfs_premap_peers;
+extern unsigned int nvfs_folio_pool_max;
+extern unsigned int nvfs_max_shadow_buf_mb;
 
 extern struct mutex nvfs_module_mutex;
 
@@ -104,6 +112,35 @@ struct nvfs_ioctl_map_s {
 } __packed __aligned(8);
 typedef struct nvfs_ioctl_map_s nvfs_ioctl_map_t;
 
+/*
+ * NVFS_IOCTL_MAP_EXT: NVFS_IOCTL_MAP with flags. The padding of
+ * nvfs_ioctl_map_t was never validated, so it cannot carry them.
+ */
+struct nvfs_ioctl_map_ext_s {
+	nvfs_ioctl_map_t	map;
+	u32			flags;		/* NVFS_MAP_*, unknown bits fail with -EINVAL */
+	u32			padding;
+} __packed __aligned(8);
+typedef struct nvfs_ioctl_map_ext_s nvfs_ioctl_map_ext_t;
+
+/*
+ * DMA map the GPU buffer for its closest peers at registration time instead
+ * of on the first IO to each peer, see the premap_peers module parameter.
+ */
+#define NVFS_MAP_PREMAP_PEERS	(1U << 0)
+/*
+ * NVFS_IOCTL_MAP_EXT only: end_fence_addr points to NVFS_MAX_IO_FENCES
+ * consecutive 4K metapages the caller allocated, instead of one. Each IO on
+ * the buffer names its own metapage with ioargs fence_idx, so async end
+ * fence IOs and sparse reads no longer own the whole buffer. Two IOs in
+ * flight cannot share a metapage. fence_idx is ignored on any other buffer.
+ */
+#define NVFS_MAP_IO_FENCES	(1U << 1)
+#define NVFS_MAP_FLAGS_MASK	(NVFS_MAP_PREMAP_PEERS | NVFS_MAP_IO_FENCES)
+#define NVFS_MAX_IO_FENCES	64
+#define NVFS_DEFAULT_PREMAP_PEERS	4
+#define NVFS_MAX_PREMAP_PEERS		16
+
 struct nvfs_file_args {
 	ino_t	inum;		/* inode number */
 	u32	generation;	/* inode generation for need for cache validation */
@@ -127,17 +164,117 @@ struct nvfs_ioctl_ioargs {
 	uint8_t			use_rkeys:1;	/* use RDMA rkey for IO */
 	uint8_t			optype:3;	/* optype (READ:0 | WRITE:1) */
 	uint8_t			reserved:1;	/* reserved for future */
-	u8			padding[3];	/* padding */
+	u8			fence_idx;	/* metapage of the IO, read only if the buffer opted in to NVFS_MAP_IO_FENCES */
+	u8			padding[2];	/* padding */
 } __packed __aligned(8);
 typedef struct nvfs_ioctl_ioargs nvfs_ioctl_ioargs_t;
 
 #ifdef NVFS_BATCH_SUPPORT
+/*
+ * With NVFS_IOCTL_BATCH_IO_STATUS entries are submitted independently and
+ * status, if set, receives nents per-entry results: the nvfs_io_start_op()
+ * return of a submitted entry (0 for async, bytes done for sync) or -errno
+ * of a rejected entry. NVFS_IOCTL_BATCH_IO ignores status, callers built
+ * before it existed leave it uninitialized. It starts no entry unless all
+ * of them are valid, and stops at the first entry failing to start.
+ * ioctl_return is 0 if every entry was submitted, else the first error.
+ * Consecutive entries contiguous in the file and in the GPU buffer, with the
+ * same fd, shadow buffer, flags and fence_idx, are issued as one IO: they
+ * share its result and its end fence is the highest end_fence_value of the
+ * run.
+ */
 struct nvfs_ioctl_batch_ioargs {
 	uint64_t		ctx_id;
 	uint64_t		nents;
 	nvfs_ioctl_ioargs_t	*io_entries;
+	s64 __user		*status;	/* optional per-entry results, NVFS_IOCTL_BATCH_IO_STATUS only */
 } __packed __aligned(8);
 typedef struct nvfs_ioctl_batch_ioargs nvfs_ioctl_batch_ioargs_t;
+
+#define NVFS_BATCH_CANCEL_IO	(1U << 0)	/* drop the completions of in-flight IOs */
+#define NVFS_BATCH_CANCEL_WAIT	(1U << 1)	/* wait until no IO of the batch is in flight */
+
+/*
+ * Cancel and/or drain the IOs submitted by the batches of the calling
+ * process with this ctx_id. A cancelled IO does not update the end fence
+ * and a chained IO stops at the chunk in flight, releasing its shadow
+ * buffer window once that chunk completes.
+ */
+struct nvfs_ioctl_batch_cancel_args {
+	uint64_t		ctx_id;
+	uint32_t		flags;		/* NVFS_BATCH_CANCEL_* */
+	uint32_t		padding;
+	uint64_t		ncancelled;	/* out: IOs cancelled */
+	s64			ioctl_return;	/* IOCTL return */
+} __packed __aligned(8);
+typedef struct nvfs_ioctl_batch_cancel_args nvfs_ioctl_batch_cancel_args_t;
+#endif
+
+#ifdef NVFS_RING_SUPPORT
+/*
+ * Shared-memory IO ring, mmap'd at NVFS_RING_MMAP_OFFSET of the device file:
+ * struct nvfs_ring_hdr, sq_entries SQEs at sq_off and cq_entries CQEs at
+ * cq_off. User space owns sq_tail and cq_head, the driver owns sq_head and
+ * cq_tail. Each consumed SQE gets exactly one CQE.
+ */
+#define NVFS_RING_MMAP_OFFSET		0x10000000UL
+#define NVFS_RING_MAX_ENTRIES		4096
+#define NVFS_RING_MAX_FILES		64
+
+#define NVFS_RING_SETUP_SQPOLL		(1U << 0)	/* driver thread polls the SQ */
+#define NVFS_RING_SQE_FIXED_FILE	(1U << 0)	/* ioargs.fd indexes the ring files */
+#define NVFS_RING_NEED_WAKEUP		(1U << 0)	/* SQ poller is idle, use ENTER_SQ_WAKEUP */
+#define NVFS_RING_ENTER_GETEVENTS	(1U << 0)	/* wait for min_complete CQEs */
+#define NVFS_RING_ENTER_SQ_WAKEUP	(1U << 1)	/* wake up the SQ poller */
+
+struct nvfs_ring_hdr {
+	u32	sq_head;
+	u32	sq_tail;
+	u32	cq_head;
+	u32	cq_tail;
+	u32	sq_mask;
+	u32	cq_mask;
+	u32	flags;		/* NVFS_RING_NEED_WAKEUP */
+	u32	cq_overflow;	/* CQEs dropped as user space overran the CQ */
+};
+
+struct nvfs_ring_sqe {
+	u64			user_data;	/* returned in the CQE */
+	u32			flags;		/* NVFS_RING_SQE_* */
+	u32			padding;
+	nvfs_ioctl_ioargs_t	ioargs;		/* optype selects read or write */
+} __packed __aligned(8);
+
+struct nvfs_ring_cqe {
+	u64	user_data;
+	s64	result;		/* bytes done or -errno */
+	u32	state;		/* enum nvfs_metastate */
+	u32	flags;
+};
+
+struct nvfs_ioctl_ring_setup_args {
+	u32	sq_entries;	/* power of 2 */
+	u32	cq_entries;	/* power of 2, 0 for 2 * sq_entries */
+	u32	flags;		/* NVFS_RING_SETUP_* */
+	s32	eventfd;	/* signalled on each CQE, -1 for none */
+	u32	sq_thread_idle;	/* SQ poller idle time in ms */
+	u32	nr_files;	/* number of fds in files */
+	u64	files;		/* user pointer to fixed file fds */
+	u64	ring_size;	/* out: mmap length */
+	u32	sq_off;		/* out: SQE array offset */
+	u32	cq_off;		/* out: CQE array offset */
+	s64	ioctl_return;	/* IOCTL return */
+} __packed __aligned(8);
+typedef struct nvfs_ioctl_ring_setup_args nvfs_ioctl_ring_setup_args_t;
+
+struct nvfs_ioctl_ring_enter_args {
+	u32	to_submit;	/* SQEs to consume */
+	u32	min_complete;	/* CQEs to wait for with GETEVENTS */
+	u32	flags;		/* NVFS_RING_ENTER_* */
+	u32	padding;
+	s64	ioctl_return;	/* submitted SQEs or -errno */
+} __packed __aligned(8);
+typedef struct nvfs_ioctl_ring_enter_args nvfs_ioctl_ring_enter_args_t;
 #endif
 
 #define NVFS_RDMA_MIN_SUPPORTED_VERSION 2
@@ -168,6 +305,7 @@ typedef struct nvfs_ioctl_clear_rdma_reg_info_args nvfs_ioctl_clear_rdma_reg_inf
 
 union nvfs_ioctl_param_u {
 	nvfs_ioctl_map_t map_args;	  // Map
+	nvfs_ioctl_map_ext_t map_ext_args;	// Map with flags
 	nvfs_ioctl_ioargs_t ioargs;   // Read/Write
 #ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
 	nvfs_ioctl_set_rdma_reg_info_args_t rdma_set_reg_info; //Set RDMA reg info in kernel(mgroup)
@@ -176,6 +314,11 @@ union nvfs_ioctl_param_u {
 #endif
 #ifdef NVFS_BATCH_SUPPORT
 	nvfs_ioctl_batch_ioargs_t batch_ioargs;   // Read/Write
+	nvfs_ioctl_batch_cancel_args_t batch_cancel_args;	// Batch cancel/drain
+#endif
+#ifdef NVFS_RING_SUPPORT
+	nvfs_ioctl_ring_setup_args_t ring_setup_args;	// Ring setup
+	nvfs_ioctl_ring_enter_args_t ring_enter_args;	// Ring submit/reap
 #endif
 } __packed __aligned(8);
 typedef union nvfs_ioctl_param_u nvfs_ioctl_param_union;
@@ -209,13 +352,18 @@ typedef struct nvfs_ioctl_metapage *nvfs_ioctl_metapage_ptr_t;
 
 
 struct nvfs_io *nvfs_io_init(int op, nvfs_ioctl_ioargs_t *ioargs);
+struct nvfs_io *nvfs_io_init_ext(int op, nvfs_ioctl_ioargs_t *ioargs,
+				 struct file *fixed_file,
+				 nvfs_io_done_t io_done, void *io_done_data);
 long nvfs_io_start_op(nvfs_io_t *nvfsio);
 void nvfs_io_free(nvfs_io_t *nvfsio, long res);
 
-nvfs_io_sparse_dptr_t nvfs_io_map_sparse_data(nvfs_mgroup_ptr_t nvfs_mgroup);
+nvfs_io_sparse_dptr_t nvfs_io_map_sparse_data(nvfs_io_t *nvfsio);
 void nvfs_io_unmap_sparse_data(nvfs_io_sparse_dptr_t ptr, enum nvfs_metastate state);
 
 int nvfs_get_dma(void *device, struct page *page, void **gpu_base_dma, int dma_length);
+int nvfs_get_dma_held(void *device, struct page *page, nvfs_mgroup_ptr_t nvfs_mgroup,
+		      void **gpu_base_dma, int dma_length);
 
 bool nvfs_free_gpu_info(struct nvfs_gpu_args *gpu_info, bool from_dma);
 bool nvfs_io_terminate_requested(struct nvfs_gpu_args *gpu_info, bool callback);
@@ -229,6 +377,7 @@ void nvfs_io_process_exiting(nvfs_mgroup_ptr_t nvfs_mgroup);
 #define NVFS_IOCTL_REMOVE		_IOW(NVFS_MAGIC, 1, int)
 #define NVFS_IOCTL_READ			_IOW(NVFS_MAGIC, 2, int)
 #define NVFS_IOCTL_MAP			_IOW(NVFS_MAGIC, 3, int)
+#define NVFS_IOCTL_MAP_EXT		_IOW(NVFS_MAGIC, 13, int)
 #define NVFS_IOCTL_WRITE		_IOW(NVFS_MAGIC, 4, int)
 
 #define NVFS_IOCTL_SET_RDMA_REG_INFO	_IOW(NVFS_MAGIC, 5, int)
@@ -237,8 +386,26 @@ void nvfs_io_process_exiting(nvfs_mgroup_ptr_t nvfs_mgroup);
 
 #ifdef NVFS_BATCH_SUPPORT
 #define NVFS_IOCTL_BATCH_IO		_IOW(NVFS_MAGIC, 8, int)
+#define NVFS_IOCTL_BATCH_CANCEL		_IOW(NVFS_MAGIC, 11, int)
+#define NVFS_IOCTL_BATCH_IO_STATUS	_IOW(NVFS_MAGIC, 12, int)
 #endif
 
+#ifdef NVFS_RING_SUPPORT
+#define NVFS_IOCTL_RING_SETUP		_IOW(NVFS_MAGIC, 9, int)
+#define NVFS_IOCTL_RING_ENTER		_IOW(NVFS_MAGIC, 10, int)
+#endif
+
+/*
+ * IORING_OP_URING_CMD on the device file takes NVFS_IOCTL_READ or
+ * NVFS_IOCTL_WRITE as cmd_op. With IORING_SETUP_SQE128 the SQE cmd area
+ * holds the nvfs_ioctl_ioargs_t, otherwise its first u64 is a user pointer
+ * to one. IOs are always async, the CQE res is the IO result and a big CQE
+ * also carries the nvfs_metastate. The IO is always issued from io-wq, as
+ * pinning the shadow buffer, mapping the GPU buffer for the peer and
+ * submitting the direct IO may all block.
+ */
+#define NVFS_URING_SQE128_CMD_SIZE	80	/* cmd area of a 128 byte SQE */
+
 //Max contiguous physical GPU memory for P2P is (4GiB - 64k) or 65535 64k pages
 #define NVFS_P2P_MAX_CONTIG_GPU_PAGES 65535
 #define PAGE_PER_GPU_PAGE_SHIFT  ilog2(GPU_PAGE_SIZE / PAGE_SIZE)
@@ -273,9 +440,63 @@ static inline bool gpu_page_aligned(unsigned long size)
 	return ((size & (GPU_PAGE_SIZE - 1)) == 0);
 }
 
+/*
+ * The P2P page table of a GPU buffer is in pages of (1 << gpu_page_shift)
+ * bytes, 64K or larger. Shadow folios and IO offsets stay in GPU_PAGE_SIZE
+ * units, these translate such a GPU page index to its page table entry and
+ * the byte offset within that entry.
+ */
+static inline unsigned long nvfs_gpu_table_index(const struct nvfs_gpu_args *gpu_info,
+						 unsigned long gpu_page_index)
+{
+	return gpu_page_index >> (gpu_info->gpu_page_shift - GPU_PAGE_SHIFT);
+}
+
+static inline u64 nvfs_gpu_table_offset(const struct nvfs_gpu_args *gpu_info,
+					unsigned long gpu_page_index)
+{
+	unsigned long mask = (1UL << (gpu_info->gpu_page_shift - GPU_PAGE_SHIFT)) - 1;
+
+	return (u64)(gpu_page_index & mask) << GPU_PAGE_SHIFT;
+}
+
+/*
+ * Whether a (4G - 64K) contiguity split of NVFS_P2P_MAX_CONTIG_GPU_PAGES falls
+ * within page table entry @table_index or at the start of the next one.
+ */
+static inline bool nvfs_gpu_table_contig_split(const struct nvfs_gpu_args *gpu_info,
+					       unsigned long table_index)
+{
+	unsigned int shift = gpu_info->gpu_page_shift - GPU_PAGE_SHIFT;
+	unsigned long first = table_index << shift;
+	unsigned long next = (table_index + 1) << shift;
+
+	return (first / NVFS_P2P_MAX_CONTIG_GPU_PAGES) !=
+		(next / NVFS_P2P_MAX_CONTIG_GPU_PAGES);
+}
+
+/* worker threads borrow the submitter mm to pin the shadow buffer pages */
+static inline void nvfs_use_mm(struct mm_struct *mm)
+{
+#ifdef HAVE_KTHREAD_USE_MM
+	kthread_use_mm(mm);
+#else
+	use_mm(mm);
+#endif
+}
+
+static inline void nvfs_unuse_mm(struct mm_struct *mm)
+{
+#ifdef HAVE_KTHREAD_USE_MM
+	kthread_unuse_mm(mm);
+#else
+	unuse_mm(mm);
+#endif
+}
+
 struct nvidia_p2p_dma_mapping *
 nvfs_get_p2p_dma_mapping(struct pci_dev *peer, struct nvfs_gpu_args *gpu_info, struct nvfs_io *nvfsio,
-			 int *n_dma_chunks);
+			 int *n_dma_chunks, const struct nvfs_dma_run **runs);
 unsigned int nvfs_get_device_count(void);
 
 /* Proc Settings */
@@ -33,11 +33,6 @@
 #include "nvfs-kernel-interface.h"
 #include "config-host.h"
 
-/*
- * This should be inline with kernel 5.3 nvme drivers. See driver/nvme/host/pci.c
- */
-#define NVME_MAX_SEGS	127
-
 //#define CONFIG_DEBUG_NVFS_BLK
 
 //#define TEST_RQ_MIXED
@@ -251,10 +246,13 @@ static inline bool nvfs_blk_rq_check(struct request *req)
 	return true;
 }
 
-static inline bool nvfs_req_payload_supported(struct request *req)
+static inline bool nvfs_req_payload_supported(struct request *req,
+					      nvfs_mgroup_ptr_t nvfs_mgroup)
 {
 #ifdef HAVE_BLK_RQ_PAYLOAD_BYTES
-	if (blk_rq_payload_bytes(req) > (NVME_MAX_SEGS * GPU_PAGE_SIZE))
+	// buffers with few physical chunks map any payload in NVME_MAX_SEGS
+	if ((!nvfs_mgroup || nvfs_mgroup->gpu_info.max_io_size) &&
+	    blk_rq_payload_bytes(req) > (NVME_MAX_SEGS * GPU_PAGE_SIZE))
 		return false;
 #else
 	return false;
@@ -306,6 +304,9 @@ static int nvfs_blk_rq_map_sg_internal(struct request_queue *q,
 	uint64_t curr_phys_addr = 0, prev_phys_addr = 0;
 	unsigned long gpu_page_index = 0;
 	pgoff_t pgoff = 0;
+	// all the bvecs of a GDS request normally belong to this mgroup
+	nvfs_mgroup_ptr_t rq_mgroup = NULL;
+	int ret = NVFS_IO_ERR;
 
 
 #ifdef TEST_DISCONTIG_ADDR
@@ -332,17 +333,33 @@ static int nvfs_blk_rq_map_sg_internal(struct request_queue *q,
 			nvfs_mgroup_ptr_t nvfs_mgroup;
 
 			struct folio *bvec_folio = page_folio(bvec.bv_page);
-			nvfs_mgroup = nvfs_mgroup_from_folio(bvec_folio); // ref dropped using CHECK_AND_PUT_MGROUP
-			if (IS_ERR(nvfs_mgroup)) {
-				nvfs_err("%s:%d mgroup_get_folio error\n", __func__, __LINE__);
-				return NVFS_IO_ERR;
+
+			/*
+			 * Only look the mgroup up, and take a reference, when the
+			 * bvec is not part of the mgroup already resolved for this
+			 * request. The reference is dropped once the request is mapped.
+			 */
+			if (rq_mgroup != NULL && nvfs_mgroup_owns_folio(rq_mgroup, bvec_folio)) {
+				nvfs_mgroup = rq_mgroup;
+			} else {
+				nvfs_mgroup = nvfs_mgroup_from_folio(bvec_folio);
+				if (IS_ERR(nvfs_mgroup)) {
+					nvfs_err("%s:%d mgroup_get_folio error\n", __func__, __LINE__);
+					goto out;
+				}
+				if (nvfs_mgroup != NULL) {
+					CHECK_AND_PUT_MGROUP(rq_mgroup);
+					rq_mgroup = nvfs_mgroup;
+				}
 			}
 
 			curr_page_gpu = (nvfs_mgroup != NULL);
 			if (nvfs_mgroup != NULL) {
-				if (nvfs_mgroup_metadata_set_dma_state_folio(bvec_folio, nvfs_mgroup, bvec.bv_len, bvec.bv_offset) != 0) {
+				if (nvfs_mgroup_metadata_set_dma_state(bvec.bv_page, nvfs_mgroup, bvec.bv_len, bvec.bv_offset) != 0) {
+					// the reference was dropped on error
+					rq_mgroup = NULL;
 					nvfs_err("%s:%d mgroup_set_dma error\n", __func__, __LINE__);
-					return NVFS_IO_ERR;
+					goto out;
 				}
 			}
 #endif
@@ -353,10 +370,9 @@ static int nvfs_blk_rq_map_sg_internal(struct request_queue *q,
 			if (unlikely(!nvfs_is_request_valid(&found_gpu_page, &found_cpu_page, &curr_page_gpu))) {
 				nvfs_clear_sglist_page(iod_sglist);
 				nvfs_stat(&nvfs_n_err_mix_cpu_gpu);
-				CHECK_AND_PUT_MGROUP(nvfs_mgroup);
 				nvfs_err("%s:%d cannot handle mixed segments(cpu/gpu) in blkrq\n",
 					 __func__, __LINE__);
-				return NVFS_IO_ERR;
+				goto out;
 			}
 
 			/*
@@ -365,18 +381,15 @@ static int nvfs_blk_rq_map_sg_internal(struct request_queue *q,
 			 * if the next set of pages found are GPU or we will return 0, if all pages in the request
 			 * are CPU pages. Hence, in both the cases, we don't care about creating SG entries as we are serving IO's.
 			 */
-			if (found_cpu_page) {
-				CHECK_AND_PUT_MGROUP(nvfs_mgroup);
+			if (found_cpu_page)
 				continue;
-			}
 
 			// First GPU page
 			if (nsegs == 0) {
 				if (unlikely(blk_integrity_rq(req))) {
-					CHECK_AND_PUT_MGROUP(nvfs_mgroup);
 					nvfs_err("%s:%d cannot handle gpu request with integrity metadata\n",
 						 __func__, __LINE__);
-					return NVFS_IO_ERR;
+					goto out;
 				}
 
 				/* We cannot support payload greater than 127 * 64k = 8323072 bytes. The 127 magic number
@@ -390,18 +403,19 @@ static int nvfs_blk_rq_map_sg_internal(struct request_queue *q,
 				 * On 4.15 kernels, SG allocation is done based on number of phsical segments (blk_nq_nr_phys_segments).
 				 * If we find that number of segments to be created is more than blk_nq_nr_phys_segments,
 				 * we will return the error. See nvfs_extend_sg_markers.
+				 *
+				 * IOs to fragmented GPU buffers are issued in chunks of gpu_info->max_io_size, so their
+				 * requests stay below this limit. Buffers with fewer physical chunks than NVME_MAX_SEGS
+				 * have no such limit.
 				 */
-				if (unlikely(!nvfs_req_payload_supported(req))) {
-					CHECK_AND_PUT_MGROUP(nvfs_mgroup);
-					return NVFS_IO_ERR;
-				}
+				if (unlikely(!nvfs_req_payload_supported(req, rq_mgroup)))
+					goto out;
 
 #ifdef HAVE_DMA_DRAIN_IN_REQUEST_QUEUE
 				if (unlikely(q->dma_drain_size && q->dma_drain_needed(req))) {
-					CHECK_AND_PUT_MGROUP(nvfs_mgroup);
 					nvfs_err("%s:%d cannot handle blk queue with drain segments\n",
 						 __func__, __LINE__);
-					return NVFS_IO_ERR;
+					goto out;
 				}
 #endif
 			}
@@ -413,11 +427,9 @@ static int nvfs_blk_rq_map_sg_internal(struct request_queue *q,
 			if (!nvme && (sg != NULL)) {
 				// check queue segment limits
 				if ((sg->length + bvec.bv_len) > queue_max_segment_size(q)) {
-					curr_phys_addr = nvfs_mgroup_get_gpu_physical_address_folio(nvfs_mgroup,
-							bvec_folio);
-					CHECK_AND_PUT_MGROUP(nvfs_mgroup);
-					nvfs_mgroup = NULL;
-						goto new_segment;
+					curr_phys_addr = nvfs_mgroup_get_gpu_physical_address(nvfs_mgroup,
+							bvec.bv_page);
+					goto new_segment;
 				}
 			}
 
@@ -430,22 +442,19 @@ static int nvfs_blk_rq_map_sg_internal(struct request_queue *q,
 				curr_phys_addr = nvfs_get_simulated_address(key, index);
 				index += 1;
 			} else {
-				curr_phys_addr = nvfs_mgroup_get_gpu_physical_address_folio(nvfs_mgroup, bvec_folio);
+				curr_phys_addr = nvfs_mgroup_get_gpu_physical_address(nvfs_mgroup, bvec.bv_page);
 			}
 #else
-			curr_phys_addr = nvfs_mgroup_get_gpu_physical_address_folio(nvfs_mgroup, bvec_folio);
+			curr_phys_addr = nvfs_mgroup_get_gpu_physical_address(nvfs_mgroup, bvec.bv_page);
 #endif
-			nvfs_mgroup_get_gpu_index_and_off_folio(nvfs_mgroup, bvec_folio, &gpu_page_index, &pgoff);
-			// We no longer need nvfs_mgroup from this point onwards
-			CHECK_AND_PUT_MGROUP(nvfs_mgroup);
-			nvfs_mgroup = NULL;
+			nvfs_mgroup_get_gpu_index_and_off(nvfs_mgroup, bvec.bv_page, &gpu_page_index, &pgoff);
 
 			if (sg != NULL) {
 				if (prev_phys_addr && is_gpu_page_contiguous(prev_phys_addr, curr_phys_addr)) {
 					/* DO NOT allow merge at (4G - 64K) to handle possible discontiguous IOVA
 					 * by SMMU.
 					 */
-					if ((gpu_page_index == 0) ||
+					if ((gpu_page_index == 0) || pgoff ||
 					    (gpu_page_index % NVFS_P2P_MAX_CONTIG_GPU_PAGES != 0)) {
 						sg->length += bvec.bv_len;
 						prev_phys_addr = curr_phys_addr;
@@ -467,7 +476,7 @@ new_segment:
 					nvfs_stat(&nvfs_n_err_sg_err);
 					nvfs_err("no space for entries in sglist (nsegs=%u/nr_phys=%u/found_gpu=%d)\n",
 							nsegs, blk_rq_nr_phys_segments(req), found_gpu_page);
-					return NVFS_IO_ERR;
+					goto out;
 				}
 			}
 			sg_set_page(sg, bvec.bv_page, bvec.bv_len, bvec.bv_offset);
@@ -494,13 +503,17 @@ new_segment:
 		nvfs_print_sglist(iod_sglist, nsegs, req);
 		nvfs_dbg("detected gpu page\n");
 #endif
-		return nsegs;
+		ret = nsegs;
+		goto out;
 	}
 #ifdef CONFIG_DEBUG_NVFS_BLK
 	// If all are host pages, we want to fall back to regular non-nvfs path
 	nvfs_dbg("detected cpu page\n");
 #endif
-	return 0;
+	ret = 0;
+out:
+	CHECK_AND_PUT_MGROUP(rq_mgroup);
+	return ret;
 }
 
 static int nvfs_blk_rq_map_sg(struct request_queue *q,
@@ -517,17 +530,58 @@ static int nvfs_nvme_blk_rq_map_sg(struct request_queue *q,
 	return nvfs_blk_rq_map_sg_internal(q, req, iod_sglist, true);
 }
 
+/*
+ * A request mapped from a single mgroup holds one mgroup and one dma
+ * reference, released at unmap through its dma cookie. Give each of the
+ * @nsegs sg entries mapped so far its own references instead, as taken by
+ * nvfs_get_dma() and released by the unmap slow path.
+ */
+static void nvfs_dma_refs_per_entry(nvfs_mgroup_ptr_t nvfs_mgroup, int nsegs)
+{
+	atomic_add(nsegs - 1, &nvfs_mgroup->dma_ref);
+	while (--nsegs > 0)
+		nvfs_mgroup_get_ref(nvfs_mgroup);
+}
+
+/*
+ * Drop the mgroup and dma references held per sg entry by the first @nsegs
+ * entries of @sglist, whatever the dma state of their blocks.
+ */
+static void nvfs_dma_put_entries(struct scatterlist *sglist, int nsegs)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup;
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(sglist, sg, nsegs, i) {
+		nvfs_mgroup = nvfs_folio_mgroup(page_folio(sg_page(sg)));
+		if (WARN_ON_ONCE(nvfs_mgroup == NULL))
+			continue;
+		if (atomic_dec_if_positive(&nvfs_mgroup->dma_ref) < 0)
+			nvfs_stat_d(&nvfs_n_err_dma_ref);
+		nvfs_mgroup_put_dma(nvfs_mgroup);
+	}
+}
+
+/*
+ * @nr_mapped (out) : on error, number of leading GPU sg entries left mapped
+ *                    with their own references, may be NULL
+ */
 static int nvfs_dma_map_sg_attrs_internal(struct device *device,
 					  struct scatterlist *sglist,
 					  int nents,
 					  enum dma_data_direction dma_dir,
-					  unsigned long attrs, bool nvme)
+					  unsigned long attrs, bool nvme,
+					  int *nr_mapped)
 {
 	int ret, i = 0, nr_gpu_dma = 0, nr_cpu_dma = 0;
 	void *gpu_base_dma = NULL;
 	struct scatterlist *sg = NULL;
 	struct blk_plug *plug = NULL;
 	nvfs_mgroup_ptr_t nvfs_mgroup = NULL;
+	// mgroup holding the references of the whole request
+	nvfs_mgroup_ptr_t req_mgroup = NULL;
+	bool per_entry_refs = false;
 
 	if (unlikely(nents == 0)) {
 		nvfs_err("%s:%d cannot map empty sglist\n", __func__, __LINE__);
@@ -537,6 +591,18 @@ static int nvfs_dma_map_sg_attrs_internal(struct device *device,
 	nvfs_dbg("nvfs_dma_map_sg_attrs invoked with %d entries\n", nents);
 
 	for_each_sg(sglist, sg, nents, i) {
+		struct page *sg_page_ptr = sg_page(sg);
+		struct folio *sg_folio = page_folio(sg_page_ptr);
+		bool held = false;
+
+		if (req_mgroup != NULL && !per_entry_refs) {
+			held = nvfs_mgroup_owns_folio(req_mgroup, sg_folio);
+			if (!held) {
+				// not part of the request mgroup, fall back to per entry references
+				nvfs_dma_refs_per_entry(req_mgroup, nr_gpu_dma);
+				per_entry_refs = true;
+			}
+		}
 
 		if (nvme) {
 			/*
@@ -558,24 +624,39 @@ static int nvfs_dma_map_sg_attrs_internal(struct device *device,
 			 */
 			plug = current->plug;
 			current->plug = NULL;
-			ret = nvfs_get_dma(to_pci_dev(device), sg_page(sg), &gpu_base_dma, -1);
+			if (held)
+				ret = nvfs_get_dma_held(to_pci_dev(device), sg_page_ptr, req_mgroup,
+							&gpu_base_dma, -1);
+			else
+				ret = nvfs_get_dma(to_pci_dev(device), sg_page_ptr, &gpu_base_dma, -1);
 			current->plug = plug;
 		} else {
-			struct page *sg_page_ptr = sg_page(sg);
-			struct folio *sg_folio = page_folio(sg_page_ptr);
-			ret = nvfs_get_dma(to_pci_dev(device), sg_page_ptr, &gpu_base_dma, sg->length);
+			if (held)
+				ret = nvfs_get_dma_held(to_pci_dev(device), sg_page_ptr, req_mgroup,
+							&gpu_base_dma, sg->length);
+			else
+				ret = nvfs_get_dma(to_pci_dev(device), sg_page_ptr, &gpu_base_dma, sg->length);
 			if (ret == 0) {
-				nvfs_mgroup = nvfs_mgroup_from_folio(sg_folio);
-				if (nvfs_mgroup == NULL) {
-					nvfs_err("%s:%d empty mgroup\n", __func__, __LINE__);
-					return NVFS_IO_ERR;
+				if (held) {
+					nvfs_mgroup = req_mgroup;
+					nvfs_mgroup_get_ref(nvfs_mgroup);
+				} else {
+					nvfs_mgroup = nvfs_mgroup_from_folio(sg_folio);
 				}
-				// We have dma mapping set up
-				if (nvfs_mgroup_metadata_set_dma_state_folio(sg_folio, nvfs_mgroup, sg->length, sg->offset) < 0) {
+				if (IS_ERR_OR_NULL(nvfs_mgroup)) {
+					nvfs_err("%s:%d empty mgroup\n", __func__, __LINE__);
+					ret = NVFS_IO_ERR;
+				} else if (nvfs_mgroup_metadata_set_dma_state(sg_page_ptr, nvfs_mgroup,
+									      sg->length, sg->offset) < 0) {
+					// the reference was dropped on error
 					nvfs_err("%s:%d mgroup_set_dma error\n", __func__, __LINE__);
 					ret = NVFS_IO_ERR;
+				} else {
+					nvfs_mgroup_put(nvfs_mgroup);
 				}
-				nvfs_mgroup_put(nvfs_mgroup);
+				// the entry is not counted as mapped, drop what nvfs_get_dma() took
+				if (ret && !held)
+					nvfs_dma_put_entries(sg, 1);
 			}
 		}
 
@@ -629,6 +710,8 @@ static int nvfs_dma_map_sg_attrs_internal(struct device *device,
 				nr_gpu_dma);
 #endif
 			nr_gpu_dma++;
+			if (req_mgroup == NULL && !per_entry_refs)
+				req_mgroup = nvfs_folio_mgroup(sg_folio);
 		}
 	}
 
@@ -644,9 +727,17 @@ static int nvfs_dma_map_sg_attrs_internal(struct device *device,
 	for_each_sg(sglist, sg, nents, i)
 		pr_info("sg entry :[%d]0x%llx/%u\n", i, sg_dma_address(sg), sg_dma_len(sg));
 #endif
+	// all the cookies of the IO may be taken by other requests in flight
+	if (!per_entry_refs && !nvfs_mgroup_set_dma_cookie(req_mgroup, sglist))
+		nvfs_dma_refs_per_entry(req_mgroup, nr_gpu_dma);
 	return nents;
 
 map_err:
+	// unmap, if called, checks the sg entries one by one
+	if (req_mgroup != NULL && !per_entry_refs)
+		nvfs_dma_refs_per_entry(req_mgroup, nr_gpu_dma);
+	if (nr_mapped)
+		*nr_mapped = nr_gpu_dma;
 	return ret;
 }
 
@@ -683,6 +774,13 @@ static int nvfs_dma_unmap_sg(struct device *device,
 	if (unlikely(!sglist || (nents < 0)))
 		BUG();
 
+	// fast path, the request was mapped from a single mgroup, dma errors included
+	if (nents && sg_page(sglist)) {
+		gpu_segs = nvfs_mgroup_put_dma_cookie(sglist, nents);
+		if (gpu_segs)
+			return gpu_segs;
+	}
+
 	for_each_sg(sglist, sg, nents, i) {
 		if (unlikely(sg == NULL))
 			return NVFS_IO_ERR;
@@ -725,7 +823,7 @@ static int nvfs_dma_map_sg_attrs_nvme(struct device *device,
 				      enum dma_data_direction dma_dir,
 				      unsigned long attrs)
 {
-	return nvfs_dma_map_sg_attrs_internal(device, sglist, nents, dma_dir, attrs, true);
+	return nvfs_dma_map_sg_attrs_internal(device, sglist, nents, dma_dir, attrs, true, NULL);
 }
 
 /*
@@ -756,7 +854,84 @@ static int nvfs_dma_map_sg_attrs(struct device *device,
 				 enum dma_data_direction dma_dir,
 				 unsigned long attrs)
 {
-	return nvfs_dma_map_sg_attrs_internal(device, sglist, nents, dma_dir, attrs, false);
+	return nvfs_dma_map_sg_attrs_internal(device, sglist, nents, dma_dir, attrs, false, NULL);
+}
+
+/*
+ * nvfs_map_request, - build and dma map the sglist of a block request
+ *
+ * This is an external facing API for vendors setting nvfs_ft_map_request.
+ * It does in one call what nvfs_blk_rq_map_sg() followed by
+ * nvfs_dma_map_sg_attrs() do, and reports the GPU of the request.
+ *
+ * @device    : dma device
+ * @q         : request queue
+ * @req       : block request
+ * @sglist    : sglist to fill, sized for the request
+ * @dma_dir   : dma direction
+ * @attrs     : dma attributes
+ * @gpu_index : (out) gpu index of the request for nvfs_device_priority(), may be NULL
+ * @returns   : number of mapped sg entries for a GPU request
+ *              0 if the request has no GPU pages
+ *              NVFS_BAD_REQ if the sg entries turned out to be CPU pages
+ *              NVFS_IO_ERR on error, or a request mixing CPU and GPU pages,
+ *              with no sg entry left mapped
+ */
+static int nvfs_map_request_internal(struct device *device,
+				     struct request_queue *q,
+				     struct request *req,
+				     struct scatterlist *sglist,
+				     enum dma_data_direction dma_dir,
+				     unsigned long attrs,
+				     unsigned int *gpu_index,
+				     bool nvme)
+{
+	int nents, ret, nr_mapped = 0;
+
+	nents = nvfs_blk_rq_map_sg_internal(q, req, sglist, nvme);
+	if (nents <= 0)
+		return nents;
+
+	ret = nvfs_dma_map_sg_attrs_internal(device, sglist, nents, dma_dir, attrs, nvme,
+					     &nr_mapped);
+	if (ret == NVFS_BAD_REQ)
+		return ret;
+	if (ret != nents) {
+		nvfs_err("%s:%d dma mapping error for %d sg entries: %d, %d mapped\n",
+			 __func__, __LINE__, nents, ret, nr_mapped);
+		// the caller has no sglist to unmap, release the mapped entries here
+		nvfs_dma_put_entries(sglist, nr_mapped);
+		return NVFS_IO_ERR;
+	}
+
+	// looked up through the shadow folio tag, no hash lookup
+	if (gpu_index)
+		*gpu_index = nvfs_gpu_index(sg_page(sglist));
+	return nents;
+}
+
+static int nvfs_map_request(struct device *device,
+			    struct request_queue *q,
+			    struct request *req,
+			    struct scatterlist *sglist,
+			    enum dma_data_direction dma_dir,
+			    unsigned long attrs,
+			    unsigned int *gpu_index)
+{
+	return nvfs_map_request_internal(device, q, req, sglist, dma_dir, attrs,
+					 gpu_index, false);
+}
+
+static int nvfs_map_request_nvme(struct device *device,
+				 struct request_queue *q,
+				 struct request *req,
+				 struct scatterlist *sglist,
+				 enum dma_data_direction dma_dir,
+				 unsigned long attrs,
+				 unsigned int *gpu_index)
+{
+	return nvfs_map_request_internal(device, q, req, sglist, dma_dir, attrs,
+					 gpu_index, true);
 }
 #ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
 static int nvfs_get_gpu_sglist_rdma_info(struct scatterlist *sglist,
@@ -810,7 +985,12 @@ static int nvfs_get_gpu_sglist_rdma_info(struct scatterlist *sglist,
 		return NVFS_IO_ERR;
 	}
 	shadow_buf_size = (prev_mgroup->nvfs_blocks_count) * NVFS_BLOCK_SIZE;
-	nvfsio = &prev_mgroup->nvfsio;
+	nvfsio = nvfs_mgroup_folio_to_io(prev_mgroup, folio);
+	if (nvfsio == NULL) {
+		nvfs_err("%s: no IO in flight for page %d for addr 0x%p", __func__, 0, page);
+		nvfs_mgroup_put(prev_mgroup);
+		return NVFS_IO_ERR;
+	}
 	memcpy(rdma_infop, &prev_mgroup->rdma_info, sizeof(*rdma_infop));
 
 	// Get to the base 64K page of the starting address
@@ -902,7 +1082,8 @@ static int nvfs_get_gpu_sglist_rdma_info(struct scatterlist *sglist,
 	.nvfs_is_gpu_page               = nvfs_is_gpu_page,     \
 	.nvfs_gpu_index                 = nvfs_gpu_index,               \
 	.nvfs_device_priority           = nvfs_device_priority, \
-	.nvfs_get_gpu_sglist_rdma_info  = nvfs_get_gpu_sglist_rdma_info,
+	.nvfs_get_gpu_sglist_rdma_info  = nvfs_get_gpu_sglist_rdma_info, \
+	.nvfs_map_request               = nvfs_map_request,
 #else
 #define SET_DEFAULT_OPS                                         \
 	.ft_bmap                        = NVIDIA_FS_SET_FT_ALL, \
@@ -911,7 +1092,8 @@ static int nvfs_get_gpu_sglist_rdma_info(struct scatterlist *sglist,
 	.nvfs_dma_unmap_sg              = nvfs_dma_unmap_sg,    \
 	.nvfs_is_gpu_page               = nvfs_is_gpu_page,     \
 	.nvfs_gpu_index                 = nvfs_gpu_index,               \
-	.nvfs_device_priority           = nvfs_device_priority,
+	.nvfs_device_priority           = nvfs_device_priority, \
+	.nvfs_map_request               = nvfs_map_request,
 #endif
 
 
@@ -923,18 +1105,21 @@ struct nvfs_dma_rw_ops nvfs_nvme_dma_rw_ops = {
 	SET_DEFAULT_OPS
 	.nvfs_blk_rq_map_sg	= nvfs_nvme_blk_rq_map_sg,
 	.nvfs_dma_map_sg_attrs  = nvfs_dma_map_sg_attrs_nvme,
+	.nvfs_map_request	= nvfs_map_request_nvme,
 };
 
 struct nvfs_dma_rw_ops nvfs_sfxv_dma_rw_ops = {
 	SET_DEFAULT_OPS
 	.nvfs_blk_rq_map_sg	= nvfs_nvme_blk_rq_map_sg,
 	.nvfs_dma_map_sg_attrs  = nvfs_dma_map_sg_attrs_nvme,
+	.nvfs_map_request	= nvfs_map_request_nvme,
 };
 
 struct nvfs_dma_rw_ops nvfs_nvmesh_dma_rw_ops = {
 	SET_DEFAULT_OPS
 	.nvfs_blk_rq_map_sg	= nvfs_nvme_blk_rq_map_sg,
 	.nvfs_dma_map_sg_attrs  = nvfs_dma_map_sg_attrs_nvme,
+	.nvfs_map_request	= nvfs_map_request_nvme,
 };
 #ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
 struct nvfs_dma_rw_ops nvfs_ibm_scale_rdma_ops = {
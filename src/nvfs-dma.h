@@ -44,6 +44,11 @@
 #define NVFS_IO_ERR	-1
 #define NVFS_BAD_REQ	-2
 
+/*
+ * This should be inline with kernel 5.3 nvme drivers. See driver/nvme/host/pci.c
+ */
+#define NVME_MAX_SEGS	127
+
 #ifndef SECTOR_SHIFT
 #define SECTOR_SHIFT 12
 #endif
@@ -93,6 +98,20 @@ struct nvfs_dma_rw_ops {
 	int (*nvfs_get_gpu_sglist_rdma_info)(struct scatterlist *sglist,
 					     int nents,
 					     struct nvfs_rdma_info *rdma_infop);
+
+	/*
+	 * Request level ops (nvfs_ft_map_request): builds the coalesced sglist
+	 * of the request and maps it for DMA in one call, in place of
+	 * nvfs_blk_rq_map_sg, nvfs_dma_map_sg_attrs and the per page checks.
+	 * The request is unmapped with nvfs_dma_unmap_sg.
+	 */
+	int (*nvfs_map_request)(struct device *device,
+				struct request_queue *q,
+				struct request *req,
+				struct scatterlist *sglist,
+				enum dma_data_direction dma_dir,
+				unsigned long attrs,
+				unsigned int *gpu_index);
 };
 
 // feature list for dma_ops, values indicate bit pos
@@ -102,6 +121,7 @@ enum ft_bits {
 	nvfs_ft_is_gpu_page			= 1ULL << 2,
 	nvfs_ft_device_priority			= 1ULL << 3,
 	nvfs_ft_get_gpu_sglist_rdma_info	= 1ULL << 4,
+	nvfs_ft_map_request			= 1ULL << 5,
 };
 
 // check features for use in registration with vendor drivers
@@ -111,8 +131,10 @@ enum ft_bits {
 #define NVIDIA_FS_CHECK_FT_DEVICE_PRIORITY(ops)     ((ops)->ft_bmap & nvfs_ft_device_priority)
 #define NVIDIA_FS_CHECK_FT_GET_GPU_sglist_RDMA_INFO(ops)   \
 						    ((ops)->ft_bmap & nvfs_ft_get_gpu_sglist_rdma_info)
+#define NVIDIA_FS_CHECK_FT_MAP_REQUEST(ops)         ((ops)->ft_bmap & nvfs_ft_map_request)
 // publish features
-#define NVIDIA_FS_SET_FT_ALL  (nvfs_ft_prep_sglist | nvfs_ft_map_sglist | nvfs_ft_is_gpu_page | nvfs_ft_device_priority | nvfs_ft_get_gpu_sglist_rdma_info)
+#define NVIDIA_FS_SET_FT_ALL  (nvfs_ft_prep_sglist | nvfs_ft_map_sglist | nvfs_ft_is_gpu_page | nvfs_ft_device_priority | nvfs_ft_get_gpu_sglist_rdma_info | \
+			       nvfs_ft_map_request)
 
 typedef int (*nvfs_register_dma_ops_fn_t) (struct nvfs_dma_rw_ops *ops);
 typedef void (*nvfs_unregister_dma_ops_fn_t) (void);
@@ -42,6 +42,10 @@
 #include <linux/random.h>
 #include <linux/ktime.h>
 #include <linux/delay.h>
+#include <linux/bitmap.h>
+#include <linux/scatterlist.h>
+#include <linux/shrinker.h>
+#include <linux/module.h>
 
 #include "nvfs-pci.h"
 #include "nvfs-mmap.h"
@@ -49,14 +53,377 @@
 #include "nvfs-stat.h"
 #include "nvfs-fault.h"
 #include "nvfs-kernel-interface.h"
+#include "nvfs-ring.h"
 #include "config-host.h"
 
 /* Folio order for GPU page allocations (64KB = order 4 for 4KB pages) */
 #define NVFS_GPU_FOLIO_ORDER	(GPU_PAGE_SHIFT - PAGE_SHIFT)
 
+/*
+ * Shadow folios are 64K when memory allows and smaller when it is too
+ * fragmented, they never cross a 64K GPU page. folio->index is
+ * base_index * NVFS_MAX_SHADOW_PAGES + the buffer page index of the first
+ * page of the folio.
+ */
+static inline unsigned long nvfs_folio_page_index(struct folio *folio)
+{
+	return folio->index % NVFS_MAX_SHADOW_PAGES;
+}
+
+// 64K GPU page of the shadow buffer, the unit of IO windows
+static inline unsigned long nvfs_folio_gpu_slot(struct folio *folio)
+{
+	return nvfs_folio_page_index(folio) >> PAGE_PER_GPU_PAGE_SHIFT;
+}
+
 static DEFINE_HASHTABLE(nvfs_io_mgroup_hash, NVFS_MAX_SHADOW_ALLOCS_ORDER);
+/*
+ * (mm, cpu_base_vaddr) -> mgroup lookup cache. Populated when the shadow
+ * buffer is registered with NVFS_IOCTL_MAP and invalidated when the VMA is
+ * closed, so the IO path can resolve the mgroup without walking the page
+ * tables. Protected by the same lock as nvfs_io_mgroup_hash.
+ */
+static DEFINE_HASHTABLE(nvfs_io_vaddr_hash, NVFS_MAX_SHADOW_ALLOCS_ORDER);
 static spinlock_t lock ____cacheline_aligned;
 
+/*
+ * Per numa node pool of free shadow folios. Shadow buffers registered and
+ * released per request recycle their folios instead of going through the
+ * high order page allocator on every mmap. A recycled folio is zeroed again
+ * before reuse as it may have been written by another process.
+ */
+struct nvfs_folio_pool {
+	spinlock_t lock;
+	struct list_head folios;		    // linked through folio->lru
+	unsigned long count;
+} ____cacheline_aligned;
+
+static struct nvfs_folio_pool *nvfs_folio_pools;
+static struct kmem_cache *nvfs_mgroup_cache;
+static struct kmem_cache *nvfs_mgroup_metadata_cache;
+
+static struct folio *nvfs_folio_pool_get(int nid)
+{
+	struct nvfs_folio_pool *pool;
+	struct folio *folio = NULL;
+	unsigned long flags;
+
+	if (nvfs_folio_pools && nid != NUMA_NO_NODE) {
+		pool = &nvfs_folio_pools[nid];
+		spin_lock_irqsave(&pool->lock, flags);
+		folio = list_first_entry_or_null(&pool->folios, struct folio, lru);
+		if (folio) {
+			list_del(&folio->lru);
+			pool->count--;
+		}
+		spin_unlock_irqrestore(&pool->lock, flags);
+	}
+
+	if (folio) {
+		nvfs_stat_d(&nvfs_n_folio_pool_cached);
+		nvfs_stat64(&nvfs_n_folio_pool_hit);
+		folio_zero_range(folio, 0, folio_size(folio));
+		return folio;
+	}
+
+	nvfs_stat64(&nvfs_n_folio_pool_miss);
+	return NULL;
+}
+
+/* Called from nvfs_mgroup_free(), possibly in interrupt context */
+static void nvfs_folio_pool_put(struct folio *folio)
+{
+	struct nvfs_folio_pool *pool;
+	unsigned long flags;
+
+	// the block layer may still hold the folio, only recycle unused ones
+	if (nvfs_folio_pools && READ_ONCE(nvfs_folio_pool_max) &&
+	    folio_order(folio) == NVFS_GPU_FOLIO_ORDER &&
+	    folio_ref_count(folio) == 1 && !folio_mapped(folio)) {
+		pool = &nvfs_folio_pools[folio_nid(folio)];
+		spin_lock_irqsave(&pool->lock, flags);
+		if (pool->count < READ_ONCE(nvfs_folio_pool_max)) {
+			folio->index = 0;
+			list_add(&folio->lru, &pool->folios);
+			pool->count++;
+			spin_unlock_irqrestore(&pool->lock, flags);
+			nvfs_stat(&nvfs_n_folio_pool_cached);
+			return;
+		}
+		spin_unlock_irqrestore(&pool->lock, flags);
+	}
+	folio_put(folio);
+}
+
+/*
+ * Free the oldest folios of the @nid pool down to @max folios, at most
+ * @nr_to_scan of them. Returns the number of folios freed.
+ */
+static unsigned long nvfs_folio_pool_shrink(int nid, unsigned long max,
+					    unsigned long nr_to_scan)
+{
+	struct nvfs_folio_pool *pool = &nvfs_folio_pools[nid];
+	struct folio *folio, *tmp;
+	unsigned long flags, freed = 0;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	while (pool->count > max && freed < nr_to_scan) {
+		folio = list_last_entry(&pool->folios, struct folio, lru);
+		list_move(&folio->lru, &list);
+		pool->count--;
+		freed++;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	list_for_each_entry_safe(folio, tmp, &list, lru) {
+		list_del(&folio->lru);
+		folio_put(folio);
+		nvfs_stat_d(&nvfs_n_folio_pool_cached);
+	}
+	return freed;
+}
+
+/* Called when the folio_pool_max module parameter is changed */
+void nvfs_folio_pool_trim(void)
+{
+	int nid;
+
+	if (!nvfs_folio_pools)
+		return;
+	for (nid = 0; nid < nr_node_ids; nid++)
+		nvfs_folio_pool_shrink(nid, READ_ONCE(nvfs_folio_pool_max), ULONG_MAX);
+}
+
+/* The pooled folios are given back under memory pressure */
+static unsigned long nvfs_folio_pool_count(struct shrinker *shrinker,
+					   struct shrink_control *sc)
+{
+	return READ_ONCE(nvfs_folio_pools[sc->nid].count);
+}
+
+static unsigned long nvfs_folio_pool_scan(struct shrinker *shrinker,
+					  struct shrink_control *sc)
+{
+	unsigned long freed = nvfs_folio_pool_shrink(sc->nid, 0, sc->nr_to_scan);
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker *nvfs_folio_pool_shrinker;
+#ifndef HAVE_SHRINKER_ALLOC
+static struct shrinker nvfs_folio_pool_shrinker_static = {
+	.count_objects = nvfs_folio_pool_count,
+	.scan_objects = nvfs_folio_pool_scan,
+	.seeks = DEFAULT_SEEKS,
+	.flags = SHRINKER_NUMA_AWARE,
+};
+#endif
+
+static int nvfs_folio_pool_shrinker_register(void)
+{
+#ifdef HAVE_SHRINKER_ALLOC
+	nvfs_folio_pool_shrinker = shrinker_alloc(SHRINKER_NUMA_AWARE, "nvfs-folio-pool");
+	if (!nvfs_folio_pool_shrinker)
+		return -ENOMEM;
+	nvfs_folio_pool_shrinker->count_objects = nvfs_folio_pool_count;
+	nvfs_folio_pool_shrinker->scan_objects = nvfs_folio_pool_scan;
+	shrinker_register(nvfs_folio_pool_shrinker);
+#else
+	int ret;
+
+#ifdef HAVE_REGISTER_SHRINKER_NAME
+	ret = register_shrinker(&nvfs_folio_pool_shrinker_static, "nvfs-folio-pool");
+#else
+	ret = register_shrinker(&nvfs_folio_pool_shrinker_static);
+#endif
+	if (ret)
+		return ret;
+	nvfs_folio_pool_shrinker = &nvfs_folio_pool_shrinker_static;
+#endif
+	return 0;
+}
+
+static void nvfs_folio_pool_shrinker_unregister(void)
+{
+	if (!nvfs_folio_pool_shrinker)
+		return;
+#ifdef HAVE_SHRINKER_ALLOC
+	shrinker_free(nvfs_folio_pool_shrinker);
+#else
+	unregister_shrinker(nvfs_folio_pool_shrinker);
+#endif
+	nvfs_folio_pool_shrinker = NULL;
+}
+
+/*
+ * Allocate the shadow folio starting at buffer page @page_idx, @nr_pages
+ * pages before the end of the buffer. 64K folios are preferred, when the
+ * buddy allocator cannot provide them without reclaim or compaction the
+ * order is lowered down to single pages. @max_order carries the order that
+ * last succeeded so that a fragmented system does not retry the failing
+ * orders for every folio of the buffer.
+ */
+static struct folio *nvfs_shadow_folio_alloc(unsigned long page_idx, unsigned long nr_pages,
+					     int *max_order)
+{
+	struct folio *folio;
+	gfp_t gfp;
+	int order = *max_order, start_order;
+
+	// folios are naturally aligned within the buffer and never cross its end
+	while (order && (!IS_ALIGNED(page_idx, 1UL << order) || (1UL << order) > nr_pages))
+		order--;
+	start_order = order;
+
+	if (order == NVFS_GPU_FOLIO_ORDER) {
+		folio = nvfs_folio_pool_get(numa_node_id());
+		if (folio)
+			return folio;
+	}
+
+	for (; order >= 0; order--) {
+		gfp = GFP_USER | __GFP_ZERO;
+		if (order)
+			gfp |= __GFP_NORETRY | __GFP_NOWARN;
+		folio = folio_alloc(gfp, order);
+		if (folio) {
+			nvfs_stat64(&nvfs_n_shadow_folio_alloc[order]);
+			if (order < start_order)
+				*max_order = order;
+			return folio;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The block metadata of buffers up to NVFS_MGROUP_CACHE_BLOCKS blocks comes
+ * from nvfs_mgroup_metadata_cache.
+ */
+static size_t nvfs_mgroup_metadata_size(unsigned long nblocks)
+{
+	return nblocks * sizeof(u8);
+}
+
+static int nvfs_mgroup_metadata_alloc(nvfs_mgroup_ptr_t nvfs_mgroup, unsigned long nblocks)
+{
+	void *metadata;
+
+	if (nblocks <= NVFS_MGROUP_CACHE_BLOCKS)
+		metadata = kmem_cache_zalloc(nvfs_mgroup_metadata_cache, GFP_KERNEL);
+	else
+		metadata = kvzalloc(nvfs_mgroup_metadata_size(nblocks), GFP_KERNEL);
+	if (!metadata)
+		return -ENOMEM;
+
+	nvfs_mgroup->nvfs_metadata_blocks = nblocks;
+	nvfs_mgroup->nvfs_block_state = metadata;
+	return 0;
+}
+
+static void nvfs_mgroup_metadata_free(nvfs_mgroup_ptr_t nvfs_mgroup)
+{
+	if (!nvfs_mgroup->nvfs_block_state)
+		return;
+	if (nvfs_mgroup->nvfs_metadata_blocks <= NVFS_MGROUP_CACHE_BLOCKS)
+		kmem_cache_free(nvfs_mgroup_metadata_cache, nvfs_mgroup->nvfs_block_state);
+	else
+		kvfree(nvfs_mgroup->nvfs_block_state);
+	nvfs_mgroup->nvfs_block_state = NULL;
+}
+
+int nvfs_mgroup_cache_init(void)
+{
+	int nid;
+
+	nvfs_mgroup_cache = KMEM_CACHE(nvfs_io_mgroup, 0);
+	nvfs_mgroup_metadata_cache = kmem_cache_create("nvfs_mgroup_metadata",
+				nvfs_mgroup_metadata_size(NVFS_MGROUP_CACHE_BLOCKS),
+				0, 0, NULL);
+	nvfs_folio_pools = kcalloc(nr_node_ids, sizeof(*nvfs_folio_pools), GFP_KERNEL);
+	for (nid = 0; nvfs_folio_pools && nid < nr_node_ids; nid++) {
+		spin_lock_init(&nvfs_folio_pools[nid].lock);
+		INIT_LIST_HEAD(&nvfs_folio_pools[nid].folios);
+	}
+
+	if (!nvfs_mgroup_cache || !nvfs_mgroup_metadata_cache || !nvfs_folio_pools ||
+	    nvfs_folio_pool_shrinker_register()) {
+		nvfs_mgroup_cache_destroy();
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void nvfs_mgroup_cache_destroy(void)
+{
+	struct nvfs_folio_pool *pools;
+	int nid;
+
+	nvfs_folio_pool_shrinker_unregister();
+
+	// folio_pool_max writes trim the pools under the parameter lock
+	kernel_param_lock(THIS_MODULE);
+	pools = nvfs_folio_pools;
+	if (pools) {
+		for (nid = 0; nid < nr_node_ids; nid++)
+			nvfs_folio_pool_shrink(nid, 0, ULONG_MAX);
+		nvfs_folio_pools = NULL;
+	}
+	kernel_param_unlock(THIS_MODULE);
+	kfree(pools);
+	kmem_cache_destroy(nvfs_mgroup_metadata_cache);
+	nvfs_mgroup_metadata_cache = NULL;
+	kmem_cache_destroy(nvfs_mgroup_cache);
+	nvfs_mgroup_cache = NULL;
+}
+
+static inline unsigned long nvfs_vaddr_hash_key(struct mm_struct *mm, u64 cpuvaddr)
+{
+	return hash_ptr(mm, 32) ^ (unsigned long)(cpuvaddr >> PAGE_SHIFT);
+}
+
+static void nvfs_mgroup_vaddr_insert(nvfs_mgroup_ptr_t nvfs_mgroup, u64 cpuvaddr)
+{
+	spin_lock(&lock);
+	if (hlist_unhashed(&nvfs_mgroup->vaddr_link)) {
+		nvfs_mgroup->mm = current->mm;
+		hash_add_rcu(nvfs_io_vaddr_hash, &nvfs_mgroup->vaddr_link,
+			     nvfs_vaddr_hash_key(current->mm, cpuvaddr));
+	}
+	spin_unlock(&lock);
+}
+
+static void nvfs_mgroup_vaddr_remove(nvfs_mgroup_ptr_t nvfs_mgroup)
+{
+	spin_lock(&lock);
+	if (!hlist_unhashed(&nvfs_mgroup->vaddr_link))
+		hlist_del_init_rcu(&nvfs_mgroup->vaddr_link);
+	nvfs_mgroup->mm = NULL;
+	spin_unlock(&lock);
+}
+
+static nvfs_mgroup_ptr_t nvfs_mgroup_vaddr_lookup(u64 cpuvaddr)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup;
+	struct mm_struct *mm = current->mm;
+
+	rcu_read_lock();
+	hash_for_each_possible_rcu(nvfs_io_vaddr_hash, nvfs_mgroup, vaddr_link,
+				   nvfs_vaddr_hash_key(mm, cpuvaddr)) {
+		if (READ_ONCE(nvfs_mgroup->mm) == mm &&
+		    READ_ONCE(nvfs_mgroup->cpu_base_vaddr) == cpuvaddr) {
+			// mgroup is on its way out, let the slow path report it
+			if (!atomic_inc_not_zero(&nvfs_mgroup->ref))
+				break;
+			rcu_read_unlock();
+			return nvfs_mgroup;
+		}
+	}
+	rcu_read_unlock();
+	return NULL;
+}
+
 static inline bool nvfs_check_process_context(void)
 {
 	if (irqs_disabled() ||
@@ -144,8 +511,17 @@ static void nvfs_mgroup_free(nvfs_mgroup_ptr_t nvfs_mgroup, bool from_dma)
 	}
 	spin_lock(&lock);
 	hash_del_rcu(&nvfs_mgroup->hash_link);
+	if (!hlist_unhashed(&nvfs_mgroup->vaddr_link))
+		hlist_del_init_rcu(&nvfs_mgroup->vaddr_link);
 	spin_unlock(&lock);
 
+	// folios may outlive the mgroup in the block layer, untag them
+	WRITE_ONCE(nvfs_mgroup->magic, 0);
+	for (i = 0; nvfs_mgroup->nvfs_folios && i < nvfs_mgroup->nvfs_pages_count; i++) {
+		if (nvfs_mgroup->nvfs_folios[i] != NULL)
+			WRITE_ONCE(nvfs_mgroup->nvfs_folios[i]->private, NULL);
+	}
+
 	nvfs_dbg("irq_disabled = %d, in intr = %d, in atomic = %d, in nmi = %d current->mm = %d\n",
 		(int) irqs_disabled(),
 		(int) in_interrupt(),
@@ -162,22 +538,31 @@ static void nvfs_mgroup_free(nvfs_mgroup_ptr_t nvfs_mgroup, bool from_dma)
 	if (atomic_read(&gpu_info->io_state) > IO_INIT)
 		nvfs_stat_d(&nvfs_n_op_maps);
 
-	kfree(nvfs_mgroup->nvfs_metadata);
+	kfree(nvfs_mgroup->nvfsio_slots);
+	bitmap_free(nvfs_mgroup->folios_busy);
+	kvfree(nvfs_mgroup->folio_owner);
+	nvfs_mgroup_metadata_free(nvfs_mgroup);
 	if (nvfs_mgroup->nvfs_folios) {
 		/* Direct folio deallocation - much more efficient */
-		for (i = 0; i < nvfs_mgroup->nvfs_folios_count; i++) {
-			if (nvfs_mgroup->nvfs_folios[i] != NULL)
-				folio_put(nvfs_mgroup->nvfs_folios[i]);
+		for (i = 0; i < nvfs_mgroup->nvfs_pages_count; ) {
+			struct folio *folio = nvfs_mgroup->nvfs_folios[i];
+
+			// a partially set up buffer ends at the first missing folio
+			if (folio == NULL)
+				break;
+			i += folio_nr_pages(folio);
+			nvfs_folio_pool_put(folio);
 		}
-		kfree(nvfs_mgroup->nvfs_folios);
+		kvfree(nvfs_mgroup->nvfs_folios);
 		nvfs_mgroup->nvfs_blocks_count = 0;
 		nvfs_mgroup->nvfs_folios_count = 0;
+		nvfs_mgroup->nvfs_pages_count = 0;
 		nvfs_mgroup->nvfs_folios = NULL;
 	}
 	nvfs_mgroup->base_index = 0;
 	nvfs_dbg("freeing base_index %lx(ref:%d) found\n",
 		  nvfs_mgroup->base_index, atomic_read(&nvfs_mgroup->ref));
-	kfree(nvfs_mgroup);
+	kmem_cache_free(nvfs_mgroup_cache, nvfs_mgroup);
 }
 
 
@@ -220,7 +605,6 @@ static nvfs_mgroup_ptr_t nvfs_get_mgroup_from_vaddr_internal(u64 cpuvaddr)
 	int ret;
 	unsigned long cur_base_index  = 0;
 	nvfs_mgroup_ptr_t nvfs_mgroup = NULL;
-	nvfs_mgroup_page_ptr_t nvfs_mpage;
 
 	if (!cpuvaddr) {
 		nvfs_err("%s:%d Invalid shadow buffer address\n",
@@ -262,12 +646,7 @@ static nvfs_mgroup_ptr_t nvfs_get_mgroup_from_vaddr_internal(u64 cpuvaddr)
 		goto failed;
 	}
 
-	// Find the block metadata for this page within the folio
-	unsigned long block_offset_in_folio = (cpuvaddr & (folio_size(folio) - 1)) / NVFS_BLOCK_SIZE;
-	nvfs_mpage = &nvfs_mgroup->nvfs_metadata[(folio->index % NVFS_MAX_SHADOW_PAGES) * (folio_size(folio) / NVFS_BLOCK_SIZE) + block_offset_in_folio];
-	
-	if (nvfs_mpage == NULL || nvfs_mpage->nvfs_start_magic != NVFS_START_MAGIC ||
-	    nvfs_mpage->folio != folio) {
+	if (!nvfs_mgroup_owns_folio(nvfs_mgroup, folio)) {
 		nvfs_err("%s:%d found invalid folio %p for address %llx\n",
 			__func__, __LINE__, folio, cpuvaddr);
 		goto failed;
@@ -288,7 +667,13 @@ nvfs_mgroup_ptr_t nvfs_get_mgroup_from_vaddr(u64 cpuvaddr)
 {
 	nvfs_mgroup_ptr_t nvfs_mgroup_s;
 
-	// Check the first page
+	if (likely(cpuvaddr && current->mm)) {
+		nvfs_mgroup_s = nvfs_mgroup_vaddr_lookup(cpuvaddr);
+		if (nvfs_mgroup_s)
+			return nvfs_mgroup_s;
+	}
+
+	// Cache miss, check the first page
 	nvfs_mgroup_s = nvfs_get_mgroup_from_vaddr_internal(cpuvaddr);
 
 	if (!nvfs_mgroup_s) {
@@ -332,7 +717,7 @@ nvfs_mgroup_ptr_t nvfs_mgroup_pin_shadow_pages(u64 cpuvaddr, unsigned long lengt
 	folio_count = DIV_ROUND_UP(length, GPU_PAGE_SIZE);  // Prefer 64KB folios
 	block_count = DIV_ROUND_UP(length, NVFS_BLOCK_SIZE);
 	
-	pages = kmalloc_array(count, sizeof(struct page *), GFP_KERNEL);
+	pages = kvmalloc_array(count, sizeof(struct page *), GFP_KERNEL);
 	if (!pages) {
 		nvfs_err("%s:%d shadow buffer pages allocation failed\n",
 				__func__, __LINE__);
@@ -409,8 +794,9 @@ nvfs_mgroup_ptr_t nvfs_mgroup_pin_shadow_pages(u64 cpuvaddr, unsigned long lengt
 
 	BUG_ON(nvfs_mgroup->nvfs_folios == NULL);
 	nvfs_mgroup->cpu_base_vaddr = cpuvaddr;
-	nvfs_mgroup_check_and_set(nvfs_mgroup, NVFS_IO_INIT, true, false);
-	kfree(pages);
+	nvfs_mgroup_vaddr_insert(nvfs_mgroup, cpuvaddr);
+	nvfs_mgroup_check_and_set(nvfs_mgroup, NULL, NVFS_IO_INIT, true, false);
+	kvfree(pages);
 	return nvfs_mgroup;
 
 failed:
@@ -419,7 +805,7 @@ failed:
 		unpin_user_pages(pages, ret);
 	}
 out:
-	kfree(pages);
+	kvfree(pages);
 	return NULL;
 }
 
@@ -477,6 +863,8 @@ static void nvfs_vma_close(struct vm_area_struct *vma)
 		gpu_info = &nvfs_mgroup->gpu_info;
 
 		nvfs_dbg("NVFS VMA close vma:%p nvfs_mgroup %p\n", vma, nvfs_mgroup);
+		// the address range is going away, no new lookups by vaddr
+		nvfs_mgroup_vaddr_remove(nvfs_mgroup);
 		if (atomic_read(&gpu_info->io_state) > IO_INIT) {
 			// cudaFree was already invoked and hence callback was done
 			if (atomic_read(&gpu_info->io_state) == IO_CALLBACK_END) {
@@ -513,10 +901,10 @@ static void nvfs_vma_close(struct vm_area_struct *vma)
 						     IO_TERMINATED);
 
 			if (atomic_read(&gpu_info->io_state) == IO_TERMINATED) {
-				// We should have atmost 3 references
+				// We should have atmost 2 + nvfs_io_nslots references
 				// 1: ref from mmap()
 				// 2: ref from nvfs_mgroup_pin_shadow_pages()
-				// 3: from In-flight IO
+				// 3: one from each In-flight IO slot
 
 				nvfs_dbg("*****************munmap invoked - nvfs_mgroup ref %d mgroup %p\n",
 					atomic_read(&nvfs_mgroup->ref), nvfs_mgroup);
@@ -579,6 +967,50 @@ static const struct vm_operations_struct nvfs_mmap_ops = {
 	.page_mkwrite = nvfs_page_mkwrite,
 };
 
+/*
+ * Map all shadow folios of @nvfs_mgroup into @vma. vm_insert_pages() takes
+ * the page table lock once per page table rather than once per page, which
+ * dominates the mmap time of large shadow buffers.
+ */
+static int nvfs_mgroup_insert_pages(struct vm_area_struct *vma, nvfs_mgroup_ptr_t nvfs_mgroup)
+{
+	unsigned long nr_pages = nvfs_mgroup->nvfs_pages_count;
+	unsigned long i, j, nr;
+	struct folio *folio;
+	int ret = 0;
+#ifdef HAVE_VM_INSERT_PAGES
+	struct page **pages;
+	unsigned long batch = min_t(unsigned long, nr_pages, PTRS_PER_PTE);
+
+	pages = kmalloc_array(batch, sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_pages && !ret; i += batch) {
+		nr = min(batch, nr_pages - i);
+		for (j = 0; j < nr; j++) {
+			folio = nvfs_mgroup->nvfs_folios[i + j];
+			pages[j] = folio_page(folio, i + j - nvfs_folio_page_index(folio));
+		}
+		ret = vm_insert_pages(vma, vma->vm_start + (i * PAGE_SIZE), pages, &nr);
+		if (!ret && nr)
+			ret = -EFAULT;
+	}
+	kfree(pages);
+#else
+	for (i = 0; i < nr_pages && !ret; i += nr) {
+		folio = nvfs_mgroup->nvfs_folios[i];
+		nr = folio_nr_pages(folio);
+		for (j = 0; j < nr && !ret; j++)
+			ret = vm_insert_page(vma, vma->vm_start + ((i + j) * PAGE_SIZE),
+					     folio_page(folio, j));
+	}
+#endif
+	nvfs_dbg("vm_insert_pages : %lu pages (%lx - %lx) ret: %d\n",
+		 nr_pages, vma->vm_start, vma->vm_start + (nr_pages * PAGE_SIZE), ret);
+	return ret;
+}
+
 static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *vma)
 {
 	int ret = -EINVAL, i, tries = 10;
@@ -588,6 +1020,8 @@ static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *v
 	nvfs_mgroup_ptr_t nvfs_mgroup, nvfs_new_mgroup;
 	struct nvfs_gpu_args *gpu_info;
 	int os_pages_count;
+	int max_order = NVFS_GPU_FOLIO_ORDER;
+	struct folio *folio;
 	vm_flags_t vm_flags, vm_flags_to_set;
 
 	nvfs_stat64(&nvfs_n_mmap);
@@ -595,8 +1029,12 @@ static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *v
 	 * check length - do not allow larger mappings than the number of
 	 * pages allocated
 	 */
-	if (length > NVFS_MAX_SHADOW_PAGES * PAGE_SIZE)
+	if (length > NVFS_MAX_SHADOW_PAGES * PAGE_SIZE ||
+	    length > ((unsigned long)READ_ONCE(nvfs_max_shadow_buf_mb) << 20)) {
+		nvfs_err("mmap size 0x%lx above the max shadow buffer size of %uMB\n",
+			 length, READ_ONCE(nvfs_max_shadow_buf_mb));
 		goto error;
+	}
 
 	/* if the length is less than 64K, check for 4K alignment */
 	if ((length < GPU_PAGE_SIZE) && (length % NVFS_BLOCK_SIZE)) {
@@ -639,7 +1077,7 @@ static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *v
 	vm_flags_set(vma, vm_flags_to_set);
 #endif
 	vma->vm_ops = &nvfs_mmap_ops;
-	nvfs_new_mgroup = (nvfs_mgroup_ptr_t)kzalloc(sizeof(struct nvfs_io_mgroup), GFP_KERNEL);
+	nvfs_new_mgroup = kmem_cache_zalloc(nvfs_mgroup_cache, GFP_KERNEL);
 	if (!nvfs_new_mgroup) {
 		ret = -ENOMEM;
 		goto error;
@@ -663,6 +1101,7 @@ static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *v
 			nvfs_mgroup_put(nvfs_mgroup);
 		} else {
 			nvfs_new_mgroup->base_index = base_index;
+			nvfs_new_mgroup->magic = NVFS_MGROUP_MAGIC;
 			atomic_set(&nvfs_new_mgroup->ref, 1);
 			hash_add_rcu(nvfs_io_mgroup_hash, &nvfs_new_mgroup->hash_link, base_index);
 			nvfs_mgroup = nvfs_new_mgroup;
@@ -673,7 +1112,7 @@ static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *v
 	spin_unlock(&lock);
 
 	if (nvfs_new_mgroup != NULL) {
-		kfree(nvfs_new_mgroup);
+		kmem_cache_free(nvfs_mgroup_cache, nvfs_new_mgroup);
 		ret = -ENOMEM;
 		goto error;
 	}
@@ -683,17 +1122,33 @@ static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *v
 	/* Calculate folio allocation strategy - prefer 64KB folios for GPU pages */
 	os_pages_count = DIV_ROUND_UP(length, PAGE_SIZE);
 	nvfs_mgroup->nvfs_folios_count = DIV_ROUND_UP(length, GPU_PAGE_SIZE);
-	nvfs_mgroup->nvfs_folios = kcalloc(nvfs_mgroup->nvfs_folios_count,
-					   sizeof(struct folio *), GFP_KERNEL);
+	nvfs_mgroup->nvfs_pages_count = os_pages_count;
+	nvfs_mgroup->nvfs_folios = kvcalloc(os_pages_count,
+					    sizeof(struct folio *), GFP_KERNEL);
 	if (!nvfs_mgroup->nvfs_folios) {
 		nvfs_mgroup_put(nvfs_mgroup);
 		ret = -ENOMEM;
 		goto error;
 	}
 
-	nvfs_mgroup->nvfs_metadata = kcalloc(nvfs_blocks_count,
-					     sizeof(struct nvfs_io_metadata), GFP_KERNEL);
-	if (!nvfs_mgroup->nvfs_metadata) {
+	if (nvfs_mgroup_metadata_alloc(nvfs_mgroup, nvfs_blocks_count)) {
+		nvfs_mgroup_put(nvfs_mgroup);
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	/* no point in having more IO slots than shadow folios */
+	spin_lock_init(&nvfs_mgroup->io_slot_lock);
+	nvfs_mgroup->nvfs_io_nslots = clamp_t(unsigned int, nvfs_max_io_slots, 1,
+					      min_t(unsigned long, NVFS_MAX_IO_SLOTS,
+						    nvfs_mgroup->nvfs_folios_count));
+	nvfs_mgroup->nvfsio_slots = kcalloc(nvfs_mgroup->nvfs_io_nslots,
+					    sizeof(nvfs_io_t), GFP_KERNEL);
+	nvfs_mgroup->folios_busy = bitmap_zalloc(nvfs_mgroup->nvfs_folios_count, GFP_KERNEL);
+	nvfs_mgroup->folio_owner = kvcalloc(nvfs_mgroup->nvfs_folios_count,
+					    sizeof(nvfs_io_t *), GFP_KERNEL);
+	if (!nvfs_mgroup->nvfsio_slots || !nvfs_mgroup->folios_busy ||
+	    !nvfs_mgroup->folio_owner) {
 		nvfs_mgroup_put(nvfs_mgroup);
 		ret = -ENOMEM;
 		goto error;
@@ -707,69 +1162,40 @@ static int nvfs_mgroup_mmap_internal(struct file *filp, struct vm_area_struct *v
 		BUG_ON(vma->vm_private_data != NULL);
 	}
 
-	for (i = 0; i < nvfs_blocks_count; i++) {
-		unsigned int folio_idx = i / (GPU_PAGE_SIZE / NVFS_BLOCK_SIZE);
-		unsigned int block_in_folio = i % (GPU_PAGE_SIZE / NVFS_BLOCK_SIZE);
-		
-		if (folio_idx < nvfs_mgroup->nvfs_folios_count && 
-		    nvfs_mgroup->nvfs_folios[folio_idx] == NULL) {
-			
-			/* Allocate large folios for better performance */
-			nvfs_mgroup->nvfs_folios[folio_idx] = folio_alloc(GFP_USER|__GFP_ZERO, NVFS_GPU_FOLIO_ORDER);
-			if (nvfs_mgroup->nvfs_folios[folio_idx]) {
-				nvfs_mgroup->nvfs_folios[folio_idx]->index = (base_index * NVFS_MAX_SHADOW_PAGES) + folio_idx;
-				
-#ifdef CONFIG_FAULT_INJECTION
-				if (nvfs_fault_trigger(&nvfs_vm_insert_page_error))
-					ret = -EFAULT;
-				else
-#endif
-				{
-					/* Insert all pages from this folio into VMA */
-					unsigned int p;
-					for (p = 0; p < folio_nr_pages(nvfs_mgroup->nvfs_folios[folio_idx]); p++) {
-						struct page *page = folio_page(nvfs_mgroup->nvfs_folios[folio_idx], p);
-						ret = vm_insert_page(vma, 
-								   vma->vm_start + (folio_idx * GPU_PAGE_SIZE) + (p * PAGE_SIZE),
-								   page);
-						if (ret) {
-							nvfs_mgroup->nvfs_blocks_count = i;
-							nvfs_mgroup_put(nvfs_mgroup);
-							ret = -ENOMEM;
-							goto error;
-						}
-					}
-				}
+	for (i = 0; i < os_pages_count; i += folio_nr_pages(folio)) {
+		unsigned int p;
 
-				nvfs_dbg("vm_insert_folio : folio %d size: %zu mapping: %p, index: %lx (%llx - %llx) ret: %d\n",
-					 folio_idx, folio_size(nvfs_mgroup->nvfs_folios[folio_idx]),
-					 nvfs_mgroup->nvfs_folios[folio_idx]->mapping,
-					 nvfs_mgroup->nvfs_folios[folio_idx]->index,
-					 (unsigned long long)(vma->vm_start + (folio_idx * GPU_PAGE_SIZE)),
-					 (unsigned long long)(vma->vm_start + (folio_idx + 1) * GPU_PAGE_SIZE),
-					 ret);
-
-				if (ret) {
-					nvfs_mgroup->nvfs_blocks_count = i;
-					nvfs_mgroup_put(nvfs_mgroup);
-					ret = -ENOMEM;
-					goto error;
-				}
-			} else {
-				nvfs_mgroup->nvfs_blocks_count = i;
-				nvfs_mgroup_put(nvfs_mgroup);
-				ret = -ENOMEM;
-				goto error;
-			}
-		}
-		/* fill the nvfs metadata header */
-		nvfs_mgroup->nvfs_metadata[i].nvfs_start_magic = NVFS_START_MAGIC;
-		nvfs_mgroup->nvfs_metadata[i].nvfs_state = NVFS_IO_ALLOC;
-		if (folio_idx < nvfs_mgroup->nvfs_folios_count) {
-			nvfs_mgroup->nvfs_metadata[i].folio = nvfs_mgroup->nvfs_folios[folio_idx];
-			nvfs_mgroup->nvfs_metadata[i].folio_offset = block_in_folio * NVFS_BLOCK_SIZE;
+		folio = nvfs_shadow_folio_alloc(i, os_pages_count - i, &max_order);
+		if (!folio) {
+			nvfs_mgroup->nvfs_blocks_count = i << NVFS_PAGE_TO_BLOCK_ORDER;
+			nvfs_mgroup_put(nvfs_mgroup);
+			ret = -ENOMEM;
+			goto error;
 		}
+
+		folio->index = (base_index * NVFS_MAX_SHADOW_PAGES) + i;
+		// tag the shadow folio, see nvfs_folio_mgroup_rcu()
+		WRITE_ONCE(folio->private, nvfs_mgroup);
+		for (p = 0; p < folio_nr_pages(folio); p++)
+			nvfs_mgroup->nvfs_folios[i + p] = folio;
+
+		nvfs_dbg("shadow folio : page %d size: %zu index: %lx\n",
+			 i, folio_size(folio), folio->index);
 	}
+
+	/* Insert the pages of all folios into VMA */
+#ifdef CONFIG_FAULT_INJECTION
+	if (nvfs_fault_trigger(&nvfs_vm_insert_page_error))
+		ret = -EFAULT;
+	else
+#endif
+		ret = nvfs_mgroup_insert_pages(vma, nvfs_mgroup);
+	if (ret) {
+		nvfs_mgroup_put(nvfs_mgroup);
+		ret = -ENOMEM;
+		goto error;
+	}
+	memset(nvfs_mgroup->nvfs_block_state, NVFS_IO_ALLOC, nvfs_blocks_count);
 	nvfs_mgroup->nvfs_blocks_count = nvfs_blocks_count;
 	gpu_info = &nvfs_mgroup->gpu_info;
 	atomic_set(&gpu_info->io_state, IO_FREE);
@@ -799,6 +1225,10 @@ int nvfs_mgroup_mmap(struct file *filp, struct vm_area_struct *vma)
 
 		return nvfs_mgroup_mmap_internal(filp, vma);
 	}
+#ifdef NVFS_RING_SUPPORT
+	if (vma->vm_pgoff == (NVFS_RING_MMAP_OFFSET >> PAGE_SHIFT))
+		return nvfs_ring_mmap(filp, vma);
+#endif
 
 	nvfs_err("ERR: mmap %p, vma->vm_pgoff: %lu file:%p\n", vma, vma->vm_pgoff, vma->vm_file);
 
@@ -810,6 +1240,203 @@ void nvfs_mgroup_init(void)
 {
 	spin_lock_init(&lock);
 	hash_init(nvfs_io_mgroup_hash);
+	hash_init(nvfs_io_vaddr_hash);
+}
+
+/*
+ * Grab a free IO slot of the shadow buffer. The first busy slot moves the
+ * buffer from IO_READY to IO_IN_PROGRESS, further slots are only handed out
+ * while the buffer stays IO_IN_PROGRESS, so a pending teardown
+ * (IO_TERMINATE_REQ/IO_CALLBACK_REQ) refuses any new IO.
+ */
+nvfs_io_t *nvfs_mgroup_io_slot_get(nvfs_mgroup_ptr_t nvfs_mgroup)
+{
+	struct nvfs_gpu_args *gpu_info = &nvfs_mgroup->gpu_info;
+	nvfs_io_t *nvfsio;
+	unsigned long flags;
+	unsigned int slot;
+	int from;
+
+#ifdef CONFIG_FAULT_INJECTION
+	if (nvfs_fault_trigger(&nvfs_io_transit_state_fail)) {
+		nvfs_err("nvfs_io_transit_state_fail fault trigger\n");
+		return ERR_PTR(-EBUSY);
+	}
+#endif
+	spin_lock_irqsave(&nvfs_mgroup->io_slot_lock, flags);
+	if (nvfs_mgroup->io_exclusive)
+		goto busy;
+
+	slot = find_first_zero_bit(&nvfs_mgroup->io_slots_busy,
+				   nvfs_mgroup->nvfs_io_nslots);
+	if (slot >= nvfs_mgroup->nvfs_io_nslots)
+		goto busy;
+
+	from = nvfs_mgroup->nvfs_io_active ? IO_IN_PROGRESS : IO_READY;
+	if (atomic_cmpxchg(&gpu_info->io_state, from, IO_IN_PROGRESS) != from)
+		goto busy;
+
+	__set_bit(slot, &nvfs_mgroup->io_slots_busy);
+	nvfs_mgroup->nvfs_io_active++;
+	spin_unlock_irqrestore(&nvfs_mgroup->io_slot_lock, flags);
+
+	nvfsio = &nvfs_mgroup->nvfsio_slots[slot];
+	memset(nvfsio, 0, sizeof(struct nvfs_io));
+	nvfsio->nvfs_mgroup = nvfs_mgroup;
+	nvfsio->slot = slot;
+
+	nvfs_dbg("%s:%d slot %u of %u, IO state %s\n", __func__, __LINE__,
+		 slot, nvfs_mgroup->nvfs_io_nslots,
+		 nvfs_io_state_status(atomic_read(&gpu_info->io_state)));
+	return nvfsio;
+busy:
+	spin_unlock_irqrestore(&nvfs_mgroup->io_slot_lock, flags);
+	nvfs_dbg("%s:%d no IO slot available, IO state %s\n", __func__, __LINE__,
+		 nvfs_io_state_status(atomic_read(&gpu_info->io_state)));
+	return ERR_PTR(-EBUSY);
+}
+
+static void nvfs_mgroup_io_window_put_locked(nvfs_io_t *nvfsio)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
+	unsigned long i;
+
+	if (!nvfsio->window_nfolios)
+		return;
+
+	for (i = 0; i < nvfsio->window_nfolios; i++)
+		WRITE_ONCE(nvfs_mgroup->folio_owner[nvfsio->window_start + i], NULL);
+	bitmap_clear(nvfs_mgroup->folios_busy, nvfsio->window_start,
+		     nvfsio->window_nfolios);
+	if (nvfsio->exclusive)
+		nvfs_mgroup->io_exclusive = false;
+	nvfsio->window_nfolios = 0;
+}
+
+/*
+ * Release the IO slot along with its shadow window. Can be called from the
+ * IO completion (interrupt) context.
+ * Returns true if this was the last busy slot and the buffer could not be
+ * moved back to IO_READY because teardown was requested in the meantime.
+ * The caller then owns the rest of the termination.
+ */
+bool nvfs_mgroup_io_slot_put(nvfs_io_t *nvfsio)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
+	struct nvfs_gpu_args *gpu_info = &nvfs_mgroup->gpu_info;
+	unsigned long flags;
+	bool teardown = false;
+
+	spin_lock_irqsave(&nvfs_mgroup->io_slot_lock, flags);
+	nvfs_mgroup_io_window_put_locked(nvfsio);
+	BUG_ON(!test_bit(nvfsio->slot, &nvfs_mgroup->io_slots_busy));
+	__clear_bit(nvfsio->slot, &nvfs_mgroup->io_slots_busy);
+	BUG_ON(nvfs_mgroup->nvfs_io_active == 0);
+	if (--nvfs_mgroup->nvfs_io_active == 0)
+		teardown = (atomic_cmpxchg(&gpu_info->io_state, IO_IN_PROGRESS,
+					   IO_READY) != IO_IN_PROGRESS);
+	spin_unlock_irqrestore(&nvfs_mgroup->io_slot_lock, flags);
+
+	return teardown;
+}
+
+/*
+ * Reserve a window of contiguous shadow folios for the IO. The folios of the
+ * window map 1:1 onto GPU pages starting at nvfsio->cur_gpu_base_index.
+ * An exclusive IO (rkey based, or end fence async and sparse without its own
+ * NVFS_MAP_IO_FENCES metapage) owns the whole buffer like a single in-flight
+ * IO always did. A sync IO which does not find
+ * a free window of the requested size settles for the first free run of
+ * folios and loops over it in smaller chunks.
+ */
+int nvfs_mgroup_io_window_get(nvfs_io_t *nvfsio, unsigned long nfolios, bool exclusive)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
+	unsigned long total = nvfs_mgroup->nvfs_folios_count;
+	unsigned long start, end, i, flags;
+
+	spin_lock_irqsave(&nvfs_mgroup->io_slot_lock, flags);
+	BUG_ON(nvfsio->window_nfolios);
+	if (nvfs_mgroup->io_exclusive)
+		goto busy;
+
+	if (exclusive) {
+		if (!bitmap_empty(nvfs_mgroup->folios_busy, total))
+			goto busy;
+		start = 0;
+		nfolios = total;
+		nvfs_mgroup->io_exclusive = true;
+	} else {
+		nfolios = clamp(nfolios, 1UL, total);
+		start = bitmap_find_next_zero_area(nvfs_mgroup->folios_busy,
+						   total, 0, nfolios, 0);
+		if (start >= total) {
+			if (!nvfsio->sync)
+				goto busy;
+			start = find_first_zero_bit(nvfs_mgroup->folios_busy, total);
+			if (start >= total)
+				goto busy;
+			end = find_next_bit(nvfs_mgroup->folios_busy, total, start);
+			nfolios = min(nfolios, end - start);
+		}
+	}
+
+	bitmap_set(nvfs_mgroup->folios_busy, start, nfolios);
+	for (i = 0; i < nfolios; i++)
+		WRITE_ONCE(nvfs_mgroup->folio_owner[start + i], nvfsio);
+	nvfsio->window_start = start;
+	nvfsio->window_nfolios = nfolios;
+	nvfsio->exclusive = exclusive;
+	spin_unlock_irqrestore(&nvfs_mgroup->io_slot_lock, flags);
+
+	nvfs_dbg("slot %u shadow window (%lu - %lu) exclusive %d\n",
+		 nvfsio->slot, start, start + nfolios - 1, exclusive);
+	return 0;
+busy:
+	spin_unlock_irqrestore(&nvfs_mgroup->io_slot_lock, flags);
+	return -EBUSY;
+}
+
+/*
+ * IO slot owning the shadow folio, NULL if the folio is not part of any
+ * in-flight IO window.
+ */
+nvfs_io_t *nvfs_mgroup_folio_to_io(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio)
+{
+	unsigned long slot = nvfs_folio_gpu_slot(folio);
+
+	if (unlikely(slot >= nvfs_mgroup->nvfs_folios_count))
+		return NULL;
+
+	return READ_ONCE(nvfs_mgroup->folio_owner[slot]);
+}
+
+/*
+ * First block in [start, end) whose state is not in the @states mask of
+ * BIT(enum nvfs_block_state), end if none. Blocks of an IO mostly share
+ * their state, runs of it are skipped with memchr_inv().
+ */
+static unsigned long nvfs_blocks_find_state_not(const u8 *blk_state, unsigned long start,
+						unsigned long end, unsigned int states)
+{
+	while (start < end) {
+		const u8 *next;
+
+		if (!(BIT(blk_state[start]) & states))
+			return start;
+		next = memchr_inv(blk_state + start, blk_state[start], end - start);
+		start = next ? next - blk_state : end;
+	}
+	return end;
+}
+
+/* shadow buffer block index of the first block in @page */
+static inline unsigned long nvfs_page_to_block_index(struct page *page)
+{
+	struct folio *folio = page_folio(page);
+
+	return (nvfs_folio_page_index(folio) + (page_to_pfn(page) - folio_pfn(folio))) <<
+		NVFS_PAGE_TO_BLOCK_ORDER;
 }
 
 static int nvfs_handle_sparse_read_region(struct nvfs_io *nvfsio, nvfs_mgroup_ptr_t nvfs_mgroup,
@@ -818,11 +1445,14 @@ static int nvfs_handle_sparse_read_region(struct nvfs_io *nvfsio, nvfs_mgroup_pt
 	if (*sparse_ptr == false) {
 		BUG_ON(nvfsio->check_sparse == true);
 		nvfsio->check_sparse = true;
-		*sparse_ptr = nvfs_io_map_sparse_data(nvfs_mgroup);
+		*sparse_ptr = nvfs_io_map_sparse_data(nvfsio);
 	}
 
+	// holes are recorded with u16 block offsets and lengths, a read going past
+	// them is cut short like one with too many holes
 	if (*last_sparse_index < 0 || (*last_sparse_index + 1) != i) {
-		if (*nholes + 1 >= NVFS_MAX_HOLE_REGIONS) {
+		if (*nholes + 1 >= NVFS_MAX_HOLE_REGIONS ||
+		    i - nvfsio->nvfs_active_blocks_start > U16_MAX) {
 			int sparse_read_bytes_limit = (i - nvfsio->nvfs_active_blocks_start) * NVFS_BLOCK_SIZE;
 			*last_sparse_index = i;
 			nvfs_info("detected max hole region count: %u", *nholes);
@@ -835,24 +1465,27 @@ static int nvfs_handle_sparse_read_region(struct nvfs_io *nvfsio, nvfs_mgroup_pt
 		(*sparse_ptr)->hole[*nholes].start = i - nvfsio->nvfs_active_blocks_start;
 		(*sparse_ptr)->hole[*nholes].npages = 1;
 		*last_sparse_index = i;
-	} else {
+	} else if ((*sparse_ptr)->hole[*nholes].npages < U16_MAX) {
 		(*sparse_ptr)->hole[*nholes].npages++;
 		*last_sparse_index = i;
+	} else {
+		*last_sparse_index = i;
+		return (i - nvfsio->nvfs_active_blocks_start) * NVFS_BLOCK_SIZE;
 	}
 
 	return 0;
 }
 
 static int nvfs_handle_done_block_validation(struct nvfs_io *nvfsio, nvfs_mgroup_ptr_t nvfs_mgroup,
-					      struct nvfs_io_metadata *nvfs_mpages, int i, int last_done_block,
+					      const u8 *blk_state, int i, int last_done_block,
 					      nvfs_io_sparse_dptr_t *sparse_ptr, int *nholes, int *last_sparse_index,
 					      int sparse_read_bytes_limit, bool validate)
 {
 	int ret = 0;
 
-	if (validate && nvfs_mpages[i].nvfs_state != NVFS_IO_DMA_START) {
+	if (validate && blk_state[i] != NVFS_IO_DMA_START) {
 		if (i > last_done_block) {
-			if (validate && nvfs_mpages[i].nvfs_state != NVFS_IO_QUEUED) {
+			if (validate && blk_state[i] != NVFS_IO_QUEUED) {
 				ret = -EIO;
 				WARN_ON_ONCE(1);
 			}
@@ -868,7 +1501,7 @@ static int nvfs_handle_done_block_validation(struct nvfs_io *nvfsio, nvfs_mgroup
 				}
 			} else {
 				nvfs_dbg("WRITE: block index: %d, expected NVFS_IO_DMA_START, current state: %x\n",
-					 i, nvfs_mpages[i].nvfs_state);
+					 i, blk_state[i]);
 				ret = -EIO;
 			}
 		}
@@ -876,21 +1509,34 @@ static int nvfs_handle_done_block_validation(struct nvfs_io *nvfsio, nvfs_mgroup
 	return ret;
 }
 
-void nvfs_mgroup_check_and_set(nvfs_mgroup_ptr_t nvfs_mgroup, enum nvfs_block_state state, bool validate,
-			       bool update_nvfsio)
+void nvfs_mgroup_check_and_set(nvfs_mgroup_ptr_t nvfs_mgroup, struct nvfs_io *nvfsio,
+			       enum nvfs_block_state state, bool validate, bool update_nvfsio)
 {
-	struct nvfs_io_metadata  *nvfs_mpages = nvfs_mgroup->nvfs_metadata;
+	u8 *blk_state = nvfs_mgroup->nvfs_block_state;
 	nvfs_io_sparse_dptr_t sparse_ptr = NULL;
 	int last_sparse_index = -1;
-	struct nvfs_io *nvfsio = &nvfs_mgroup->nvfsio;
-	unsigned int done_blocks = DIV_ROUND_UP(nvfsio->ret, NVFS_BLOCK_SIZE);
-	unsigned int issued_blocks = (nvfsio->nvfs_active_blocks_end - nvfsio->nvfs_active_blocks_start + 1);
+	unsigned int done_blocks, issued_blocks;
+	unsigned int states = 0;
 	int i, nholes = -1;
 	int  last_done_block = 0; // needs to be int to handle 0 bytes done.
 	int sparse_read_bytes_limit = 0; // set only if we reach max hole regions
 	int ret = 0;
-	int cur_block_num = nvfsio->nvfs_active_blocks_start;
-	int last_block_num = nvfsio->nvfs_active_blocks_end;
+	int cur_block_num, end_block_num;
+
+	// buffer wide initialization, not tied to any IO slot
+	if (state == NVFS_IO_INIT) {
+		WARN_ON_ONCE(validate &&
+			     nvfs_blocks_find_state_not(blk_state, 0, nvfs_mgroup->nvfs_blocks_count,
+							BIT(NVFS_IO_ALLOC)) != nvfs_mgroup->nvfs_blocks_count);
+		memset(blk_state, state, nvfs_mgroup->nvfs_blocks_count);
+		return;
+	}
+
+	BUG_ON(!nvfsio);
+	done_blocks = DIV_ROUND_UP(nvfsio->ret, NVFS_BLOCK_SIZE);
+	issued_blocks = (nvfsio->nvfs_active_blocks_end - nvfsio->nvfs_active_blocks_start + 1);
+	cur_block_num = nvfsio->nvfs_active_blocks_start;
+	end_block_num = max_t(int, nvfsio->nvfs_active_blocks_end + 1, cur_block_num);
 
 	if (validate && (state == NVFS_IO_DONE)) {
 		BUG_ON(nvfsio->ret < 0);
@@ -898,7 +1544,7 @@ void nvfs_mgroup_check_and_set(nvfs_mgroup_ptr_t nvfs_mgroup, enum nvfs_block_st
 
 		/* setup sparse metadata structure */
 		if (nvfsio->op == READ && nvfsio->check_sparse == true)
-			sparse_ptr = nvfs_io_map_sparse_data(nvfs_mgroup);
+			sparse_ptr = nvfs_io_map_sparse_data(nvfsio);
 
 		/*setup the last block IO was seen based on the ret value */
 		if (done_blocks < issued_blocks) {
@@ -914,70 +1560,61 @@ void nvfs_mgroup_check_and_set(nvfs_mgroup_ptr_t nvfs_mgroup, enum nvfs_block_st
 		}
 	}
 
-	if (state == NVFS_IO_INIT) {
-		cur_block_num = 0;
-		last_block_num = nvfs_mgroup->nvfs_blocks_count - 1;
-	}
 	/* check that every block has seen the dma mapping call on success */
-	for (i = cur_block_num; i <= last_block_num; i++) {
-		switch (state) {
-		case NVFS_IO_FREE:
-			WARN_ON_ONCE(validate && nvfs_mpages[i].nvfs_state != NVFS_IO_INIT
-					 && nvfs_mpages[i].nvfs_state != NVFS_IO_ALLOC
-					 && nvfs_mpages[i].nvfs_state != NVFS_IO_DONE);
-			break;
-		case NVFS_IO_ALLOC:
-			WARN_ON_ONCE(validate && nvfs_mpages[i].nvfs_state != NVFS_IO_FREE);
-			break;
-		case NVFS_IO_INIT:
-			WARN_ON_ONCE(validate && nvfs_mpages[i].nvfs_state != NVFS_IO_ALLOC);
-			break;
-		case NVFS_IO_QUEUED:
-			WARN_ON_ONCE(validate && nvfs_mpages[i].nvfs_state != NVFS_IO_INIT
-				    && nvfs_mpages[i].nvfs_state != NVFS_IO_DONE);
-			break;
-		case NVFS_IO_DMA_START:
-		case NVFS_IO_DMA_ERROR:
-			WARN_ON_ONCE(validate && nvfs_mpages[i].nvfs_state != NVFS_IO_QUEUED
-				     && nvfs_mpages[i].nvfs_state != NVFS_IO_DMA_START);
-			break;
-		case NVFS_IO_DONE:
-			if (i >= nvfsio->nvfs_active_blocks_start && i <= nvfsio->nvfs_active_blocks_end) {
-				int result = nvfs_handle_done_block_validation(nvfsio, nvfs_mgroup, nvfs_mpages,
-									       i, last_done_block, &sparse_ptr,
-									       &nholes, &last_sparse_index,
-									       sparse_read_bytes_limit, validate);
-				if (result > 0)
-					sparse_read_bytes_limit = result;
-				else if (result < 0)
-					ret = result;
-			} else if (i > nvfsio->nvfs_active_blocks_end || i < nvfsio->nvfs_active_blocks_start) {
-				if (validate && nvfs_mpages[i].nvfs_state != NVFS_IO_INIT) {
-					// We shouldn't be seeing a page which are out of bounds
-					BUG_ON(1);
-				}
-				// don't update the state to DONE.
-				continue;
-			}
-			break;
-		default:
-			WARN_ON_ONCE(1);
-			ret = -EIO;
-			break;
+	switch (state) {
+	case NVFS_IO_FREE:
+		states = BIT(NVFS_IO_INIT) | BIT(NVFS_IO_ALLOC) | BIT(NVFS_IO_DONE);
+		break;
+	case NVFS_IO_ALLOC:
+		states = BIT(NVFS_IO_FREE);
+		break;
+	case NVFS_IO_QUEUED:
+		states = BIT(NVFS_IO_INIT) | BIT(NVFS_IO_DONE);
+		break;
+	case NVFS_IO_DMA_START:
+	case NVFS_IO_DMA_ERROR:
+		states = BIT(NVFS_IO_QUEUED) | BIT(NVFS_IO_DMA_START);
+		break;
+	case NVFS_IO_DONE:
+		// blocks not DMA'd are holes, past EOF or errors
+		for (i = cur_block_num; validate; i++) {
+			int result;
+
+			i = nvfs_blocks_find_state_not(blk_state, i, end_block_num,
+						       BIT(NVFS_IO_DMA_START));
+			if (i >= end_block_num)
+				break;
+			result = nvfs_handle_done_block_validation(nvfsio, nvfs_mgroup, blk_state,
+								   i, last_done_block, &sparse_ptr,
+								   &nholes, &last_sparse_index,
+								   sparse_read_bytes_limit, validate);
+			if (result > 0)
+				sparse_read_bytes_limit = result;
+			else if (result < 0)
+				ret = result;
 		}
+		break;
+	default:
+		WARN_ON_ONCE(1);
+		ret = -EIO;
+		break;
+	}
 
-		// Do not transition an active block to IO_DONE state,
-		// if process is exiting or the thread is interrupted
-		if (state == NVFS_IO_DONE &&
-				(i >= nvfsio->nvfs_active_blocks_start && i <= nvfsio->nvfs_active_blocks_end) &&
-				((!in_interrupt() && current->flags & PF_EXITING) || nvfsio->ret == -ERESTARTSYS)) {
-			if (nvfs_mpages[i].nvfs_state < NVFS_IO_QUEUED ||
-					nvfs_mpages[i].nvfs_state > NVFS_IO_DMA_START) {
-				nvfs_err("block %d in unexpected state: %d\n", i, nvfs_mpages[i].nvfs_state);
-			}
-		} else {
-			nvfs_mpages[i].nvfs_state = state;
-		}
+	if (states)
+		WARN_ON_ONCE(validate &&
+			     nvfs_blocks_find_state_not(blk_state, cur_block_num, end_block_num,
+							states) != end_block_num);
+
+	// Do not transition the active blocks to IO_DONE state,
+	// if process is exiting or the thread is interrupted
+	if (state == NVFS_IO_DONE &&
+			((!in_interrupt() && current->flags & PF_EXITING) || nvfsio->ret == -ERESTARTSYS)) {
+		i = nvfs_blocks_find_state_not(blk_state, cur_block_num, end_block_num,
+					       BIT(NVFS_IO_QUEUED) | BIT(NVFS_IO_DMA_START));
+		if (i < end_block_num)
+			nvfs_err("block %d in unexpected state: %d\n", i, blk_state[i]);
+	} else {
+		memset(blk_state + cur_block_num, state, end_block_num - cur_block_num);
 	}
 
 	if (state == NVFS_IO_DONE) {
@@ -1022,28 +1659,21 @@ void nvfs_mgroup_check_and_set(nvfs_mgroup_ptr_t nvfs_mgroup, enum nvfs_block_st
 		nvfsio->ret = sparse_read_bytes_limit;
 }
 
-static void nvfs_mgroup_fill_mpage(struct page *page, nvfs_mgroup_page_ptr_t nvfs_mdata, nvfs_io_t *nvfsio)
-{
-	BUG_ON(!page);
-	BUG_ON(nvfs_mdata->nvfs_start_magic != NVFS_START_MAGIC);
-	BUG_ON(nvfs_mdata->nvfs_state != NVFS_IO_INIT && nvfs_mdata->nvfs_state != NVFS_IO_DONE);
-	BUG_ON(folio_page(nvfs_mdata->folio, (nvfs_mdata->folio_offset / PAGE_SIZE)) != page);
-
-	nvfs_mdata->nvfs_state = NVFS_IO_QUEUED;
-	nvfs_dbg("page %p page->mapping: %lx, page->flags: %lx\n",
-		 page, (unsigned long)page->mapping, page->flags);
-}
-
-
-int nvfs_mgroup_fill_mpages(nvfs_mgroup_ptr_t nvfs_mgroup, unsigned int nr_blocks)
+int nvfs_mgroup_fill_mpages(nvfs_io_t *nvfsio, unsigned int nr_blocks)
 {
-	struct nvfs_io *nvfsio = &nvfs_mgroup->nvfsio;
-	int j;
+	nvfs_mgroup_ptr_t nvfs_mgroup = nvfsio->nvfs_mgroup;
+	unsigned long j;
 	unsigned long blockoff = 0;
-	int nvfs_block_count_per_page = (int) PAGE_SIZE / NVFS_BLOCK_SIZE;
+	u8 *blk_state = nvfs_mgroup->nvfs_block_state;
+	unsigned long win_start = nvfsio->window_start << NVFS_BLOCKS_PER_FOLIO_SHIFT;
+	unsigned long win_end;
+
+	BUG_ON(!nvfsio->window_nfolios);
+	win_end = min(win_start + (nvfsio->window_nfolios << NVFS_BLOCKS_PER_FOLIO_SHIFT),
+		      nvfs_mgroup->nvfs_blocks_count);
 
-	if (unlikely(nr_blocks > nvfs_mgroup->nvfs_blocks_count)) {
-		nvfs_err("nr_blocks :%u nvfs_blocks_count :%lu\n", nr_blocks, nvfs_mgroup->nvfs_blocks_count);
+	if (unlikely(nr_blocks > win_end - win_start)) {
+		nvfs_err("nr_blocks :%u window blocks :%lu\n", nr_blocks, win_end - win_start);
 		return -EIO;
 	}
 
@@ -1063,27 +1693,24 @@ int nvfs_mgroup_fill_mpages(nvfs_mgroup_ptr_t nvfs_mgroup, unsigned int nr_block
 		blockoff = nvfsio->gpu_page_offset >> NVFS_BLOCK_SHIFT;
 
 		// Check shadow buffer pages are big enough to map the (gpu base address + offset)
-		if (((blockoff + nr_blocks) > nvfs_mgroup->nvfs_blocks_count))
+		if (((win_start + blockoff + nr_blocks) > win_end))
 			return -EIO;
 
-		for (j = 0; j < blockoff; ++j)
-			nvfs_mgroup->nvfs_metadata[j].nvfs_state = NVFS_IO_INIT;
+		memset(blk_state + win_start, NVFS_IO_INIT, blockoff);
 	}
 
-	nvfsio->nvfs_active_blocks_start = blockoff;
-	for (j = blockoff; j < nr_blocks + blockoff; ++j) {
-		unsigned int folio_idx = j / (GPU_PAGE_SIZE / NVFS_BLOCK_SIZE);
-		unsigned int page_in_folio = (j % (GPU_PAGE_SIZE / NVFS_BLOCK_SIZE)) / nvfs_block_count_per_page;
-		struct page *page = folio_page(nvfs_mgroup->nvfs_folios[folio_idx], page_in_folio);
-		nvfs_mgroup_fill_mpage(page, &nvfs_mgroup->nvfs_metadata[j], nvfsio);
-	}
+	nvfsio->nvfs_active_blocks_start = win_start + blockoff;
+	j = nvfsio->nvfs_active_blocks_start + nr_blocks;
+	BUG_ON(nvfs_blocks_find_state_not(blk_state, nvfsio->nvfs_active_blocks_start, j,
+					  BIT(NVFS_IO_INIT) | BIT(NVFS_IO_DONE)) != j);
+	memset(blk_state + nvfsio->nvfs_active_blocks_start, NVFS_IO_QUEUED, nr_blocks);
 	nvfsio->nvfs_active_blocks_end = (j > 0 ? j-1 : 0);
 
-	// Clear the state for unqueued pages
-	for (; j < nvfs_mgroup->nvfs_blocks_count ; j++)
-		nvfs_mgroup->nvfs_metadata[j].nvfs_state = NVFS_IO_INIT;
+	// Clear the state for unqueued pages of the window
+	memset(blk_state + j, NVFS_IO_INIT, win_end - j);
 
-	nvfsio->cpuvaddr += nvfsio->nvfs_active_blocks_start << NVFS_BLOCK_SHIFT;
+	nvfsio->cpuvaddr = (char __user *)(nvfs_mgroup->cpu_base_vaddr +
+			   (nvfsio->nvfs_active_blocks_start << NVFS_BLOCK_SHIFT));
 	nvfs_dbg("cpuvaddr: %llx active shadow blocks range set to (%ld -  %ld)\n",
 		  (u64)nvfsio->cpuvaddr,
 		  nvfsio->nvfs_active_blocks_start,
@@ -1091,116 +1718,160 @@ int nvfs_mgroup_fill_mpages(nvfs_mgroup_ptr_t nvfs_mgroup, unsigned int nr_block
 	return 0;
 }
 
-// eg: page->index relative to base_index (16 + 1) will return 1, 4K
-// eg: page->index relative to base_index (32 + 2) will return 2, 8K
+// GPU page backing the shadow folio is picked relative to the window of the
+// IO owning the folio, eg: folio 5 of a window starting at folio 4 maps to
+// cur_gpu_base_index + 1
 void nvfs_mgroup_get_gpu_index_and_off_folio(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio,
 				       unsigned long *gpu_index, pgoff_t *offset)
 {
-	unsigned long rel_folio_index = (folio->index % NVFS_MAX_SHADOW_PAGES);
-
-	*gpu_index = nvfs_mgroup->nvfsio.cur_gpu_base_index + (rel_folio_index >> PAGE_PER_GPU_PAGE_SHIFT);
-	if (PAGE_SIZE < GPU_PAGE_SIZE)
-		*offset = (rel_folio_index % GPU_PAGE_SHIFT) << PAGE_SHIFT;
+	unsigned long page_index = nvfs_folio_page_index(folio);
+	nvfs_io_t *nvfsio = nvfs_mgroup_folio_to_io(nvfs_mgroup, folio);
+
+	BUG_ON(!nvfsio);
+	*gpu_index = nvfsio->cur_gpu_base_index +
+		((page_index >> PAGE_PER_GPU_PAGE_SHIFT) - nvfsio->window_start);
+	// folios smaller than 64K start inside their GPU page
+	*offset = (page_index & ((1UL << PAGE_PER_GPU_PAGE_SHIFT) - 1)) << PAGE_SHIFT;
 }
 
+// same as above, with the offset of the 4K page within its 64K GPU page
 void nvfs_mgroup_get_gpu_index_and_off(nvfs_mgroup_ptr_t nvfs_mgroup, struct page *page,
 				       unsigned long *gpu_index, pgoff_t *offset)
 {
-	nvfs_mgroup_get_gpu_index_and_off_folio(nvfs_mgroup, page_folio(page), gpu_index, offset);
+	struct folio *folio = page_folio(page);
+
+	nvfs_mgroup_get_gpu_index_and_off_folio(nvfs_mgroup, folio, gpu_index, offset);
+	*offset += (page_to_pfn(page) - folio_pfn(folio)) << PAGE_SHIFT;
 }
 
-uint64_t nvfs_mgroup_get_gpu_physical_address_folio(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio)
+static uint64_t nvfs_mgroup_gpu_physical_address(nvfs_mgroup_ptr_t nvfs_mgroup,
+						 unsigned long gpu_page_index, pgoff_t pgoff)
 {
 	struct nvfs_gpu_args *gpu_info = &nvfs_mgroup->gpu_info;
+	unsigned long table_index = nvfs_gpu_table_index(gpu_info, gpu_page_index);
+	dma_addr_t phys_base_addr;
+
+	phys_base_addr = gpu_info->page_table->pages[table_index]->physical_address;
+	return phys_base_addr + nvfs_gpu_table_offset(gpu_info, gpu_page_index) + pgoff;
+}
+
+uint64_t nvfs_mgroup_get_gpu_physical_address_folio(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio)
+{
 	unsigned long gpu_page_index = ULONG_MAX;
 	pgoff_t pgoff = 0;
-	dma_addr_t phys_base_addr, phys_start_addr;
 
 	nvfs_mgroup_get_gpu_index_and_off_folio(nvfs_mgroup, folio,
 			&gpu_page_index, &pgoff);
+	return nvfs_mgroup_gpu_physical_address(nvfs_mgroup, gpu_page_index, pgoff);
+}
 
-	phys_base_addr = gpu_info->page_table->pages[gpu_page_index]->physical_address;
-	phys_start_addr = phys_base_addr + pgoff;
+uint64_t nvfs_mgroup_get_gpu_physical_address(nvfs_mgroup_ptr_t nvfs_mgroup, struct page *page)
+{
+	unsigned long gpu_page_index = ULONG_MAX;
+	pgoff_t pgoff = 0;
 
-	return phys_start_addr;
+	nvfs_mgroup_get_gpu_index_and_off(nvfs_mgroup, page,
+			&gpu_page_index, &pgoff);
+	return nvfs_mgroup_gpu_physical_address(nvfs_mgroup, gpu_page_index, pgoff);
 }
 
-uint64_t nvfs_mgroup_get_gpu_physical_address(nvfs_mgroup_ptr_t nvfs_mgroup, struct page *page)
+/* true if @tag is the mgroup hashed at @base_index, without dereferencing @tag */
+static bool nvfs_mgroup_hashed_rcu(nvfs_mgroup_ptr_t tag, unsigned long base_index)
 {
-	return nvfs_mgroup_get_gpu_physical_address_folio(nvfs_mgroup, page_folio(page));
+	nvfs_mgroup_ptr_t nvfs_mgroup;
+
+	hash_for_each_possible_rcu(nvfs_io_mgroup_hash, nvfs_mgroup, hash_link, base_index) {
+		if (nvfs_mgroup == tag)
+			return true;
+	}
+	return false;
 }
 
-static nvfs_mgroup_ptr_t __nvfs_mgroup_from_folio(struct folio *folio, bool check_dma_error)
+/*
+ * Shadow folios point at their mgroup through folio->private, set when the
+ * buffer is mmapped and cleared before the mgroup is freed. A folio without
+ * the tag is not a shadow folio, so checking pages of non GDS IO costs a
+ * couple of loads. Folios not owned by nvfs may use folio->private for
+ * anything, so the tag is only dereferenced once found in the mgroup hash
+ * under the base index packed in folio->index, then validated against the
+ * mgroup. Must be called under rcu_read_lock(), the mgroup is unhashed
+ * before its folios are untagged and freed after a grace period.
+ */
+static nvfs_mgroup_ptr_t nvfs_folio_mgroup_rcu(struct folio *folio)
 {
-	unsigned long base_index;
-	nvfs_mgroup_ptr_t nvfs_mgroup = NULL;
-	nvfs_mgroup_page_ptr_t nvfs_mpage;
-	struct nvfs_io *nvfsio = NULL;
-	int i = 0;
-	int nvfs_block_count_per_page = (int) PAGE_SIZE / NVFS_BLOCK_SIZE;
-	unsigned int folio_idx = 0;
-	unsigned int blocks_per_folio = folio_size(folio) / NVFS_BLOCK_SIZE;
-	bool found_folio = false;
+	nvfs_mgroup_ptr_t nvfs_mgroup;
+	unsigned long base_index, page_idx;
 
-	// bailout if folio mapping is not NULL
 	if (folio == NULL || folio->mapping != NULL)
 		return NULL;
 
-	base_index = (folio->index >> NVFS_MAX_SHADOW_PAGES_ORDER);
-	if (base_index < NVFS_MIN_BASE_INDEX)
+	nvfs_mgroup = READ_ONCE(folio->private);
+	if (nvfs_mgroup == NULL)
 		return NULL;
 
-	nvfs_mgroup = nvfs_mgroup_get(base_index);
-	// check if the nvfs page group exists.
-	if (nvfs_mgroup == NULL)
+	base_index = folio->index >> NVFS_MAX_SHADOW_PAGES_ORDER;
+	if (!nvfs_mgroup_hashed_rcu(nvfs_mgroup, base_index) ||
+	    READ_ONCE(nvfs_mgroup->magic) != NVFS_MGROUP_MAGIC)
 		return NULL;
 
-	if (IS_ERR(nvfs_mgroup))
-		return ERR_PTR(-EIO);
+	page_idx = nvfs_folio_page_index(folio);
+	if (base_index != nvfs_mgroup->base_index ||
+	    page_idx >= nvfs_mgroup->nvfs_pages_count ||
+	    nvfs_mgroup->nvfs_folios[page_idx] != folio)
+		return NULL;
 
-	nvfsio = &nvfs_mgroup->nvfsio;
-	folio_idx = folio->index % NVFS_MAX_SHADOW_PAGES;
+	return nvfs_mgroup;
+}
 
-	// check if this folio is valid in our folios array
-	if (folio_idx < nvfs_mgroup->nvfs_folios_count && 
-	    nvfs_mgroup->nvfs_folios[folio_idx] == folio) {
-		found_folio = true;
-	}
+/* true if a block of the shadow folio failed its GPU DMA mapping */
+static bool nvfs_folio_dma_error(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio)
+{
+	unsigned long start_block = nvfs_folio_page_index(folio) << NVFS_PAGE_TO_BLOCK_ORDER;
+	unsigned long nblocks;
 
-	if (!found_folio) {
-		nvfs_mgroup_put(nvfs_mgroup);
-		WARN_ON_ONCE(1);
+	if (start_block >= nvfs_mgroup->nvfs_blocks_count)
+		return false;
+	nblocks = min_t(unsigned long, folio_size(folio) / NVFS_BLOCK_SIZE,
+			nvfs_mgroup->nvfs_blocks_count - start_block);
+	return memchr(nvfs_mgroup->nvfs_block_state + start_block, NVFS_IO_DMA_ERROR,
+		      nblocks) != NULL;
+}
+
+static nvfs_mgroup_ptr_t __nvfs_mgroup_from_folio(struct folio *folio, bool check_dma_error)
+{
+	nvfs_mgroup_ptr_t nvfs_mgroup = NULL;
+	struct nvfs_io *nvfsio = NULL;
+	unsigned int blocks_per_folio;
+
+	rcu_read_lock();
+	nvfs_mgroup = nvfs_folio_mgroup_rcu(folio);
+	// the last reference may be gone, the mgroup is then freed after this grace period
+	if (nvfs_mgroup != NULL && !atomic_inc_not_zero(&nvfs_mgroup->ref))
+		nvfs_mgroup = ERR_PTR(-EIO);
+	rcu_read_unlock();
+
+	// not a shadow folio
+	if (nvfs_mgroup == NULL)
 		return NULL;
-	}
 
-	// check metadata for this folio
-	unsigned int start_block = folio_idx * (GPU_PAGE_SIZE / NVFS_BLOCK_SIZE);
-	for (i = start_block; i < start_block + blocks_per_folio && i < nvfs_mgroup->nvfs_blocks_count; i++) {
-		nvfs_mpage = &nvfs_mgroup->nvfs_metadata[i];
-		if (nvfs_mpage == NULL || nvfs_mpage->nvfs_start_magic != NVFS_START_MAGIC) {
-			nvfs_mgroup_put(nvfs_mgroup);
-			WARN_ON_ONCE(1);
-			return NULL;
-		}
+	// a shadow folio of a buffer being torn down
+	if (IS_ERR(nvfs_mgroup))
+		return nvfs_mgroup;
 
-		if (nvfs_mpage->folio != folio) {
-			nvfs_mgroup_put(nvfs_mgroup);
-			WARN_ON_ONCE(1);
-			return NULL;
-		}
+	blocks_per_folio = folio_size(folio) / NVFS_BLOCK_SIZE;
 
-		if (check_dma_error && nvfs_mpage->nvfs_state == NVFS_IO_DMA_ERROR) {
-			nvfs_mgroup_put(nvfs_mgroup);
-			return ERR_PTR(-EIO);
-		}
+	// the folio was checked against the mgroup, check the state of its blocks
+	unsigned int start_block = nvfs_folio_page_index(folio) << NVFS_PAGE_TO_BLOCK_ORDER;
+	if (check_dma_error && nvfs_folio_dma_error(nvfs_mgroup, folio)) {
+		nvfs_mgroup_put(nvfs_mgroup);
+		return ERR_PTR(-EIO);
 	}
 
-	// check if the folio range is within active blocks
-	unsigned int folio_start_page = folio->index % NVFS_MAX_SHADOW_PAGES;
-	unsigned int folio_end_page = folio_start_page + folio_nr_pages(folio) - 1;
-	
-	if ((nvfsio->nvfs_active_blocks_start/nvfs_block_count_per_page) > folio_end_page ||
-	    (nvfsio->nvfs_active_blocks_end/nvfs_block_count_per_page) < folio_start_page) {
+	// check if the folio range is within active blocks of the IO owning it
+	nvfsio = nvfs_mgroup_folio_to_io(nvfs_mgroup, folio);
+	if (nvfsio == NULL ||
+	    nvfsio->nvfs_active_blocks_start > start_block + blocks_per_folio - 1 ||
+	    nvfsio->nvfs_active_blocks_end < start_block) {
 		nvfs_mgroup_put(nvfs_mgroup);
 		return ERR_PTR(-EIO);
 	}
@@ -1216,12 +1887,11 @@ static nvfs_mgroup_ptr_t __nvfs_mgroup_from_page(struct page *page, bool check_d
 nvfs_mgroup_ptr_t nvfs_mgroup_from_page_range(struct page *page, int nblocks, unsigned int start_offset)
 {
 	nvfs_mgroup_ptr_t nvfs_mgroup = NULL;
-	nvfs_mgroup_page_ptr_t nvfs_mpage = NULL, prev_mpage = NULL;
 	struct nvfs_io *nvfsio = NULL;
-	unsigned int i = 0;
-	int nvfs_block_count_per_page = (int) PAGE_SIZE / NVFS_BLOCK_SIZE;
-	unsigned int block_idx;
-	unsigned int cur_page;
+	unsigned long block_idx, end_block, last_block, i;
+	long err_block = -1;
+	struct folio *prev, *next;
+	u8 *blk_state;
 
 	nvfs_dbg("setting metadata for %d nblocks from page: %p and start offset :%u\n", nblocks, page, start_offset);
 	nvfs_mgroup = __nvfs_mgroup_from_page(page, false);
@@ -1231,47 +1901,60 @@ nvfs_mgroup_ptr_t nvfs_mgroup_from_page_range(struct page *page, int nblocks, un
 	if (IS_ERR(nvfs_mgroup))
 		return ERR_PTR(-EIO);
 
-	block_idx = (page_folio(page)->index % NVFS_MAX_SHADOW_PAGES) * nvfs_block_count_per_page;
-	block_idx += ((start_offset) / NVFS_BLOCK_SIZE);
-	for (i = 0; i < nblocks ; i++) {
-		// Check the page range is not beyond the issued range
-		nvfsio = &nvfs_mgroup->nvfsio;
-		cur_page = i / nvfs_block_count_per_page;
-		if (((page_folio(page)->index + cur_page) % NVFS_MAX_SHADOW_PAGES) > (nvfsio->nvfs_active_blocks_end/nvfs_block_count_per_page)) {
-			WARN_ON_ONCE(1);
-			nvfs_dbg("page index: %lu cur_page: %u, blockend: %lu\n", page_folio(page)->index, cur_page,
-					nvfsio->nvfs_active_blocks_end);
-			goto err;
-		}
+	nvfsio = nvfs_mgroup_folio_to_io(nvfs_mgroup, page_folio(page));
+	if (!nvfsio) {
+		WARN_ON_ONCE(1);
+		goto err;
+	}
 
-		nvfs_mpage = &nvfs_mgroup->nvfs_metadata[block_idx + i];
+	blk_state = nvfs_mgroup->nvfs_block_state;
+	block_idx = nvfs_page_to_block_index(page);
+	block_idx += ((start_offset) / NVFS_BLOCK_SIZE);
+	end_block = block_idx + max(nblocks, 0);
 
-		// Check the blocks are in same folio or in indeed contiguous folios
-		if (prev_mpage && nvfs_mpage->folio && prev_mpage->folio) {
-			struct page *curr_page = folio_page(nvfs_mpage->folio, nvfs_mpage->folio_offset / PAGE_SIZE);
-			struct page *prev_page = folio_page(prev_mpage->folio, prev_mpage->folio_offset / PAGE_SIZE);
-			if ((page_to_pfn(curr_page) != page_to_pfn(prev_page) + 1) &&
-			    (page_to_pfn(curr_page) != page_to_pfn(prev_page))) {
-				WARN_ON_ONCE(1);
-				goto err;
-			}
-		}
+	// Check the page range is not beyond the issued range
+	last_block = min_t(unsigned long, end_block, nvfsio->nvfs_active_blocks_end + 1);
+	if (last_block < end_block) {
+		WARN_ON_ONCE(1);
+		nvfs_dbg("page index: %lu block: %lu, blockend: %lu\n", page_folio(page)->index,
+			 last_block, nvfsio->nvfs_active_blocks_end);
+		if (last_block > block_idx)
+			err_block = last_block - 1;
+		end_block = last_block;
+	}
 
-		if (nvfs_mpage->nvfs_state != NVFS_IO_QUEUED &&
-		   nvfs_mpage->nvfs_state != NVFS_IO_DMA_START)	{
+	// Check the blocks are in same folio or in indeed contiguous folios
+	prev = block_idx < end_block ?
+		nvfs_mgroup->nvfs_folios[block_idx >> NVFS_PAGE_TO_BLOCK_ORDER] : NULL;
+	for (i = prev ? (nvfs_folio_page_index(prev) + folio_nr_pages(prev)) << NVFS_PAGE_TO_BLOCK_ORDER : end_block;
+	     i < end_block; i += folio_nr_pages(prev) << NVFS_PAGE_TO_BLOCK_ORDER) {
+		next = nvfs_mgroup->nvfs_folios[i >> NVFS_PAGE_TO_BLOCK_ORDER];
+		if (folio_pfn(next) != folio_pfn(prev) + folio_nr_pages(prev)) {
 			WARN_ON_ONCE(1);
-			goto err;
+			err_block = i;
+			end_block = i;
+			break;
 		}
+		prev = next;
+	}
 
-		nvfs_dbg("%u block dma start %p\n", block_idx + i, nvfs_mpage);
-		// Updating block metadata state
-		nvfs_mpage->nvfs_state = NVFS_IO_DMA_START;
-		prev_mpage = nvfs_mpage;
+	i = nvfs_blocks_find_state_not(blk_state, block_idx, end_block,
+				       BIT(NVFS_IO_QUEUED) | BIT(NVFS_IO_DMA_START));
+	if (i < end_block) {
+		WARN_ON_ONCE(1);
+		err_block = i;
+		end_block = i;
+	}
+
+	nvfs_dbg("%lu-%lu blocks dma start\n", block_idx, end_block);
+	// Updating block metadata state
+	memset(blk_state + block_idx, NVFS_IO_DMA_START, end_block - block_idx);
+	if (err_block >= 0) {
+		blk_state[err_block] = NVFS_IO_DMA_ERROR;
+		goto err;
 	}
 	return nvfs_mgroup;
 err:
-	if (nvfs_mpage)
-		nvfs_mpage->nvfs_state = NVFS_IO_DMA_ERROR;
 	if (nvfs_mgroup)
 		nvfs_mgroup_put(nvfs_mgroup);
 	return ERR_PTR(-EIO);
@@ -1284,10 +1967,9 @@ int nvfs_mgroup_metadata_set_dma_state_folio(struct folio *folio,
 {
 	unsigned int start_block = 0;
 	unsigned int end_block = 0;
-	nvfs_mgroup_page_ptr_t nvfs_mpage;
-	int nvfs_block_count_per_page = (int) PAGE_SIZE / NVFS_BLOCK_SIZE;
+	u8 *blk_state;
 	int block_idx = 0;
-	int i;
+	unsigned long i;
 
 	if (!nvfs_mgroup)
 		return -EIO;
@@ -1295,34 +1977,29 @@ int nvfs_mgroup_metadata_set_dma_state_folio(struct folio *folio,
 	if (IS_ERR(nvfs_mgroup))
 		return -EIO;
 
+	blk_state = nvfs_mgroup->nvfs_block_state;
 	start_block = METADATA_BLOCK_START_INDEX(bv_offset);
 	end_block = METADATA_BLOCK_END_INDEX(bv_offset, bv_len);
-	block_idx = (folio->index % NVFS_MAX_SHADOW_PAGES) * nvfs_block_count_per_page;
-
-	// For each
-	for (i = block_idx + start_block; i <= block_idx + end_block; i++) {
-		nvfs_mpage = &nvfs_mgroup->nvfs_metadata[i];
-
-		if (nvfs_mpage->nvfs_state != NVFS_IO_QUEUED &&
-			nvfs_mpage->nvfs_state != NVFS_IO_DMA_START) {
-			nvfs_err("%s: found folio in wrong state: %d, folio->index: %ld at block: %d len: %u and offset: %u\n",
-				 __func__, nvfs_mpage->nvfs_state, folio->index % NVFS_MAX_SHADOW_PAGES, i, bv_len, bv_offset);
-			nvfs_mpage->nvfs_state = NVFS_IO_DMA_ERROR;
-			nvfs_mgroup_put(nvfs_mgroup);
-			WARN_ON_ONCE(1);
-			return (-EIO);
-		}
-
-		if (nvfs_mpage->nvfs_state == NVFS_IO_QUEUED) {
-			nvfs_mpage->nvfs_state = NVFS_IO_DMA_START;
-			nvfs_dbg("%s : setting folio in IO_QUEUED, folio->index: %ld at block: %d\n",
-				 __func__, folio->index % NVFS_MAX_SHADOW_PAGES, i);
-		} else if (nvfs_mpage->nvfs_state == NVFS_IO_DMA_START) {
-			nvfs_dbg("%s : setting folio in IO_DMA_START, folio->index: %ld at block: %d\n",
-				 __func__, folio->index % NVFS_MAX_SHADOW_PAGES, i);
-		}
+	block_idx = nvfs_folio_page_index(folio) << NVFS_PAGE_TO_BLOCK_ORDER;
+	start_block += block_idx;
+	end_block += block_idx + 1;
+
+	i = nvfs_blocks_find_state_not(blk_state, start_block, end_block,
+				       BIT(NVFS_IO_QUEUED) | BIT(NVFS_IO_DMA_START));
+	if (i < end_block) {
+		nvfs_err("%s: found folio in wrong state: %d, folio->index: %ld at block: %lu len: %u and offset: %u\n",
+			 __func__, blk_state[i], folio->index % NVFS_MAX_SHADOW_PAGES, i, bv_len, bv_offset);
+		memset(blk_state + start_block, NVFS_IO_DMA_START, i - start_block);
+		blk_state[i] = NVFS_IO_DMA_ERROR;
+		nvfs_mgroup_put(nvfs_mgroup);
+		WARN_ON_ONCE(1);
+		return (-EIO);
 	}
 
+	nvfs_dbg("%s : setting folio in IO_DMA_START, folio->index: %ld at blocks: %u-%u\n",
+		 __func__, folio->index % NVFS_MAX_SHADOW_PAGES, start_block, end_block - 1);
+	memset(blk_state + start_block, NVFS_IO_DMA_START, end_block - start_block);
+
 	// success
 	return 0;
 }
@@ -1332,13 +2009,17 @@ int nvfs_mgroup_metadata_set_dma_state(struct page *page,
 				       unsigned int bv_len,
 				       unsigned int bv_offset)
 {
-	return nvfs_mgroup_metadata_set_dma_state_folio(page_folio(page), nvfs_mgroup, bv_len, bv_offset);
+	struct folio *folio = page_folio(page);
+
+	// bv_offset is relative to the page, make it relative to the folio
+	bv_offset += (page_to_pfn(page) - folio_pfn(folio)) << PAGE_SHIFT;
+	return nvfs_mgroup_metadata_set_dma_state_folio(folio, nvfs_mgroup, bv_len, bv_offset);
 }
 
 nvfs_mgroup_ptr_t nvfs_mgroup_from_folio(struct folio *folio)
 {
 	nvfs_mgroup_ptr_t nvfs_mgroup = NULL;
-	nvfs_mgroup_page_ptr_t nvfs_mpage;
+	u8 *blk_state;
 
 	nvfs_mgroup = __nvfs_mgroup_from_folio(folio, false);
 	if (!nvfs_mgroup)
@@ -1348,13 +2029,13 @@ nvfs_mgroup_ptr_t nvfs_mgroup_from_folio(struct folio *folio)
 		return ERR_PTR(-EIO);
 
 	if (PAGE_SIZE < GPU_PAGE_SIZE) {
-		unsigned int folio_start_block = (folio->index % NVFS_MAX_SHADOW_PAGES) * (folio_size(folio) / NVFS_BLOCK_SIZE);
-		nvfs_mpage = &nvfs_mgroup->nvfs_metadata[folio_start_block];
-		if (nvfs_mpage->nvfs_state != NVFS_IO_QUEUED &&
-				nvfs_mpage->nvfs_state != NVFS_IO_DMA_START) {
+		unsigned int folio_start_block = nvfs_folio_page_index(folio) << NVFS_PAGE_TO_BLOCK_ORDER;
+		blk_state = &nvfs_mgroup->nvfs_block_state[folio_start_block];
+		if (*blk_state != NVFS_IO_QUEUED &&
+				*blk_state != NVFS_IO_DMA_START) {
 			nvfs_err("%s: found folio in wrong state: %d, folio->index: %ld\n",
-				 __func__, nvfs_mpage->nvfs_state, folio->index % NVFS_MAX_SHADOW_PAGES);
-			nvfs_mpage->nvfs_state = NVFS_IO_DMA_ERROR;
+				 __func__, *blk_state, folio->index % NVFS_MAX_SHADOW_PAGES);
+			*blk_state = NVFS_IO_DMA_ERROR;
 			nvfs_mgroup_put(nvfs_mgroup);
 			WARN_ON_ONCE(1);
 			return ERR_PTR(-EIO);
@@ -1363,6 +2044,21 @@ nvfs_mgroup_ptr_t nvfs_mgroup_from_folio(struct folio *folio)
 	return nvfs_mgroup;
 }
 
+/*
+ * Check that @folio is a shadow folio of @nvfs_mgroup, for callers already
+ * holding a reference on the mgroup: no hash lookup and no refcount.
+ */
+bool nvfs_mgroup_owns_folio(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio)
+{
+	unsigned long page_idx = nvfs_folio_page_index(folio);
+
+	return READ_ONCE(folio->private) == nvfs_mgroup &&
+	       folio->mapping == NULL &&
+	       (folio->index >> NVFS_MAX_SHADOW_PAGES_ORDER) == nvfs_mgroup->base_index &&
+	       page_idx < nvfs_mgroup->nvfs_pages_count &&
+	       nvfs_mgroup->nvfs_folios[page_idx] == folio;
+}
+
 nvfs_mgroup_ptr_t nvfs_mgroup_from_page(struct page *page)
 {
 	return nvfs_mgroup_from_folio(page_folio(page));
@@ -1375,21 +2071,15 @@ nvfs_mgroup_ptr_t nvfs_mgroup_from_page(struct page *page)
  */
 bool nvfs_is_gpu_folio(struct folio *folio)
 {
-	nvfs_mgroup_ptr_t nvfs_mgroup;
+	bool gpu_folio;
 
-	nvfs_mgroup = __nvfs_mgroup_from_folio(folio, false);
-
-	if (nvfs_mgroup == NULL)
-		return false;
-	else if (IS_ERR(nvfs_mgroup))
-		// This is a GPU folio but we did not take reference as we are in shutdown path
-		// But, we will return true to the caller so that caller doesn't think it is a
-		// CPU folio and fall back to CPU path
-		return true;
-
-	nvfs_mgroup_put(nvfs_mgroup);
+	// A shadow folio is a GPU folio whatever its IO state, so that
+	// callers don't fall back to the CPU path for it.
+	rcu_read_lock();
+	gpu_folio = (nvfs_folio_mgroup_rcu(folio) != NULL);
+	rcu_read_unlock();
 
-	return true;
+	return gpu_folio;
 }
 
 /* nvfs_is_gpu_page : checks if a page belongs to a GPU request
@@ -1431,6 +2121,76 @@ int nvfs_check_gpu_folio_and_error(struct folio *folio, unsigned int offset, uns
 	return 1;
 }
 
+/*
+ * Per request dma cookie: a request mapped by nvfs_dma_map_sg_attrs_internal()
+ * from a single mgroup holds one mgroup reference and one dma reference for
+ * all its sg entries. Its sglist is recorded in one of the NVFS_IO_DMA_COOKIES
+ * cookies of the IO slot owning the shadow window its first sg entry maps,
+ * which outlives the request. Requests finding no free cookie, eg: more
+ * requests per IO in flight than cookies, hold references per sg entry
+ * instead.
+ */
+bool nvfs_mgroup_set_dma_cookie(nvfs_mgroup_ptr_t nvfs_mgroup, struct scatterlist *sglist)
+{
+	nvfs_io_t *nvfsio = nvfs_mgroup_folio_to_io(nvfs_mgroup, page_folio(sg_page(sglist)));
+	unsigned int i;
+
+	for (i = 0; nvfsio && i < NVFS_IO_DMA_COOKIES; i++) {
+		if (cmpxchg(&nvfsio->dma_cookies[i], NULL, sglist) == NULL)
+			return true;
+	}
+	return false;
+}
+
+/* nvfs_mgroup_put_dma_cookie : consume the dma cookie of a request and drop its references
+ * @sglist (in)     : sglist the request was mapped from
+ * @nents (in)      : number of sg entries of the request
+ * @returns         : number of GPU sg entries released,
+ *                    NVFS_IO_ERR if the GPU dma mapping of an entry has failed,
+ *                    0 if the request has no cookie and its sg entries have to
+ *                    be checked one by one
+ */
+int nvfs_mgroup_put_dma_cookie(struct scatterlist *sglist, int nents)
+{
+	struct folio *folio = page_folio(sg_page(sglist));
+	nvfs_mgroup_ptr_t nvfs_mgroup;
+	nvfs_io_t *nvfsio = NULL;
+	struct scatterlist *sg;
+	bool owner = false;
+	int i, ret = nents;
+
+	rcu_read_lock();
+	nvfs_mgroup = nvfs_folio_mgroup_rcu(folio);
+	if (nvfs_mgroup)
+		nvfsio = nvfs_mgroup_folio_to_io(nvfs_mgroup, folio);
+	// only the request that took the cookie can release it
+	for (i = 0; nvfsio && i < NVFS_IO_DMA_COOKIES; i++) {
+		if (READ_ONCE(nvfsio->dma_cookies[i]) == sglist) {
+			owner = cmpxchg(&nvfsio->dma_cookies[i], sglist, NULL) == sglist;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	if (!owner)
+		return 0;
+
+	// the request holds the mgroup reference from here, report dma errors like the slow path
+	for_each_sg(sglist, sg, nents, i) {
+		if (nvfs_folio_dma_error(nvfs_mgroup, page_folio(sg_page(sg)))) {
+			ret = NVFS_IO_ERR;
+			break;
+		}
+	}
+
+	if (atomic_dec_if_positive(&nvfs_mgroup->dma_ref) < 0)
+		nvfs_stat_d(&nvfs_n_err_dma_ref);
+	else
+		nvfs_mgroup_put_dma(nvfs_mgroup);
+
+	return ret;
+}
+
 /* nvfs_check_gpu_page_and_error : checks if a page belongs to a GPU request and if it has any gpu dma mapping error
  * @page (in)       : start page pointer
  * @offset(in)	    : offset in page
@@ -1452,27 +2212,22 @@ int nvfs_check_gpu_page_and_error(struct page *page, unsigned int offset, unsign
  */
 unsigned int nvfs_gpu_index_from_folio(struct folio *folio)
 {
-	u64 pdevinfo;
 	nvfs_mgroup_ptr_t nvfs_mgroup;
+	unsigned int gpu_index = UINT_MAX;
 
-	nvfs_mgroup = __nvfs_mgroup_from_folio(folio, false);
-	// not a gpu folio
-	if (nvfs_mgroup == NULL || IS_ERR(nvfs_mgroup)) {
-		nvfs_err("%s : invalid gpu folio\n", __func__);
-		return UINT_MAX;
-	}
-
-	// does not contain gpu info
-	pdevinfo = nvfs_mgroup->gpu_info.pdevinfo;
+	rcu_read_lock();
+	nvfs_mgroup = nvfs_folio_mgroup_rcu(folio);
+	// gpu_hash_index is cached at map time along with pdevinfo
+	if (nvfs_mgroup != NULL && nvfs_mgroup->gpu_info.pdevinfo)
+		gpu_index = nvfs_mgroup->gpu_info.gpu_hash_index;
+	rcu_read_unlock();
 
-	if (!pdevinfo) {
+	if (nvfs_mgroup == NULL)
+		nvfs_err("%s : invalid gpu folio\n", __func__);
+	else if (gpu_index == UINT_MAX)
 		nvfs_err("%s : gpu bdf info not found in mgroup\n", __func__);
-		nvfs_mgroup_put(nvfs_mgroup);
-		return UINT_MAX;
-	}
 
-	nvfs_mgroup_put(nvfs_mgroup);
-	return nvfs_get_gpu_hash_index(pdevinfo);
+	return gpu_index;
 }
 
 /* Description      : get gpu index key given a GPU page.
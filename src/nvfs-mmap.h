@@ -27,6 +27,9 @@
 #include <linux/rculist.h>
 #include <linux/device.h>
 #include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/refcount.h>
 #include "nv-p2p.h"
 
 #define KiB4			(4096)
@@ -36,18 +39,35 @@
 #define METADATA_BLOCK_START_INDEX(bv_offset) (METADATA_BLOCK_INDEX(bv_offset))
 #define METADATA_BLOCK_END_INDEX(bv_offset, bv_len) (METADATA_BLOCK_INDEX((bv_offset) + (bv_len) - 1))
 #define NVFS_MIN_BASE_INDEX   (1UL<<32)
+#define NVFS_MGROUP_MAGIC	0x6e7666736d677270ULL
 #ifndef NVFS_PAGE_TO_BLOCK_ORDER
 #define NVFS_PAGE_TO_BLOCK_ORDER ((int)ilog2(PAGE_SIZE / NVFS_BLOCK_SIZE))
 #endif
-#define NVFS_MAX_SHADOW_PAGES_ORDER (12 - NVFS_PAGE_TO_BLOCK_ORDER)
+/*
+ * folio->index packs the base index of the shadow buffer, below 2^33, above
+ * NVFS_MAX_SHADOW_PAGES_ORDER bits of page index within the buffer.
+ */
+#ifndef NVFS_MAX_SHADOW_SIZE_SHIFT
+#define NVFS_MAX_SHADOW_SIZE_SHIFT 30	/* 1GB */
+#endif
+#define NVFS_MAX_SHADOW_PAGES_ORDER (NVFS_MAX_SHADOW_SIZE_SHIFT - PAGE_SHIFT)
 #define NVFS_MAX_SHADOW_ALLOCS_ORDER 12
 #define NVFS_MAX_SHADOW_PAGES (1 << NVFS_MAX_SHADOW_PAGES_ORDER)
+#define NVFS_DEFAULT_MAX_SHADOW_BUF_MB 16	/* larger buffers, up to NVFS_MAX_SHADOW_SIZE_SHIFT, are opt-in */
+
+#define NVFS_BLOCKS_PER_FOLIO_SHIFT (GPU_PAGE_SHIFT - NVFS_BLOCK_SHIFT)
+#define NVFS_BLOCKS_PER_FOLIO (1UL << NVFS_BLOCKS_PER_FOLIO_SHIFT)
+#define NVFS_MAX_IO_SLOTS BITS_PER_LONG
+#define NVFS_IO_DMA_COOKIES 16	/* requests of an IO holding refs for all their sg entries */
+#define NVFS_MGROUP_CACHE_BLOCKS 256	/* metadata of buffers up to 1MB uses nvfs_mgroup_metadata_cache */
+#define NVFS_DEFAULT_FOLIO_POOL_MAX 256	/* free shadow folios kept per numa node */
 
 #define MAX_PCI_BUCKETS 32
 #define MAX_PCI_BUCKETS_BITS ilog2(MAX_PCI_BUCKETS)
 #define MAX_RDMA_REGS_SUPPORTED 16
 
 struct nvfs_gpu_args;
+struct nvfs_io_mgroup;
 
 enum nvfs_block_state {
 	NVFS_IO_FREE = 0,  /* set on init */
@@ -98,6 +118,15 @@ static inline const char *nvfs_io_state_status(int state)
 	return "illegal io state";
 }
 
+/*
+ * Completion callback for IOs not reporting through the end fence metapage,
+ * called once per IO from nvfs_io_free(), possibly in interrupt context.
+ */
+typedef void (*nvfs_io_done_t)(void *data, u64 user_data, long res,
+			       enum nvfs_metastate state);
+
+struct nvfs_batch_ctx;
+
 typedef struct nvfs_io {
 	char __user *cpuvaddr;          // Shadow buffer address (4k aligned)
 	u64 length;                     // IO length
@@ -121,13 +150,51 @@ typedef struct nvfs_io {
 	ktime_t start_io;		// Start time of IO for latency calculation
 	ssize_t rdma_seg_offset;	// Start offset for the rdma segment
 	bool	use_rkeys;		/* Is set, use rkeys for IO */
+	bool	exclusive;		/* IO owns the whole shadow buffer and the metapage */
+	int	io_fence;		/* own metapage index of NVFS_MAP_IO_FENCES, -1 for the buffer one */
+	struct nvfs_io_mgroup *nvfs_mgroup;	// shadow buffer this IO slot belongs to
+	unsigned int slot;		// index in nvfs_mgroup->nvfsio_slots
+	unsigned long window_start;	// first shadow folio owned by this IO
+	unsigned long window_nfolios;	// number of shadow folios owned by this IO
+	struct mm_struct *chain_mm;	// submitter mm, set if the async IO is chained
+	const struct cred *chain_cred;	// submitter credentials for the chunks issued from the workqueue
+	struct work_struct chain_work;	// issues the next chunk of a chained async IO
+	long chain_res;			// result of the last completed chunk
+	ssize_t chain_bytes_done;	// bytes completed by the previous chunks
+	ssize_t chain_bytes_issued;	// bytes issued by the current chunk
+	nvfs_io_done_t io_done;		// completion callback, replaces the end fence
+	void *io_done_data;		// private data for io_done
+	u64 user_data;			// passed back to io_done
+	struct nvfs_batch_ctx *batch_ctx;	// batch context of a batch IO entry
+	struct list_head batch_node;	// entry in batch_ctx->ios
+	bool cancelled;			// batch cancelled, drop the completion
+	struct scatterlist *dma_cookies[NVFS_IO_DMA_COOKIES];	// sglists of the requests owning a dma cookie
 } nvfs_io_t;
 
+// GPU pages with contiguous DMA addresses for a peer
+struct nvfs_dma_run {
+	unsigned long gpu_index;		    // first page table entry of the run
+	unsigned long npages;			    // number of page table entries in the run
+	dma_addr_t dma_addr;			    // DMA address of gpu_index
+};
+
+/* Backoff before mapping again a peer the GPU buffer failed to map for */
+#define NVFS_P2P_MAP_BACKOFF_MIN_MS	100
+#define NVFS_P2P_MAP_BACKOFF_MAX_MS	30000
+
 struct pci_dev_mapping {
 	struct nvidia_p2p_dma_mapping *dma_mapping; // p2p dma mappint entries
 	struct pci_dev *pci_dev;                    // NVMe device
 	int n_dma_chunks;			    // Number of DMA chunks
+	struct nvfs_dma_run *runs;		    // n_dma_chunks runs, sorted by gpu_index
 	struct hlist_node hentry;
+	bool ready;				    // dma_mapping is set, else being created
+	int err;				    // negative entry: error mapping the peer
+	unsigned int nfails;			    // consecutive failures to map the peer
+	unsigned long retry_at;			    // jiffies the peer may be mapped again
+	struct completion done;			    // completed once the mapping is ready or failed
+	refcount_t ref;				    // hash table and waiters for done
+	struct rcu_head rcu;
 };
 
 struct nvfs_gpu_args {
@@ -136,25 +203,25 @@ struct nvfs_gpu_args {
 	u64 gpu_buf_len;                            // length of gpu buffer
 	struct page *end_fence_page;                // end fence addr pinned page
 	u32 offset_in_page;			    // end_fence_addr byte offset in end_fence_page
+	struct page **io_fence_pages;		    // pinned metapages of NVFS_MAP_IO_FENCES, else NULL
+	unsigned int nr_io_fence_pages;		    // number of pages in io_fence_pages
+	unsigned long io_fences_busy;		    // bitmap of the metapages owned by an in-flight IO
 	atomic_t io_state;			/* IO state transitions */
-	atomic_t dma_mapping_in_progress;	    // Mapping in progress for a specific PCI device
+	atomic_t dma_mapping_in_progress;	    // Number of PCI device mappings being created
+	spinlock_t dma_mapping_lock;		    // serializes additions to buckets
 	atomic_t callback_invoked;
 	wait_queue_head_t callback_wq;              // wait queue for IO completion
 	bool is_bounce_buffer;			    // is this memory used for bounce buffer
 	bool use_legacy_p2p_allocation;             // Use legacy p2p_get/put_page()
 	int n_phys_chunks;			    // number of contiguous physical address range
+	unsigned int gpu_page_shift;		    // log2 of the P2P page table page size
+	u64 max_io_size;			    // largest IO mapped in NVME_MAX_SEGS sg entries, 0 if no limit
 	u64 pdevinfo;				    // pci domain(upper 4 bytes), bus, device, function for pci ranking
 	unsigned int gpu_hash_index;                // cache gpu hash index for pci rank lookups
+	int numa_node;				    // numa node of the GPU, NUMA_NO_NODE if unknown
 	DECLARE_HASHTABLE(buckets, MAX_PCI_BUCKETS_BITS);
 };
 
-struct nvfs_io_metadata {
-	u64 nvfs_start_magic;                       // start magic of metadata
-	enum nvfs_block_state nvfs_state;
-	struct folio *folio;                        // folio containing this block
-	u16 folio_offset;                           // offset within folio for this block
-} __packed __aligned(8);
-
 typedef struct nvfs_rdma_info {
 	uint8_t    version;   // to support future changes to structure
 	uint8_t    flags;     // if bit 0 != 0, then gid field is valid
@@ -172,17 +239,40 @@ typedef struct nvfs_rdma_info {
 } nvfs_rdma_info_t;
 
 struct nvfs_io_mgroup {
+	u64 magic;				    // NVFS_MGROUP_MAGIC while shadow folios point here
 	atomic_t ref;
 	atomic_t dma_ref;
 	struct hlist_node hash_link;
+	struct hlist_node vaddr_link;		    // link in the (mm, cpu_base_vaddr) lookup cache
+	struct mm_struct *mm;			    // mm that registered cpu_base_vaddr
 	u64 cpu_base_vaddr;
 	unsigned long base_index;
 	unsigned long nvfs_blocks_count;
-	struct folio **nvfs_folios;                 // array of folios (replaces nvfs_ppages)
-	unsigned long nvfs_folios_count;            // number of folios allocated
-	struct nvfs_io_metadata *nvfs_metadata;
+	struct folio **nvfs_folios;                 // folio backing each page, 64K or smaller ones on fragmentation
+	unsigned long nvfs_pages_count;             // entries of nvfs_folios
+	unsigned long nvfs_folios_count;            // number of 64K GPU pages, the unit of IO windows
+	/*
+	 * Per shadow block metadata. The folio of block i is
+	 * nvfs_folios[i >> NVFS_PAGE_TO_BLOCK_ORDER], the mgroup magic
+	 * stands for all blocks.
+	 */
+	u8 *nvfs_block_state;			    // enum nvfs_block_state of each block
+	unsigned long nvfs_metadata_blocks;	    // blocks the metadata was allocated for
 	struct nvfs_gpu_args gpu_info;
-	nvfs_io_t nvfsio;
+	/*
+	 * IO slots. Each in-flight IO owns one slot and a window of shadow
+	 * folios, so that disjoint ranges of the buffer can be DMA'd in
+	 * parallel. gpu_info.io_state stays the buffer-wide state and is
+	 * IO_IN_PROGRESS as long as at least one slot is busy.
+	 */
+	spinlock_t io_slot_lock;
+	nvfs_io_t *nvfsio_slots;
+	unsigned int nvfs_io_nslots;
+	unsigned int nvfs_io_active;		    // busy slots
+	unsigned long io_slots_busy;		    // bitmap of busy slots
+	bool io_exclusive;			    // an exclusive IO owns all folios
+	unsigned long *folios_busy;		    // bitmap of folios owned by a window
+	nvfs_io_t **folio_owner;		    // IO slot owning each folio
 #ifdef NVFS_ENABLE_KERN_RDMA_SUPPORT
 	struct nvfs_rdma_info	rdma_info;
 #endif
@@ -193,15 +283,28 @@ struct nvfs_io_mgroup {
 };
 
 typedef struct nvfs_io_mgroup *nvfs_mgroup_ptr_t;
-typedef struct nvfs_io_metadata *nvfs_mgroup_page_ptr_t;
 
 void nvfs_mgroup_init(void);
+int nvfs_mgroup_cache_init(void);
+void nvfs_mgroup_cache_destroy(void);
+void nvfs_folio_pool_trim(void);
 int nvfs_mgroup_mmap(struct file *filp, struct vm_area_struct *vma);
 nvfs_mgroup_ptr_t nvfs_mgroup_get(unsigned long base_index);
 void nvfs_mgroup_put(nvfs_mgroup_ptr_t nvfs_mgroup);
 void nvfs_mgroup_put_dma(nvfs_mgroup_ptr_t nvfs_mgroup);
-void nvfs_mgroup_check_and_set(nvfs_mgroup_ptr_t nvfs_mgroup, enum nvfs_block_state state, bool validate, bool update_nvfsio);
+void nvfs_mgroup_check_and_set(nvfs_mgroup_ptr_t nvfs_mgroup, nvfs_io_t *nvfsio, enum nvfs_block_state state,
+			       bool validate, bool update_nvfsio);
 nvfs_mgroup_ptr_t nvfs_mgroup_from_folio(struct folio *folio);
+bool nvfs_mgroup_owns_folio(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio);
+
+/* mgroup of a shadow folio, for callers holding a reference on the mgroup */
+static inline nvfs_mgroup_ptr_t nvfs_folio_mgroup(struct folio *folio)
+{
+	return READ_ONCE(folio->private);
+}
+
+bool nvfs_mgroup_set_dma_cookie(nvfs_mgroup_ptr_t nvfs_mgroup, struct scatterlist *sglist);
+int nvfs_mgroup_put_dma_cookie(struct scatterlist *sglist, int nents);
 nvfs_mgroup_ptr_t nvfs_mgroup_from_folio_range(struct folio *folio, int nblocks, unsigned int start_offset);
 bool nvfs_is_gpu_folio(struct folio *folio);
 unsigned int nvfs_gpu_index_from_folio(struct folio *folio);
@@ -215,7 +318,11 @@ unsigned int nvfs_gpu_index(struct page *page);
 int nvfs_check_gpu_page_and_error(struct page *page, unsigned int offset, unsigned int len);
 unsigned int nvfs_device_priority(struct device *dev, unsigned int gpu_index);
 
-int nvfs_mgroup_fill_mpages(nvfs_mgroup_ptr_t nvfs_mgroup, unsigned int nr_blocks);
+int nvfs_mgroup_fill_mpages(nvfs_io_t *nvfsio, unsigned int nr_blocks);
+nvfs_io_t *nvfs_mgroup_io_slot_get(nvfs_mgroup_ptr_t nvfs_mgroup);
+bool nvfs_mgroup_io_slot_put(nvfs_io_t *nvfsio);
+int nvfs_mgroup_io_window_get(nvfs_io_t *nvfsio, unsigned long nfolios, bool exclusive);
+nvfs_io_t *nvfs_mgroup_folio_to_io(nvfs_mgroup_ptr_t nvfs_mgroup, struct folio *folio);
 nvfs_mgroup_ptr_t nvfs_mgroup_pin_shadow_pages(u64 cpuvaddr, unsigned long length);
 void nvfs_mgroup_unpin_shadow_pages(nvfs_mgroup_ptr_t nvfs_mgroup);
 nvfs_mgroup_ptr_t nvfs_get_mgroup_from_vaddr(u64 cpuvaddr);
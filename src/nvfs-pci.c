@@ -95,6 +95,7 @@ struct nvfs_rank_data {
 	u16 pci_dist;   // pci distance between a GPU and its peer dma device
 	u16 bw_index;   // indicator of available bw
 	uint64_t count; // counts number of p2p dma ops between the pair
+	u32 map_err;    // counts failures to dma map gpu buffers for the peer
 };
 
 // Store pci paths
@@ -728,6 +729,47 @@ unsigned int nvfs_get_gpu2peer_distance(struct device *dev, unsigned int gpu_ind
 	return rank;
 }
 
+/*
+ *  Description: get the closest peers of a gpu, by rank
+ *  @params  : gpu hash index
+ *  @params  : array filled with the peer pci device info
+ *  @params  : size of the array
+ *  @returns : number of peers filled in, closest first
+ */
+unsigned int nvfs_get_gpu_ranked_peers(unsigned int gpu_index, uint64_t *peers,
+				       unsigned int max_peers)
+{
+	u32 ranks[MAX_PEER_DEVS];
+	unsigned int i, j, n = 0;
+
+	if (unlikely(gpu_index >= MAX_GPU_DEVS))
+		return 0;
+
+	max_peers = min(max_peers, MAX_PEER_DEVS);
+	for (i = 0; i < MAX_PEER_DEVS; i++) {
+		u64 peerinfo = nvfs_lookup_peer_hash_index_entry(i);
+		u32 rank = gpu_rank_matrix[gpu_index][i].rank;
+
+		if (!peerinfo)
+			continue;
+
+		// insertion sort into the max_peers best ranks
+		for (j = n; j > 0 && ranks[j - 1] > rank; j--) {
+			if (j < max_peers) {
+				ranks[j] = ranks[j - 1];
+				peers[j] = peers[j - 1];
+			}
+		}
+		if (j < max_peers) {
+			ranks[j] = rank;
+			peers[j] = peerinfo;
+			if (n < max_peers)
+				n++;
+		}
+	}
+	return n;
+}
+
 /*
  *  Description: updates peer usage count for a gpu
  *  @params  : gpu hash index
@@ -752,6 +794,22 @@ void nvfs_update_peer_usage(unsigned int gpu_index, u64 peer_pdevinfo)
 	}
 }
 
+/*
+ *  Description: updates count of failures to dma map a gpu buffer for a peer
+ *  @params  : gpu hash index
+ *  @params  : peer device bdf
+ */
+void nvfs_update_peer_map_err(unsigned int gpu_index, u64 peer_pdevinfo)
+{
+	unsigned int peer_index = nvfs_get_peer_hash_index(peer_pdevinfo);
+
+	if (unlikely((gpu_index >= MAX_GPU_DEVS) || (peer_index >= MAX_PEER_DEVS)))
+		return;
+
+	WRITE_ONCE(gpu_rank_matrix[gpu_index][peer_index].map_err,
+		   gpu_rank_matrix[gpu_index][peer_index].map_err + 1);
+}
+
 /*
  *  Description: get total number of dma operations between a gpu and all its peers
  *      which are at given `pci-dist` away
@@ -830,8 +888,10 @@ void nvfs_reset_peer_affinity_stats(void)
 	unsigned int i, j;
 
 	for (i = 0; i < MAX_GPU_DEVS; i++) {
-		for (j = 0; j < MAX_PEER_DEVS; j++)
+		for (j = 0; j < MAX_PEER_DEVS; j++) {
 			gpu_rank_matrix[i][j].count = 0;
+			gpu_rank_matrix[i][j].map_err = 0;
+		}
 	}
 }
 
@@ -876,6 +936,37 @@ int nvfs_peer_distance_show(struct seq_file *m, void *data)
 	return 0;
 }
 
+/*
+ *  Description: show the gpu and peer pairs the gpu buffers failed to dma map for
+ *  @params  : seq_file
+ */
+void nvfs_peer_map_err_show(struct seq_file *m)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < MAX_GPU_DEVS; i++) {
+		u64 pdevinfo = nvfs_lookup_gpu_hash_index_entry(i);
+
+		if (!pdevinfo)
+			continue;
+
+		for (j = 0; j < MAX_PEER_DEVS; j++) {
+			u64 peerinfo = nvfs_lookup_peer_hash_index_entry(j);
+			u32 map_err = READ_ONCE(gpu_rank_matrix[i][j].map_err);
+
+			if (!peerinfo || !map_err)
+				continue;
+
+			seq_printf(m, "P2P-map-err GPU "PCI_INFO_FMT" peer "PCI_INFO_FMT" : err=%u\n",
+				   PCI_INFO_DOMAIN(pdevinfo), PCI_INFO_BUS(pdevinfo),
+				   PCI_INFO_SLOT(pdevinfo), PCI_INFO_FUNC(pdevinfo),
+				   PCI_INFO_DOMAIN(peerinfo), PCI_INFO_BUS(peerinfo),
+				   PCI_INFO_SLOT(peerinfo), PCI_INFO_FUNC(peerinfo),
+				   map_err);
+		}
+	}
+}
+
 /*
  *  Description: proc function to show p2p distribution based on pci-distance
  *  @returns   : always 0
@@ -262,9 +262,15 @@ uint64_t nvfs_lookup_peer_hash_index_entry(unsigned int index);
 // return pci-distance between a gpu(hash-key) and peer dma source
 unsigned int nvfs_get_gpu2peer_distance(struct device *dev, unsigned int gpuindex);
 
+// closest peers of a gpu(hash-key), by rank
+unsigned int nvfs_get_gpu_ranked_peers(unsigned int gpu_index, uint64_t *peers,
+				       unsigned int max_peers);
+
 // stats
 void nvfs_update_peer_usage(unsigned int gpu_index, u64 peer_pdevinfo);
 
+void nvfs_update_peer_map_err(unsigned int gpu_index, u64 peer_pdevinfo);
+
 unsigned int nvfs_aggregate_cross_peer_usage(unsigned int gpu_index);
 
 void nvfs_reset_peer_affinity_stats(void);
@@ -272,4 +278,6 @@ void nvfs_reset_peer_affinity_stats(void);
 int nvfs_peer_distance_show(struct seq_file *m, void *v);
 
 int nvfs_peer_affinity_show(struct seq_file *m, void *v);
+
+void nvfs_peer_map_err_show(struct seq_file *m);
 #endif
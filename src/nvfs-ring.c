@@ -0,0 +1,548 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+#ifdef NVFS_RING_SUPPORT
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <linux/kthread.h>
+#include <linux/eventfd.h>
+#include <linux/nospec.h>
+#include <linux/log2.h>
+#include <linux/wait.h>
+
+#include "nvfs-core.h"
+#include "nvfs-ring.h"
+#include "nvfs-stat.h"
+
+#define NVFS_RING_DEFAULT_IDLE_MS	1000
+
+static inline void nvfs_ring_eventfd_signal(struct eventfd_ctx *ctx)
+{
+#ifdef HAVE_EVENTFD_SIGNAL_COUNT
+	eventfd_signal(ctx, 1);
+#else
+	eventfd_signal(ctx);
+#endif
+}
+
+/*
+ * CQ slots not yet claimed by posted CQEs or in-flight IOs. Submission stops
+ * when the CQ is full so that every in-flight IO has a CQE slot reserved.
+ */
+static bool nvfs_ring_cq_space(struct nvfs_ring *ring)
+{
+	u32 inflight = atomic_read(&ring->inflight);
+	u32 pending;
+
+	// pairs with smp_mb__before_atomic() in nvfs_ring_post_cqe()
+	smp_rmb();
+	pending = READ_ONCE(ring->cq_tail) - READ_ONCE(ring->hdr->cq_head);
+	return (u64)pending + inflight < ring->cq_entries;
+}
+
+static u32 nvfs_ring_cq_ready(struct nvfs_ring *ring)
+{
+	return READ_ONCE(ring->cq_tail) - READ_ONCE(ring->hdr->cq_head);
+}
+
+static bool nvfs_ring_sq_ready(struct nvfs_ring *ring)
+{
+	return smp_load_acquire(&ring->hdr->sq_tail) != READ_ONCE(ring->sq_head) &&
+		nvfs_ring_cq_space(ring);
+}
+
+/*
+ * Post a CQE; may be called from the IO completion interrupt. inflight is
+ * set if the SQE was accounted in ring->inflight.
+ */
+static void nvfs_ring_post_cqe(struct nvfs_ring *ring, u64 user_data,
+			       long res, u32 state, bool inflight)
+{
+	struct nvfs_ring_cqe *cqe;
+	unsigned long flags;
+	u32 tail;
+
+	spin_lock_irqsave(&ring->cq_lock, flags);
+	tail = ring->cq_tail;
+	if (tail - READ_ONCE(ring->hdr->cq_head) >= ring->cq_entries) {
+		// submission reserves CQ space, user space moved cq_head
+		WRITE_ONCE(ring->hdr->cq_overflow,
+			   READ_ONCE(ring->hdr->cq_overflow) + 1);
+		nvfs_stat(&nvfs_n_ring_cq_overflow);
+	} else {
+		cqe = &ring->cqes[tail & (ring->cq_entries - 1)];
+		cqe->user_data = user_data;
+		cqe->result = res;
+		cqe->state = state;
+		cqe->flags = 0;
+		WRITE_ONCE(ring->cq_tail, tail + 1);
+		// CQE contents are visible before the new tail
+		smp_store_release(&ring->hdr->cq_tail, tail + 1);
+	}
+
+	if (inflight) {
+		smp_mb__before_atomic();
+		atomic_dec(&ring->inflight);
+	}
+
+	if (ring->cq_ev)
+		nvfs_ring_eventfd_signal(ring->cq_ev);
+	// wake up under cq_lock, nvfs_ring_release() frees the ring after it
+	wake_up(&ring->cq_wait);
+	spin_unlock_irqrestore(&ring->cq_lock, flags);
+}
+
+static void nvfs_ring_io_done(void *data, u64 user_data, long res,
+			      enum nvfs_metastate state)
+{
+	nvfs_ring_post_cqe((struct nvfs_ring *)data, user_data, res, state, true);
+}
+
+/*
+ * Issue one SQE through nvfs_io_init_ext()/nvfs_io_start_op(). Returns 0 if
+ * the IO was started, its CQE is then posted by nvfs_ring_io_done().
+ */
+static long nvfs_ring_submit_sqe(struct nvfs_ring *ring,
+				 struct nvfs_ring_sqe *sqe)
+{
+	nvfs_ioctl_ioargs_t *ioargs = &sqe->ioargs;
+	struct file *fixed_file = NULL;
+	bool rw_stats_enabled = 0;
+	int op = ioargs->optype;
+	nvfs_io_t *nvfsio;
+
+	if (op != READ && op != WRITE)
+		return -EINVAL;
+
+	if (sqe->flags & NVFS_RING_SQE_FIXED_FILE) {
+		if (ioargs->fd < 0 || ioargs->fd >= ring->nr_files)
+			return -EBADF;
+		fixed_file = ring->files[array_index_nospec(ioargs->fd,
+							    ring->nr_files)];
+	} else if (current == ring->sq_thread) {
+		// the SQ poller has no file table to resolve user fds from
+		return -EBADF;
+	}
+
+	if (nvfs_rw_stats_enabled > 0)
+		rw_stats_enabled = 1;
+
+	if (rw_stats_enabled) {
+		if (op == READ) {
+			nvfs_stat64(&nvfs_n_reads);
+			nvfs_stat(&nvfs_n_op_reads);
+		} else {
+			nvfs_stat64(&nvfs_n_writes);
+			nvfs_stat(&nvfs_n_op_writes);
+		}
+	}
+
+	nvfsio = nvfs_io_init_ext(op, ioargs, fixed_file,
+				  nvfs_ring_io_done, ring);
+	if (IS_ERR(nvfsio)) {
+		if (op == READ) {
+			nvfs_stat(&nvfs_n_read_err);
+			if (rw_stats_enabled)
+				nvfs_stat_d(&nvfs_n_op_reads);
+		} else {
+			nvfs_stat(&nvfs_n_write_err);
+			if (rw_stats_enabled)
+				nvfs_stat_d(&nvfs_n_op_writes);
+		}
+		nvfs_dbg("%s:%d ring IO init failed %ld\n",
+			 __func__, __LINE__, PTR_ERR(nvfsio));
+		return PTR_ERR(nvfsio);
+	}
+	nvfsio->user_data = sqe->user_data;
+	nvfsio->rw_stats_enabled = rw_stats_enabled;
+
+	// errors past this point are reported through nvfs_ring_io_done()
+	(void)nvfs_io_start_op(nvfsio);
+	return 0;
+}
+
+/*
+ * Consume up to to_submit SQEs. Returns the number of SQEs consumed.
+ */
+static long nvfs_ring_submit(struct nvfs_ring *ring, u32 to_submit)
+{
+	u32 head, tail, submitted = 0;
+
+	mutex_lock(&ring->sq_lock);
+	head = ring->sq_head;
+	tail = smp_load_acquire(&ring->hdr->sq_tail);
+	if (tail - head > ring->sq_entries) {
+		mutex_unlock(&ring->sq_lock);
+		nvfs_err("%s:%d invalid sq_tail %u sq_head %u\n",
+			 __func__, __LINE__, tail, head);
+		return -EINVAL;
+	}
+
+	while (head != tail && submitted < to_submit) {
+		struct nvfs_ring_sqe sqe;
+		long ret;
+
+		if (!nvfs_ring_cq_space(ring))
+			break;
+
+		// user space may rewrite the slot once sq_head moves past it
+		memcpy(&sqe, &ring->sqes[head & (ring->sq_entries - 1)],
+		       sizeof(sqe));
+		head++;
+		WRITE_ONCE(ring->sq_head, head);
+		smp_store_release(&ring->hdr->sq_head, head);
+
+		atomic_inc(&ring->inflight);
+		ret = nvfs_ring_submit_sqe(ring, &sqe);
+		if (ret)
+			nvfs_ring_post_cqe(ring, sqe.user_data, ret,
+					   NVFS_IO_META_CLEAN, true);
+		submitted++;
+	}
+	mutex_unlock(&ring->sq_lock);
+
+	nvfs_stat64_add(submitted, &nvfs_n_ring_sqes);
+	return submitted;
+}
+
+static void nvfs_ring_set_need_wakeup(struct nvfs_ring *ring, bool set)
+{
+	u32 flags = READ_ONCE(ring->hdr->flags);
+
+	if (set)
+		flags |= NVFS_RING_NEED_WAKEUP;
+	else
+		flags &= ~NVFS_RING_NEED_WAKEUP;
+	WRITE_ONCE(ring->hdr->flags, flags);
+}
+
+/*
+ * SQ poller. Borrows the submitter mm only while submitting so that it does
+ * not pin the address space, and with it the ring mapping, across exit.
+ */
+static int nvfs_ring_sq_thread(void *data)
+{
+	struct nvfs_ring *ring = data;
+	const struct cred *old_creds = override_creds(ring->creds);
+	unsigned long timeout = jiffies + ring->sq_idle;
+	bool mm_gone = false;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		long submitted = 0;
+
+		if (!mm_gone && nvfs_ring_sq_ready(ring)) {
+			if (mmget_not_zero(ring->mm)) {
+				nvfs_use_mm(ring->mm);
+				submitted = nvfs_ring_submit(ring, ring->sq_entries);
+				nvfs_unuse_mm(ring->mm);
+				mmput(ring->mm);
+			} else {
+				// submitter exited, idle until nvfs_ring_release()
+				mm_gone = true;
+			}
+		}
+
+		if (!mm_gone && (submitted > 0 || time_before(jiffies, timeout))) {
+			if (submitted > 0)
+				timeout = jiffies + ring->sq_idle;
+			cond_resched();
+			continue;
+		}
+
+		prepare_to_wait(&ring->sq_wait, &wait, TASK_INTERRUPTIBLE);
+		nvfs_ring_set_need_wakeup(ring, true);
+		// pairs with user space reading flags after updating sq_tail
+		smp_mb();
+		if (!kthread_should_stop() &&
+		    (mm_gone || !nvfs_ring_sq_ready(ring)))
+			schedule();
+		finish_wait(&ring->sq_wait, &wait);
+		nvfs_ring_set_need_wakeup(ring, false);
+		timeout = jiffies + ring->sq_idle;
+	}
+
+	revert_creds(old_creds);
+	return 0;
+}
+
+static void nvfs_ring_free(struct nvfs_ring *ring)
+{
+	u32 i;
+
+	if (ring->files) {
+		for (i = 0; i < ring->nr_files; i++) {
+			if (ring->files[i])
+				fput(ring->files[i]);
+		}
+		kfree(ring->files);
+	}
+
+	if (ring->cq_ev)
+		eventfd_ctx_put(ring->cq_ev);
+	if (ring->creds)
+		put_cred(ring->creds);
+	if (ring->mm)
+		mmdrop(ring->mm);
+	vfree(ring->mem);
+	kfree(ring);
+}
+
+static int nvfs_ring_get_files(struct file *filp, struct nvfs_ring *ring,
+			       nvfs_ioctl_ring_setup_args_t *args)
+{
+	int __user *ufds = u64_to_user_ptr(args->files);
+	u32 i;
+
+	if (!args->nr_files)
+		return 0;
+
+	ring->files = kcalloc(args->nr_files, sizeof(struct file *),
+			      GFP_KERNEL);
+	if (!ring->files)
+		return -ENOMEM;
+	ring->nr_files = args->nr_files;
+
+	for (i = 0; i < ring->nr_files; i++) {
+		int fd;
+
+		if (get_user(fd, &ufds[i]))
+			return -EFAULT;
+
+		ring->files[i] = fget(fd);
+		if (!ring->files[i]) {
+			nvfs_err("%s:%d invalid file descriptor:%d\n",
+				 __func__, __LINE__, fd);
+			return -EBADF;
+		}
+
+		// the ring would hold its own device file open forever
+		if (ring->files[i]->f_op == filp->f_op) {
+			nvfs_err("%s:%d nvidia-fs file %d can't be a ring file\n",
+				 __func__, __LINE__, fd);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+long nvfs_ring_setup(struct file *filp, nvfs_ioctl_ring_setup_args_t *args)
+{
+	struct nvfs_ring *ring;
+	u32 cq_entries;
+	size_t sq_off, cq_off;
+	long ret = -EINVAL;
+
+	if (!args->sq_entries || args->sq_entries > NVFS_RING_MAX_ENTRIES ||
+	    !is_power_of_2(args->sq_entries)) {
+		nvfs_err("%s:%d invalid sq_entries %u\n",
+			 __func__, __LINE__, args->sq_entries);
+		return -EINVAL;
+	}
+
+	cq_entries = args->cq_entries ? args->cq_entries : 2 * args->sq_entries;
+	if (cq_entries < args->sq_entries ||
+	    cq_entries > 2 * NVFS_RING_MAX_ENTRIES ||
+	    !is_power_of_2(cq_entries)) {
+		nvfs_err("%s:%d invalid cq_entries %u\n",
+			 __func__, __LINE__, cq_entries);
+		return -EINVAL;
+	}
+
+	if ((args->flags & ~NVFS_RING_SETUP_SQPOLL) ||
+	    args->nr_files > NVFS_RING_MAX_FILES)
+		return -EINVAL;
+
+	// the SQ poller runs without the submitter file table
+	if ((args->flags & NVFS_RING_SETUP_SQPOLL) && !args->nr_files) {
+		nvfs_err("%s:%d SQ poller requires fixed files\n",
+			 __func__, __LINE__);
+		return -EINVAL;
+	}
+
+	if (READ_ONCE(filp->private_data))
+		return -EBUSY;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	sq_off = ALIGN(sizeof(struct nvfs_ring_hdr), SMP_CACHE_BYTES);
+	cq_off = ALIGN(sq_off + args->sq_entries * sizeof(struct nvfs_ring_sqe),
+		       SMP_CACHE_BYTES);
+	ring->mem_size = PAGE_ALIGN(cq_off +
+				    cq_entries * sizeof(struct nvfs_ring_cqe));
+	ring->mem = vmalloc_user(ring->mem_size);
+	if (!ring->mem) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ring->hdr = ring->mem;
+	ring->sqes = ring->mem + sq_off;
+	ring->cqes = ring->mem + cq_off;
+	ring->sq_entries = args->sq_entries;
+	ring->cq_entries = cq_entries;
+	ring->hdr->sq_mask = ring->sq_entries - 1;
+	ring->hdr->cq_mask = ring->cq_entries - 1;
+	mutex_init(&ring->sq_lock);
+	spin_lock_init(&ring->cq_lock);
+	atomic_set(&ring->inflight, 0);
+	init_waitqueue_head(&ring->cq_wait);
+	init_waitqueue_head(&ring->sq_wait);
+
+	ret = nvfs_ring_get_files(filp, ring, args);
+	if (ret)
+		goto err;
+
+	if (args->eventfd >= 0) {
+		ring->cq_ev = eventfd_ctx_fdget(args->eventfd);
+		if (IS_ERR(ring->cq_ev)) {
+			ret = PTR_ERR(ring->cq_ev);
+			ring->cq_ev = NULL;
+			goto err;
+		}
+	}
+
+	if (args->flags & NVFS_RING_SETUP_SQPOLL) {
+		ring->creds = get_current_cred();
+		ring->mm = current->mm;
+		mmgrab(ring->mm);
+		ring->sq_idle = msecs_to_jiffies(args->sq_thread_idle ?
+						 args->sq_thread_idle :
+						 NVFS_RING_DEFAULT_IDLE_MS);
+		ring->sq_thread = kthread_create(nvfs_ring_sq_thread, ring,
+						 "nvfs-sqpoll/%d", current->tgid);
+		if (IS_ERR(ring->sq_thread)) {
+			ret = PTR_ERR(ring->sq_thread);
+			ring->sq_thread = NULL;
+			goto err;
+		}
+	}
+
+	// one ring per open device file
+	if (cmpxchg(&filp->private_data, NULL, ring) != NULL) {
+		ret = -EBUSY;
+		goto err;
+	}
+
+	if (ring->sq_thread)
+		wake_up_process(ring->sq_thread);
+
+	args->ring_size = ring->mem_size;
+	args->sq_off = sq_off;
+	args->cq_off = cq_off;
+	nvfs_dbg("ring setup sq %u cq %u size %zu sqpoll %d files %u\n",
+		 ring->sq_entries, ring->cq_entries, ring->mem_size,
+		 !!ring->sq_thread, ring->nr_files);
+	return 0;
+
+err:
+	// a thread that never ran exits without calling nvfs_ring_sq_thread()
+	if (ring->sq_thread)
+		kthread_stop(ring->sq_thread);
+	nvfs_ring_free(ring);
+	return ret;
+}
+
+long nvfs_ring_enter(struct file *filp, nvfs_ioctl_ring_enter_args_t *args)
+{
+	struct nvfs_ring *ring = READ_ONCE(filp->private_data);
+	long submitted = 0;
+	u32 min_complete;
+
+	if (!ring)
+		return -ENXIO;
+
+	if (args->flags & ~(NVFS_RING_ENTER_GETEVENTS | NVFS_RING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	if (ring->sq_thread) {
+		if (args->flags & NVFS_RING_ENTER_SQ_WAKEUP)
+			wake_up(&ring->sq_wait);
+	} else if (args->to_submit) {
+		submitted = nvfs_ring_submit(ring, args->to_submit);
+		if (submitted < 0)
+			return submitted;
+	}
+
+	if (!(args->flags & NVFS_RING_ENTER_GETEVENTS) || !args->min_complete)
+		return submitted;
+
+	min_complete = min(args->min_complete, ring->cq_entries);
+	if (wait_event_interruptible(ring->cq_wait,
+			nvfs_ring_cq_ready(ring) >= min_complete ||
+			atomic_read(&ring->inflight) == 0))
+		return submitted ? submitted : -EINTR;
+
+	return submitted;
+}
+
+int nvfs_ring_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct nvfs_ring *ring = READ_ONCE(filp->private_data);
+
+	if (!ring) {
+		nvfs_err("%s:%d ring is not set up\n", __func__, __LINE__);
+		return -ENXIO;
+	}
+
+	if (vma->vm_end - vma->vm_start > ring->mem_size)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->mem, 0);
+}
+
+/*
+ * Called on the last close of the device file, all ring mappings are gone.
+ */
+void nvfs_ring_release(struct file *filp)
+{
+	struct nvfs_ring *ring = xchg(&filp->private_data, NULL);
+
+	if (!ring)
+		return;
+
+	if (ring->sq_thread)
+		kthread_stop(ring->sq_thread);
+
+	// in-flight IOs still post their CQEs into the ring memory
+	wait_event(ring->cq_wait, atomic_read(&ring->inflight) == 0);
+
+	// the last completion wakes us up while holding cq_lock
+	spin_lock_irq(&ring->cq_lock);
+	spin_unlock_irq(&ring->cq_lock);
+
+	nvfs_ring_free(ring);
+}
+#endif
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NVFS_RING_H
+#define NVFS_RING_H
+
+#include "nvfs-core.h"
+
+#ifdef NVFS_RING_SUPPORT
+#include <linux/eventfd.h>
+#include <linux/wait.h>
+
+/*
+ * Per open device file IO ring, stored in file->private_data.
+ */
+struct nvfs_ring {
+	void *mem;			// vmalloc_user'd header, SQEs and CQEs
+	size_t mem_size;
+	struct nvfs_ring_hdr *hdr;
+	struct nvfs_ring_sqe *sqes;
+	struct nvfs_ring_cqe *cqes;
+	u32 sq_entries;
+	u32 cq_entries;
+	u32 sq_head;			// driver copy, published to hdr->sq_head
+	u32 cq_tail;			// driver copy, published to hdr->cq_tail
+	struct mutex sq_lock;		// serializes SQ consumers
+	spinlock_t cq_lock;		// serializes CQE posting from IO completions
+	atomic_t inflight;		// IOs submitted without a CQE yet
+	wait_queue_head_t cq_wait;	// woken on each CQE
+	struct eventfd_ctx *cq_ev;	// optional, signalled on each CQE
+	struct file **files;		// fixed files, NVFS_RING_SQE_FIXED_FILE
+	u32 nr_files;
+	struct task_struct *sq_thread;	// SQ poller, NVFS_RING_SETUP_SQPOLL
+	wait_queue_head_t sq_wait;	// SQ poller idles here
+	unsigned long sq_idle;		// SQ poller idle time in jiffies
+	struct mm_struct *mm;		// submitter mm, borrowed by the SQ poller
+	const struct cred *creds;	// submitter credentials for the SQ poller
+};
+
+long nvfs_ring_setup(struct file *filp, nvfs_ioctl_ring_setup_args_t *args);
+long nvfs_ring_enter(struct file *filp, nvfs_ioctl_ring_enter_args_t *args);
+int nvfs_ring_mmap(struct file *filp, struct vm_area_struct *vma);
+void nvfs_ring_release(struct file *filp);
+#endif
+
+#endif /* NVFS_RING_H */
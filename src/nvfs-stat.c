@@ -53,16 +53,28 @@ atomic_t nvfs_avg_read_latency;
 atomic_t nvfs_batch_ops_per_sec;
 atomic64_t nvfs_batch_submit_latency_per_sec;
 atomic_t nvfs_batch_submit_avg_latency;
+atomic64_t nvfs_batch_entries_per_sec;
+atomic_t nvfs_batch_submit_avg_entry_latency;
 
 atomic64_t nvfs_n_batches;
 atomic64_t nvfs_n_batches_ok;
 atomic_t nvfs_n_batch_err;
+atomic64_t nvfs_n_batch_coalesced;
+atomic64_t nvfs_n_batch_cancelled;
 
 atomic64_t nvfs_n_reads_sparse_files;
 atomic64_t nvfs_n_reads_sparse_io;
 atomic64_t nvfs_n_reads_sparse_region;
 atomic64_t nvfs_n_reads_sparse_pages;
 
+atomic64_t nvfs_n_chained_io;
+
+atomic64_t nvfs_n_ring_sqes;
+atomic_t nvfs_n_ring_cq_overflow;
+
+atomic64_t nvfs_n_uring_cmds;
+atomic_t nvfs_n_uring_cmd_err;
+
 atomic64_t nvfs_n_writes;
 atomic64_t nvfs_n_writes_ok;
 atomic_t nvfs_n_write_err;
@@ -78,6 +90,10 @@ atomic64_t nvfs_n_mmap;
 atomic64_t nvfs_n_mmap_ok;
 atomic_t nvfs_n_mmap_err;
 atomic64_t nvfs_n_munmap;
+atomic_t nvfs_n_folio_pool_cached;
+atomic64_t nvfs_n_folio_pool_hit;
+atomic64_t nvfs_n_folio_pool_miss;
+atomic64_t nvfs_n_shadow_folio_alloc[NVFS_STAT_FOLIO_ORDERS];
 
 atomic64_t nvfs_n_maps;
 atomic64_t nvfs_n_maps_ok;
@@ -99,6 +115,9 @@ atomic_t nvfs_n_err_sg_err;
 atomic_t nvfs_n_err_dma_map;
 atomic_t nvfs_n_err_dma_ref;
 
+atomic_t nvfs_n_p2p_map_err;
+atomic64_t nvfs_n_p2p_map_fail_fast;
+
 atomic_t prev_read_throughput;
 atomic_t prev_write_throughput;
 
@@ -163,6 +182,8 @@ static void nvfs_print_gpuinfo(struct seq_file *m)
  */
 static int nvfs_stats_show(struct seq_file *m, void *v)
 {
+	int i;
+
 #ifdef GDS_VERSION
 #define GDS_STRING2(x) #x
 #define GDS_STRING(x) GDS_STRING2(x)
@@ -205,14 +226,17 @@ static int nvfs_stats_show(struct seq_file *m, void *v)
 
 	if (nvfs_rw_stats_enabled) {
 #ifdef HAVE_ATOMIC64_LONG
-		seq_printf(m, "Batches				: n=%lu ok=%lu err=%u Avg-Submit-Latency(usec)=%u\n",
+		seq_printf(m, "Batches				: n=%lu ok=%lu err=%u coalesced=%lu cancelled=%lu Avg-Submit-Latency(usec)=%u Avg-Entry-Submit-Latency(nsec)=%u\n",
 #else
-		seq_printf(m, "Batches				: n=%llu ok=%llu err=%u Avg-Submit-Latency(usec)=%u\n",
+		seq_printf(m, "Batches				: n=%llu ok=%llu err=%u coalesced=%llu cancelled=%llu Avg-Submit-Latency(usec)=%u Avg-Entry-Submit-Latency(nsec)=%u\n",
 #endif
 			   atomic64_read(&nvfs_n_batches),
 			   atomic64_read(&nvfs_n_batches_ok),
 			   atomic_read(&nvfs_n_batch_err),
-			   atomic_read(&nvfs_batch_submit_avg_latency));
+			   atomic64_read(&nvfs_n_batch_coalesced),
+			   atomic64_read(&nvfs_n_batch_cancelled),
+			   atomic_read(&nvfs_batch_submit_avg_latency),
+			   atomic_read(&nvfs_batch_submit_avg_entry_latency));
 	}
 
 	if (nvfs_rw_stats_enabled) {
@@ -246,6 +270,29 @@ static int nvfs_stats_show(struct seq_file *m, void *v)
 		   atomic64_read(&nvfs_n_reads_sparse_region),
 		   atomic64_read(&nvfs_n_reads_sparse_pages));
 
+#ifdef HAVE_ATOMIC64_LONG
+	seq_printf(m, "Chained Async IO		: n=%lu\n",
+#else
+	seq_printf(m, "Chained Async IO		: n=%llu\n",
+#endif
+		   atomic64_read(&nvfs_n_chained_io));
+
+#ifdef HAVE_ATOMIC64_LONG
+	seq_printf(m, "Ring				: sqes=%lu cq_overflow=%u\n",
+#else
+	seq_printf(m, "Ring				: sqes=%llu cq_overflow=%u\n",
+#endif
+		   atomic64_read(&nvfs_n_ring_sqes),
+		   atomic_read(&nvfs_n_ring_cq_overflow));
+
+#ifdef HAVE_ATOMIC64_LONG
+	seq_printf(m, "Uring Cmd			: n=%lu err=%u\n",
+#else
+	seq_printf(m, "Uring Cmd			: n=%llu err=%u\n",
+#endif
+		   atomic64_read(&nvfs_n_uring_cmds),
+		   atomic_read(&nvfs_n_uring_cmd_err));
+
 	if (nvfs_rw_stats_enabled) {
 #ifdef HAVE_ATOMIC64_LONG
 		seq_printf(m, "Writes				: n=%lu ok=%lu err=%u writeMiB=%lu io_state_err=%u pg-cache=%u pg-cache-fail=%u pg-cache-eio=%u\n",
@@ -283,6 +330,26 @@ static int nvfs_stats_show(struct seq_file *m, void *v)
 		   atomic_read(&nvfs_n_mmap_err),
 		   atomic64_read(&nvfs_n_munmap));
 
+#ifdef HAVE_ATOMIC64_LONG
+	seq_printf(m, "Folio-pool			: max=%u cached=%u hit=%lu miss=%lu\n",
+#else
+	seq_printf(m, "Folio-pool			: max=%u cached=%u hit=%llu miss=%llu\n",
+#endif
+		   READ_ONCE(nvfs_folio_pool_max),
+		   atomic_read(&nvfs_n_folio_pool_cached),
+		   atomic64_read(&nvfs_n_folio_pool_hit),
+		   atomic64_read(&nvfs_n_folio_pool_miss));
+
+	// fresh shadow folio allocations per order, low orders mean fragmentation
+	seq_puts(m, "Shadow-folio-alloc		:");
+	for (i = NVFS_STAT_FOLIO_ORDERS - 1; i >= 0; i--)
+#ifdef HAVE_ATOMIC64_LONG
+		seq_printf(m, " order%d=%lu", i, atomic64_read(&nvfs_n_shadow_folio_alloc[i]));
+#else
+		seq_printf(m, " order%d=%llu", i, atomic64_read(&nvfs_n_shadow_folio_alloc[i]));
+#endif
+	seq_putc(m, '\n');
+
 #ifdef HAVE_ATOMIC64_LONG
 	seq_printf(m, "Bar1-map			: n=%lu ok=%lu err=%u free=%lu callbacks=%u active=%u delay-frees=%lu\n",
 #else
@@ -302,6 +369,15 @@ static int nvfs_stats_show(struct seq_file *m, void *v)
 		   atomic_read(&nvfs_n_err_dma_map),
 		   atomic_read(&nvfs_n_err_dma_ref));
 
+#ifdef HAVE_ATOMIC64_LONG
+	seq_printf(m, "P2P-map				: err=%u fail-fast=%lu\n",
+#else
+	seq_printf(m, "P2P-map				: err=%u fail-fast=%llu\n",
+#endif
+		   atomic_read(&nvfs_n_p2p_map_err),
+		   atomic64_read(&nvfs_n_p2p_map_fail_fast));
+	nvfs_peer_map_err_show(m);
+
 	seq_printf(m, "Ops				: Read=%u Write=%u BatchIO=%u\n",
 		   atomic_read(&nvfs_n_op_reads),
 		   atomic_read(&nvfs_n_op_writes),
@@ -318,6 +394,7 @@ static int nvfs_stats_show(struct seq_file *m, void *v)
  */
 static int nvfs_stats_reset(void)
 {
+	int i;
 
 	nvfs_stat64_reset(&nvfs_n_reads);
 	nvfs_stat64_reset(&nvfs_n_reads_ok);
@@ -333,6 +410,14 @@ static int nvfs_stats_reset(void)
 	nvfs_stat64_reset(&nvfs_n_reads_sparse_region);
 	nvfs_stat64_reset(&nvfs_n_reads_sparse_pages);
 
+	nvfs_stat64_reset(&nvfs_n_chained_io);
+
+	nvfs_stat64_reset(&nvfs_n_ring_sqes);
+	nvfs_stat_reset(&nvfs_n_ring_cq_overflow);
+
+	nvfs_stat64_reset(&nvfs_n_uring_cmds);
+	nvfs_stat_reset(&nvfs_n_uring_cmd_err);
+
 	nvfs_stat64_reset(&nvfs_n_writes);
 	nvfs_stat64_reset(&nvfs_n_writes_ok);
 	nvfs_stat_reset(&nvfs_n_write_err);
@@ -345,12 +430,18 @@ static int nvfs_stats_reset(void)
 	nvfs_stat64_reset(&nvfs_n_mmap);
 	nvfs_stat64_reset(&nvfs_n_mmap_ok);
 	nvfs_stat64_reset(&nvfs_n_munmap);
+	nvfs_stat64_reset(&nvfs_n_folio_pool_hit);
+	nvfs_stat64_reset(&nvfs_n_folio_pool_miss);
+	for (i = 0; i < NVFS_STAT_FOLIO_ORDERS; i++)
+		nvfs_stat64_reset(&nvfs_n_shadow_folio_alloc[i]);
 
 	nvfs_stat_reset(&nvfs_n_mmap_err);
 	nvfs_stat_reset(&nvfs_n_err_mix_cpu_gpu);
 	nvfs_stat_reset(&nvfs_n_err_sg_err);
 	nvfs_stat_reset(&nvfs_n_err_dma_map);
 	nvfs_stat_reset(&nvfs_n_err_dma_ref);
+	nvfs_stat_reset(&nvfs_n_p2p_map_err);
+	nvfs_stat64_reset(&nvfs_n_p2p_map_fail_fast);
 
 	nvfs_stat64_reset(&nvfs_n_maps);
 	nvfs_stat64_reset(&nvfs_n_maps_ok);
@@ -362,7 +453,11 @@ static int nvfs_stats_reset(void)
 	nvfs_stat64_reset(&nvfs_n_batches);
 	nvfs_stat64_reset(&nvfs_n_batches_ok);
 	nvfs_stat_reset(&nvfs_n_batch_err);
+	nvfs_stat64_reset(&nvfs_n_batch_coalesced);
+	nvfs_stat64_reset(&nvfs_n_batch_cancelled);
 	nvfs_stat_reset(&nvfs_batch_submit_avg_latency);
+	nvfs_stat_reset(&nvfs_batch_submit_avg_entry_latency);
+	nvfs_stat64_reset(&nvfs_batch_entries_per_sec);
 	nvfs_stat_reset(&nvfs_batch_ops_per_sec);
 	nvfs_stat_reset(&nvfs_n_op_batches);
 
@@ -508,7 +603,7 @@ void nvfs_update_read_latency(unsigned long avg_latency,
 	}
 }
 
-void nvfs_update_batch_latency(unsigned long avg_latency,
+void nvfs_update_batch_latency(unsigned long avg_latency, unsigned long nents,
 			       atomic64_t *stat)
 {
 	int delta;
@@ -518,6 +613,7 @@ void nvfs_update_batch_latency(unsigned long avg_latency,
 		atomic64_set(&prev_batch_submit_avg_latency, ktime_to_us(ktime_get()));
 		nvfs_stat(&nvfs_batch_ops_per_sec);
 		nvfs_stat64_add(avg_latency, stat);
+		nvfs_stat64_add(nents, &nvfs_batch_entries_per_sec);
 		return;
 	}
 
@@ -526,17 +622,24 @@ void nvfs_update_batch_latency(unsigned long avg_latency,
 	if (delta > USEC_PER_SEC) {
 		nvfs_stat64_add(avg_latency, stat);
 		nvfs_stat(&nvfs_batch_ops_per_sec);
+		nvfs_stat64_add(nents, &nvfs_batch_entries_per_sec);
 
 		average_latency = div64_safe(atomic64_read(stat),
 					(unsigned long) atomic_read(&nvfs_batch_ops_per_sec));
 		atomic_set(&nvfs_batch_submit_avg_latency, average_latency);
+		// submit cost per entry, in nsec as it is well below a usec
+		average_latency = div64_safe(atomic64_read(stat) * NSEC_PER_USEC,
+					(unsigned long) atomic64_read(&nvfs_batch_entries_per_sec));
+		atomic_set(&nvfs_batch_submit_avg_entry_latency, average_latency);
 		nvfs_stat64_reset(stat);
 		nvfs_stat_reset(&nvfs_batch_ops_per_sec);
+		nvfs_stat64_reset(&nvfs_batch_entries_per_sec);
 
 		atomic64_set(&prev_batch_submit_avg_latency, ktime_to_us(ktime_get()));
 	} else {
 		nvfs_stat64_add(avg_latency, stat);
 		nvfs_stat(&nvfs_batch_ops_per_sec);
+		nvfs_stat64_add(nents, &nvfs_batch_entries_per_sec);
 	}
 }
 
@@ -22,6 +22,7 @@
 #define BYTES_TO_MB(b) ((b) >> 20ULL)
 #define NVFS_MAX_GPU		16
 #define NVFS_MAX_GPU_BITS	ilog2(NVFS_MAX_GPU)
+#define NVFS_STAT_FOLIO_ORDERS	5	/* shadow folios are 64K at most, order 4 with 4K pages */
 
 static inline unsigned long div64_safe(unsigned long sum, unsigned long nr)
 {
@@ -74,12 +75,22 @@ extern atomic_t nvfs_avg_read_latency;
 extern atomic64_t nvfs_n_batches;
 extern atomic64_t nvfs_n_batches_ok;
 extern atomic_t nvfs_n_batch_err;
+extern atomic64_t nvfs_n_batch_coalesced;
+extern atomic64_t nvfs_n_batch_cancelled;
 
 extern atomic64_t nvfs_n_reads_sparse_files;
 extern atomic64_t nvfs_n_reads_sparse_io;
 extern atomic64_t nvfs_n_reads_sparse_region;
 extern atomic64_t nvfs_n_reads_sparse_pages;
 
+extern atomic64_t nvfs_n_chained_io;
+
+extern atomic64_t nvfs_n_ring_sqes;
+extern atomic_t nvfs_n_ring_cq_overflow;
+
+extern atomic64_t nvfs_n_uring_cmds;
+extern atomic_t nvfs_n_uring_cmd_err;
+
 extern atomic64_t nvfs_n_writes;
 extern atomic64_t nvfs_n_writes_ok;
 extern atomic_t nvfs_n_write_err;
@@ -94,11 +105,17 @@ extern atomic_t nvfs_avg_write_latency;
 extern atomic_t nvfs_batch_ops_per_sec;
 extern atomic64_t nvfs_batch_submit_latency_per_sec;
 extern atomic_t nvfs_batch_submit_avg_latency;
+extern atomic64_t nvfs_batch_entries_per_sec;
+extern atomic_t nvfs_batch_submit_avg_entry_latency;
 
 extern atomic64_t nvfs_n_mmap;
 extern atomic64_t nvfs_n_mmap_ok;
 extern atomic_t nvfs_n_mmap_err;
 extern atomic64_t nvfs_n_munmap;
+extern atomic_t nvfs_n_folio_pool_cached;
+extern atomic64_t nvfs_n_folio_pool_hit;
+extern atomic64_t nvfs_n_folio_pool_miss;
+extern atomic64_t nvfs_n_shadow_folio_alloc[NVFS_STAT_FOLIO_ORDERS];
 
 extern atomic64_t nvfs_n_maps;
 extern atomic64_t nvfs_n_maps_ok;
@@ -119,6 +136,9 @@ extern atomic_t nvfs_n_err_sg_err;
 extern atomic_t nvfs_n_err_dma_map;
 extern atomic_t nvfs_n_err_dma_ref;
 
+extern atomic_t nvfs_n_p2p_map_err;
+extern atomic64_t nvfs_n_p2p_map_fail_fast;
+
 extern atomic_t nvfs_n_pg_cache;
 extern atomic_t nvfs_n_pg_cache_fail;
 extern atomic_t nvfs_n_pg_cache_eio;
@@ -212,7 +232,7 @@ void nvfs_update_read_latency(unsigned long avg_latency,
 void nvfs_update_write_latency(unsigned long avg_latency,
 				atomic64_t *stat);
 
-void nvfs_update_batch_latency(unsigned long avg_latency,
+void nvfs_update_batch_latency(unsigned long avg_latency, unsigned long nents,
 				atomic64_t *stat);
 void nvfs_update_write_throughput(unsigned long total_bytes,
 				atomic64_t *stat);
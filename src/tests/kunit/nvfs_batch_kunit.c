@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit Tests for NVFS Batch IO Coalescing
+ * Tests merging of contiguous batch entries and the split of their result
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/minmax.h>
+
+/* Mock NVFS batch structures, layouts of nvfs-core.h and nvfs-batch.h */
+struct nvfs_file_args {
+	ino_t	inum;
+	u32	generation;
+	u32	majdev;
+	u32	mindev;
+	u64	devptroff;
+} __packed __aligned(8);
+typedef struct nvfs_file_args nvfs_file_args_t;
+
+struct nvfs_ioctl_ioargs {
+	u64			cpuvaddr;
+	loff_t			offset;
+	u64			size;
+	u64			end_fence_value;
+	s64			ioctl_return;
+	nvfs_file_args_t	file_args;
+	int			fd;
+	uint8_t			sync:1;
+	uint8_t			hipri:1;
+	uint8_t			allowreads:1;
+	uint8_t			use_rkeys:1;
+	uint8_t			optype:3;
+	uint8_t			reserved:1;
+	u8			fence_idx;
+	u8			padding[2];
+} __packed __aligned(8);
+typedef struct nvfs_ioctl_ioargs nvfs_ioctl_ioargs_t;
+
+struct nvfs_batch_entry {
+	void *nvfsio;
+	s64 status;
+	int node;
+	unsigned int nmerged;
+};
+
+typedef struct nvfs_batch_io {
+	uint64_t nents;
+	nvfs_ioctl_ioargs_t *io_args;
+	struct nvfs_batch_entry entries[];
+} nvfs_batch_io_t;
+
+/* copies of nvfs_batch_can_merge(), nvfs_batch_coalesce() and nvfs_batch_fan_out() */
+static bool nvfs_batch_can_merge(nvfs_ioctl_ioargs_t *prev, nvfs_ioctl_ioargs_t *next)
+{
+	return prev->optype == next->optype &&
+	       prev->fd == next->fd &&
+	       prev->cpuvaddr == next->cpuvaddr &&
+	       prev->sync == next->sync &&
+	       prev->hipri == next->hipri &&
+	       prev->allowreads == next->allowreads &&
+	       prev->use_rkeys == next->use_rkeys &&
+	       prev->fence_idx == next->fence_idx &&
+	       !memcmp(&prev->file_args, &next->file_args,
+		       offsetof(nvfs_file_args_t, devptroff)) &&
+	       prev->offset + prev->size == next->offset &&
+	       prev->file_args.devptroff + prev->size == next->file_args.devptroff;
+}
+
+static unsigned int nvfs_batch_coalesce(nvfs_batch_io_t *nvfs_batch, uint64_t i,
+					nvfs_ioctl_ioargs_t *merged)
+{
+	nvfs_ioctl_ioargs_t *io_args = nvfs_batch->io_args;
+	unsigned int j, n = 0;
+
+	while (i + n + 1 < nvfs_batch->nents &&
+	       !nvfs_batch->entries[i + n + 1].status &&
+	       nvfs_batch_can_merge(&io_args[i + n], &io_args[i + n + 1]))
+		n++;
+
+	if (n == 0)
+		return 0;
+
+	*merged = io_args[i];
+	for (j = 1; j <= n; j++) {
+		merged->size += io_args[i + j].size;
+		merged->end_fence_value = max(merged->end_fence_value,
+					      io_args[i + j].end_fence_value);
+	}
+
+	return n;
+}
+
+static void nvfs_batch_fan_out(nvfs_batch_io_t *nvfs_batch, uint64_t i)
+{
+	struct nvfs_batch_entry *entries = &nvfs_batch->entries[i];
+	s64 done = entries[0].status;
+	unsigned int j;
+
+	for (j = 0; j <= entries[0].nmerged; j++) {
+		if (done <= 0) {
+			entries[j].status = done;
+			continue;
+		}
+		entries[j].status = min_t(s64, done, nvfs_batch->io_args[i + j].size);
+		done -= entries[j].status;
+	}
+}
+
+#define NVFS_BLOCK_SIZE 4096
+#define TEST_BATCH_ENTRIES 8
+#define TEST_ENTRY_SIZE (64 * 1024)
+
+static int nvfs_batch_test_init(struct kunit *test)
+{
+	nvfs_batch_io_t *nvfs_batch;
+	unsigned int i;
+
+	nvfs_batch = kunit_kzalloc(test, struct_size(nvfs_batch, entries, TEST_BATCH_ENTRIES),
+				   GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, nvfs_batch);
+	nvfs_batch->io_args = kunit_kcalloc(test, TEST_BATCH_ENTRIES,
+					    sizeof(nvfs_ioctl_ioargs_t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, nvfs_batch->io_args);
+	nvfs_batch->nents = TEST_BATCH_ENTRIES;
+
+	/* contiguous reads of one file into one shadow buffer */
+	for (i = 0; i < TEST_BATCH_ENTRIES; i++) {
+		nvfs_ioctl_ioargs_t *args = &nvfs_batch->io_args[i];
+
+		args->cpuvaddr = 0x7f0000000000ULL;
+		args->fd = 3;
+		args->offset = (loff_t)i * TEST_ENTRY_SIZE;
+		args->size = TEST_ENTRY_SIZE;
+		args->file_args.devptroff = (u64)i * TEST_ENTRY_SIZE;
+		args->end_fence_value = i + 1;
+	}
+
+	test->priv = nvfs_batch;
+	return 0;
+}
+
+/*
+ * Test 1: A contiguous run is folded into its first entry
+ */
+static void nvfs_test_batch_coalesce_run(struct kunit *test)
+{
+	nvfs_batch_io_t *nvfs_batch = test->priv;
+	nvfs_ioctl_ioargs_t merged;
+	unsigned int n;
+
+	n = nvfs_batch_coalesce(nvfs_batch, 0, &merged);
+	KUNIT_EXPECT_EQ(test, n, TEST_BATCH_ENTRIES - 1U);
+	KUNIT_EXPECT_EQ(test, merged.offset, 0LL);
+	KUNIT_EXPECT_EQ(test, merged.file_args.devptroff, 0ULL);
+	KUNIT_EXPECT_EQ(test, merged.size, (u64)TEST_BATCH_ENTRIES * TEST_ENTRY_SIZE);
+	KUNIT_EXPECT_EQ(test, merged.end_fence_value, (u64)TEST_BATCH_ENTRIES);
+
+	/* the end fence is the highest of the run, not the last one */
+	nvfs_batch->io_args[2].end_fence_value = 100;
+	n = nvfs_batch_coalesce(nvfs_batch, 1, &merged);
+	KUNIT_EXPECT_EQ(test, n, TEST_BATCH_ENTRIES - 2U);
+	KUNIT_EXPECT_EQ(test, merged.end_fence_value, 100ULL);
+
+	/* nothing after the last entry */
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, TEST_BATCH_ENTRIES - 1, &merged), 0U);
+}
+
+/*
+ * Test 2: Runs stop at any difference, gap or rejected entry
+ */
+static void nvfs_test_batch_coalesce_breaks(struct kunit *test)
+{
+	nvfs_batch_io_t *nvfs_batch = test->priv;
+	nvfs_ioctl_ioargs_t *io_args = nvfs_batch->io_args;
+	nvfs_ioctl_ioargs_t merged;
+
+	/* gap in the file */
+	io_args[2].offset += NVFS_BLOCK_SIZE;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 1U);
+	io_args[2].offset -= NVFS_BLOCK_SIZE;
+
+	/* gap in the GPU buffer */
+	io_args[2].file_args.devptroff += NVFS_BLOCK_SIZE;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 1U);
+	io_args[2].file_args.devptroff -= NVFS_BLOCK_SIZE;
+
+	/* different op, fd, buffer, flags or metapage */
+	io_args[3].optype = 1;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 2U);
+	io_args[3].optype = 0;
+	io_args[3].fd = 4;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 2U);
+	io_args[3].fd = 3;
+	io_args[3].cpuvaddr += TEST_ENTRY_SIZE;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 2U);
+	io_args[3].cpuvaddr -= TEST_ENTRY_SIZE;
+	io_args[3].sync = 1;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 2U);
+	io_args[3].sync = 0;
+	io_args[3].fence_idx = 1;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 2U);
+	io_args[3].fence_idx = 0;
+
+	/* different file identity, devptroff aside */
+	io_args[3].file_args.inum = 42;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 2U);
+	io_args[3].file_args.inum = 0;
+
+	/* a rejected entry is not folded in */
+	nvfs_batch->entries[4].status = -EFAULT;
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 0, &merged), 3U);
+	KUNIT_EXPECT_EQ(test, merged.size, 4ULL * TEST_ENTRY_SIZE);
+	KUNIT_EXPECT_EQ(test, nvfs_batch_coalesce(nvfs_batch, 5, &merged), 2U);
+}
+
+/*
+ * Test 3: Bytes done by a merged sync IO are split in entry order
+ */
+static void nvfs_test_batch_fan_out_bytes(struct kunit *test)
+{
+	nvfs_batch_io_t *nvfs_batch = test->priv;
+	struct nvfs_batch_entry *entries = nvfs_batch->entries;
+	unsigned int j;
+
+	/* full IO */
+	entries[0].nmerged = 3;
+	entries[0].status = 4 * TEST_ENTRY_SIZE;
+	nvfs_batch_fan_out(nvfs_batch, 0);
+	for (j = 0; j < 4; j++)
+		KUNIT_EXPECT_EQ(test, entries[j].status, (s64)TEST_ENTRY_SIZE);
+
+	/* short IO ends in the middle of the third entry */
+	entries[0].status = 2 * TEST_ENTRY_SIZE + 4096;
+	nvfs_batch_fan_out(nvfs_batch, 0);
+	KUNIT_EXPECT_EQ(test, entries[0].status, (s64)TEST_ENTRY_SIZE);
+	KUNIT_EXPECT_EQ(test, entries[1].status, (s64)TEST_ENTRY_SIZE);
+	KUNIT_EXPECT_EQ(test, entries[2].status, 4096LL);
+	KUNIT_EXPECT_EQ(test, entries[3].status, 0LL);
+
+	/* merged run in the middle of the batch, entries around it untouched */
+	entries[4].status = 77;
+	entries[5].nmerged = 1;
+	entries[5].status = TEST_ENTRY_SIZE + 512;
+	nvfs_batch_fan_out(nvfs_batch, 5);
+	KUNIT_EXPECT_EQ(test, entries[4].status, 77LL);
+	KUNIT_EXPECT_EQ(test, entries[5].status, (s64)TEST_ENTRY_SIZE);
+	KUNIT_EXPECT_EQ(test, entries[6].status, 512LL);
+	KUNIT_EXPECT_EQ(test, entries[7].status, 0LL);
+}
+
+/*
+ * Test 4: Errors and async submissions apply to every merged entry
+ */
+static void nvfs_test_batch_fan_out_status(struct kunit *test)
+{
+	nvfs_batch_io_t *nvfs_batch = test->priv;
+	struct nvfs_batch_entry *entries = nvfs_batch->entries;
+	unsigned int j;
+
+	entries[0].nmerged = TEST_BATCH_ENTRIES - 1;
+	entries[0].status = -EIO;
+	nvfs_batch_fan_out(nvfs_batch, 0);
+	for (j = 0; j < TEST_BATCH_ENTRIES; j++)
+		KUNIT_EXPECT_EQ(test, entries[j].status, (s64)-EIO);
+
+	/* async start_op returns 0 */
+	entries[0].status = 0;
+	nvfs_batch_fan_out(nvfs_batch, 0);
+	for (j = 0; j < TEST_BATCH_ENTRIES; j++)
+		KUNIT_EXPECT_EQ(test, entries[j].status, 0LL);
+
+	/* a single entry keeps its result */
+	entries[0].nmerged = 0;
+	entries[1].status = 5;
+	entries[0].status = TEST_ENTRY_SIZE;
+	nvfs_batch_fan_out(nvfs_batch, 0);
+	KUNIT_EXPECT_EQ(test, entries[0].status, (s64)TEST_ENTRY_SIZE);
+	KUNIT_EXPECT_EQ(test, entries[1].status, 5LL);
+}
+
+/*
+ * Test case definitions
+ */
+static struct kunit_case nvfs_batch_test_cases[] = {
+	KUNIT_CASE(nvfs_test_batch_coalesce_run),
+	KUNIT_CASE(nvfs_test_batch_coalesce_breaks),
+	KUNIT_CASE(nvfs_test_batch_fan_out_bytes),
+	KUNIT_CASE(nvfs_test_batch_fan_out_status),
+	{}
+};
+
+/*
+ * KUnit test suite definition
+ */
+static struct kunit_suite nvfs_batch_test_suite = {
+	.name = "nvfs_batch_coalescing",
+	.init = nvfs_batch_test_init,
+	.test_cases = nvfs_batch_test_cases,
+};
+
+kunit_test_suite(nvfs_batch_test_suite);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("KUnit tests for NVFS batch IO coalescing");
+MODULE_AUTHOR("NVIDIA Corporation");
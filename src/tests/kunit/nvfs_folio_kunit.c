@@ -13,13 +13,14 @@
 #include <linux/random.h>
 
 /* NVFS test helpers */
-#define NVFS_GPU_FOLIO_ORDER 4  /* 64KB = order 4 for 4KB pages */
 #define GPU_PAGE_SIZE 65536
 #define GPU_PAGE_SHIFT 16
+#define NVFS_GPU_FOLIO_ORDER (GPU_PAGE_SHIFT - PAGE_SHIFT)  /* 64KB folios */
 #define NVFS_BLOCK_SIZE 4096
 #define NVFS_BLOCK_SHIFT 12
-#define NVFS_START_MAGIC 0xabc0cba1abc2cba3ULL
+#define NVFS_PAGE_TO_BLOCK_ORDER ((int)ilog2(PAGE_SIZE / NVFS_BLOCK_SIZE))
 #define NVFS_MIN_BASE_INDEX 0x100000000UL
+#define NVFS_STAT_FOLIO_ORDERS 5	/* shadow folios are 64K at most, order 4 with 4K pages */
 
 /* Mock NVFS structures for testing */
 enum nvfs_block_state {
@@ -29,26 +30,92 @@ enum nvfs_block_state {
 	NVFS_IO_QUEUED,
 	NVFS_IO_DMA_START,
 	NVFS_IO_DONE,
-	NVFS_IO_DMA_ERROR
-};
-
-struct nvfs_io_metadata {
-	u64 nvfs_start_magic;
-	enum nvfs_block_state nvfs_state;
-	struct folio *folio;
-	unsigned int folio_offset;
+	NVFS_IO_DMA_ERROR,
+	NVFS_IO_LAST_STATE = NVFS_IO_DMA_ERROR,
 };
 
 /*
- * Test fixture for folio operations
+ * Test fixture for folio operations, block metadata is one state byte per
+ * block, the folio of a block is found from its index
  */
 struct nvfs_folio_test_fixture {
 	struct folio *test_folio;
-	struct nvfs_io_metadata *metadata;
+	u8 *block_state;
 	unsigned int num_blocks;
 	void *test_pages[16]; /* Pages within the folio */
 };
 
+/*
+ * Mock allocator for nvfs_shadow_folio_alloc(): orders above fail_above_order
+ * fail like a fragmented buddy allocator, calls are counted per order.
+ */
+static int mock_fail_above_order;
+static unsigned int mock_alloc_calls[NVFS_STAT_FOLIO_ORDERS];
+static atomic64_t mock_n_shadow_folio_alloc[NVFS_STAT_FOLIO_ORDERS];
+static struct folio *mock_pool_folio;	/* one entry folio pool */
+
+static struct folio *mock_folio_alloc(gfp_t gfp, unsigned int order)
+{
+	mock_alloc_calls[order]++;
+	if ((int)order > mock_fail_above_order)
+		return NULL;
+	return folio_alloc(gfp, order);
+}
+
+static struct folio *mock_folio_pool_get(void)
+{
+	return xchg(&mock_pool_folio, NULL);
+}
+
+/* copy of nvfs_shadow_folio_alloc() over the mocks */
+static struct folio *nvfs_shadow_folio_alloc(unsigned long page_idx, unsigned long nr_pages,
+					     int *max_order)
+{
+	struct folio *folio;
+	gfp_t gfp;
+	int order = *max_order, start_order;
+
+	// folios are naturally aligned within the buffer and never cross its end
+	while (order && (!IS_ALIGNED(page_idx, 1UL << order) || (1UL << order) > nr_pages))
+		order--;
+	start_order = order;
+
+	if (order == NVFS_GPU_FOLIO_ORDER) {
+		folio = mock_folio_pool_get();
+		if (folio)
+			return folio;
+	}
+
+	for (; order >= 0; order--) {
+		gfp = GFP_USER | __GFP_ZERO;
+		if (order)
+			gfp |= __GFP_NORETRY | __GFP_NOWARN;
+		folio = mock_folio_alloc(gfp, order);
+		if (folio) {
+			atomic64_inc(&mock_n_shadow_folio_alloc[order]);
+			if (order < start_order)
+				*max_order = order;
+			return folio;
+		}
+	}
+	return NULL;
+}
+
+static void mock_shadow_alloc_reset(struct kunit *test, int fail_above_order)
+{
+	int i;
+
+	if (NVFS_GPU_FOLIO_ORDER + 1 != NVFS_STAT_FOLIO_ORDERS)
+		kunit_skip(test, "order fallback cases assume 4KB pages");
+
+	mock_fail_above_order = fail_above_order;
+	mock_pool_folio = NULL;
+	for (i = 0; i < NVFS_STAT_FOLIO_ORDERS; i++) {
+		mock_alloc_calls[i] = 0;
+		atomic64_set(&mock_n_shadow_folio_alloc[i], 0);
+	}
+}
+
 static int nvfs_folio_test_init(struct kunit *test)
 {
 	struct nvfs_folio_test_fixture *fixture;
@@ -64,10 +131,9 @@ static int nvfs_folio_test_init(struct kunit *test)
 	/* Calculate number of 4KB blocks in the 64KB folio */
 	fixture->num_blocks = GPU_PAGE_SIZE / NVFS_BLOCK_SIZE;
 	
-	/* Allocate metadata for each block */
-	fixture->metadata = kunit_kcalloc(test, fixture->num_blocks, 
-					  sizeof(struct nvfs_io_metadata), GFP_KERNEL);
-	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, fixture->metadata);
+	/* Allocate the state of each block */
+	fixture->block_state = kunit_kzalloc(test, fixture->num_blocks, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, fixture->block_state);
 	
 	/* Initialize test pages from the folio */
 	for (i = 0; i < folio_nr_pages(fixture->test_folio) && i < 16; i++) {
@@ -147,23 +213,21 @@ static void nvfs_test_folio_page_extraction(struct kunit *test)
 static void nvfs_test_metadata_initialization(struct kunit *test)
 {
 	struct nvfs_folio_test_fixture *fixture = test->priv;
-	struct nvfs_io_metadata *metadata = fixture->metadata;
+	u8 *block_state = fixture->block_state;
 	unsigned int i;
-	
-	/* Initialize metadata for each block */
-	for (i = 0; i < fixture->num_blocks; i++) {
-		metadata[i].nvfs_start_magic = NVFS_START_MAGIC;
-		metadata[i].nvfs_state = NVFS_IO_ALLOC;
-		metadata[i].folio = fixture->test_folio;
-		metadata[i].folio_offset = i * NVFS_BLOCK_SIZE;
-	}
-	
-	/* Validate metadata initialization */
+
+	/* Initialize metadata for each block, states fit in a byte */
+	KUNIT_EXPECT_LE(test, (int)NVFS_IO_LAST_STATE, U8_MAX);
+	memset(block_state, NVFS_IO_ALLOC, fixture->num_blocks);
+
+	/* Validate metadata initialization, page and offset come from the block index */
 	for (i = 0; i < fixture->num_blocks; i++) {
-		KUNIT_EXPECT_EQ(test, metadata[i].nvfs_start_magic, NVFS_START_MAGIC);
-		KUNIT_EXPECT_EQ(test, metadata[i].nvfs_state, NVFS_IO_ALLOC);
-		KUNIT_EXPECT_EQ(test, metadata[i].folio, fixture->test_folio);
-		KUNIT_EXPECT_EQ(test, metadata[i].folio_offset, i * NVFS_BLOCK_SIZE);
+		struct page *page = folio_page(fixture->test_folio, i >> NVFS_PAGE_TO_BLOCK_ORDER);
+
+		KUNIT_EXPECT_EQ(test, block_state[i], (u8)NVFS_IO_ALLOC);
+		KUNIT_EXPECT_PTR_EQ(test, page_folio(page), fixture->test_folio);
+		KUNIT_EXPECT_EQ(test, ((unsigned long)(i >> NVFS_PAGE_TO_BLOCK_ORDER) << PAGE_SHIFT) +
+				((i << NVFS_BLOCK_SHIFT) & ~PAGE_MASK), (unsigned long)i * NVFS_BLOCK_SIZE);
 	}
 	
 	kunit_info(test, "Metadata initialization: validated %u blocks", fixture->num_blocks);
@@ -205,31 +269,26 @@ static void nvfs_test_folio_boundary_calculations(struct kunit *test)
 static void nvfs_test_dma_state_transitions(struct kunit *test)
 {
 	struct nvfs_folio_test_fixture *fixture = test->priv;
-	struct nvfs_io_metadata *metadata = &fixture->metadata[0];
-	
-	/* Initialize metadata */
-	metadata->nvfs_start_magic = NVFS_START_MAGIC;
-	metadata->folio = fixture->test_folio;
-	metadata->folio_offset = 0;
-	
+	u8 *state = &fixture->block_state[0];
+
 	/* Test state transitions */
-	metadata->nvfs_state = NVFS_IO_FREE;
-	KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_FREE);
-	
-	metadata->nvfs_state = NVFS_IO_ALLOC;
-	KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_ALLOC);
-	
-	metadata->nvfs_state = NVFS_IO_INIT;
-	KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_INIT);
-	
-	metadata->nvfs_state = NVFS_IO_QUEUED;
-	KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_QUEUED);
-	
-	metadata->nvfs_state = NVFS_IO_DMA_START;
-	KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_DMA_START);
-	
-	metadata->nvfs_state = NVFS_IO_DONE;
-	KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_DONE);
+	*state = NVFS_IO_FREE;
+	KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_FREE);
+
+	*state = NVFS_IO_ALLOC;
+	KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_ALLOC);
+
+	*state = NVFS_IO_INIT;
+	KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_INIT);
+
+	*state = NVFS_IO_QUEUED;
+	KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_QUEUED);
+
+	*state = NVFS_IO_DMA_START;
+	KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_DMA_START);
+
+	*state = NVFS_IO_DONE;
+	KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_DONE);
 	
 	kunit_info(test, "DMA state transitions: all states validated");
 }
@@ -311,10 +370,107 @@ static void nvfs_test_constants_validation(struct kunit *test)
 	
 	/* Test blocks per GPU page */
 	KUNIT_EXPECT_EQ(test, GPU_PAGE_SIZE / NVFS_BLOCK_SIZE, 16);
+
+	/* Test the per order stats cover every shadow folio order */
+	KUNIT_EXPECT_LT(test, NVFS_GPU_FOLIO_ORDER, NVFS_STAT_FOLIO_ORDERS);
 	
 	kunit_info(test, "Constants validation: all GPU/block size relationships correct");
 }
 
+/*
+ * Test 9: Shadow folios are GPU page sized when memory is not fragmented
+ */
+static void nvfs_test_shadow_alloc_gpu_order(struct kunit *test)
+{
+	int max_order = NVFS_GPU_FOLIO_ORDER;
+	struct folio *folio;
+
+	mock_shadow_alloc_reset(test, NVFS_GPU_FOLIO_ORDER);
+
+	folio = nvfs_shadow_folio_alloc(0, 1UL << (NVFS_GPU_FOLIO_ORDER + 1), &max_order);
+	KUNIT_ASSERT_NOT_NULL(test, folio);
+	KUNIT_EXPECT_EQ(test, folio_order(folio), (unsigned int)NVFS_GPU_FOLIO_ORDER);
+	KUNIT_EXPECT_EQ(test, max_order, NVFS_GPU_FOLIO_ORDER);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&mock_n_shadow_folio_alloc[NVFS_GPU_FOLIO_ORDER]), 1LL);
+	folio_put(folio);
+
+	/* a pooled folio is reused, not counted as a fresh allocation */
+	mock_pool_folio = folio_alloc(GFP_KERNEL, NVFS_GPU_FOLIO_ORDER);
+	KUNIT_ASSERT_NOT_NULL(test, mock_pool_folio);
+	folio = nvfs_shadow_folio_alloc(0, 1UL << NVFS_GPU_FOLIO_ORDER, &max_order);
+	KUNIT_EXPECT_NULL(test, mock_pool_folio);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&mock_n_shadow_folio_alloc[NVFS_GPU_FOLIO_ORDER]), 1LL);
+	KUNIT_EXPECT_EQ(test, mock_alloc_calls[NVFS_GPU_FOLIO_ORDER], 1U);
+	folio_put(folio);
+}
+
+/*
+ * Test 10: Failing orders fall back to smaller folios, and are not retried
+ */
+static void nvfs_test_shadow_alloc_order_fallback(struct kunit *test)
+{
+	int max_order = NVFS_GPU_FOLIO_ORDER;
+	unsigned long nr_pages = 1UL << (NVFS_GPU_FOLIO_ORDER + 1);
+	struct folio *folio;
+	int order;
+
+	mock_shadow_alloc_reset(test, 1);
+
+	folio = nvfs_shadow_folio_alloc(0, nr_pages, &max_order);
+	KUNIT_ASSERT_NOT_NULL(test, folio);
+	KUNIT_EXPECT_EQ(test, folio_order(folio), 1U);
+	KUNIT_EXPECT_EQ(test, max_order, 1);
+	for (order = NVFS_GPU_FOLIO_ORDER; order > 1; order--)
+		KUNIT_EXPECT_EQ(test, mock_alloc_calls[order], 1U);
+	folio_put(folio);
+
+	/* the next folio of the buffer starts at the order that last succeeded */
+	folio = nvfs_shadow_folio_alloc(2, nr_pages - 2, &max_order);
+	KUNIT_ASSERT_NOT_NULL(test, folio);
+	KUNIT_EXPECT_EQ(test, folio_order(folio), 1U);
+	for (order = NVFS_GPU_FOLIO_ORDER; order > 1; order--)
+		KUNIT_EXPECT_EQ(test, mock_alloc_calls[order], 1U);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&mock_n_shadow_folio_alloc[1]), 2LL);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&mock_n_shadow_folio_alloc[NVFS_GPU_FOLIO_ORDER]), 0LL);
+	folio_put(folio);
+
+	/* down to single pages */
+	mock_fail_above_order = 0;
+	folio = nvfs_shadow_folio_alloc(4, nr_pages - 4, &max_order);
+	KUNIT_ASSERT_NOT_NULL(test, folio);
+	KUNIT_EXPECT_EQ(test, folio_order(folio), 0U);
+	KUNIT_EXPECT_EQ(test, max_order, 0);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&mock_n_shadow_folio_alloc[0]), 1LL);
+	folio_put(folio);
+}
+
+/*
+ * Test 11: Alignment and buffer end lower the order without lowering max_order
+ */
+static void nvfs_test_shadow_alloc_alignment(struct kunit *test)
+{
+	int max_order = NVFS_GPU_FOLIO_ORDER;
+	struct folio *folio;
+
+	mock_shadow_alloc_reset(test, NVFS_GPU_FOLIO_ORDER);
+
+	/* page 2 of the buffer is only order 1 aligned */
+	folio = nvfs_shadow_folio_alloc(2, 1UL << NVFS_GPU_FOLIO_ORDER, &max_order);
+	KUNIT_ASSERT_NOT_NULL(test, folio);
+	KUNIT_EXPECT_EQ(test, folio_order(folio), 1U);
+	KUNIT_EXPECT_EQ(test, max_order, NVFS_GPU_FOLIO_ORDER);
+	KUNIT_EXPECT_EQ(test, mock_alloc_calls[NVFS_GPU_FOLIO_ORDER], 0U);
+	folio_put(folio);
+
+	/* three pages left, the folio does not cross the end of the buffer */
+	folio = nvfs_shadow_folio_alloc(0, 3, &max_order);
+	KUNIT_ASSERT_NOT_NULL(test, folio);
+	KUNIT_EXPECT_EQ(test, folio_order(folio), 1U);
+	KUNIT_EXPECT_EQ(test, max_order, NVFS_GPU_FOLIO_ORDER);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&mock_n_shadow_folio_alloc[1]), 2LL);
+	folio_put(folio);
+}
+
 /*
  * Test case definitions
  */
@@ -327,6 +483,9 @@ static struct kunit_case nvfs_folio_test_cases[] = {
 	KUNIT_CASE(nvfs_test_block_offset_calculations),
 	KUNIT_CASE(nvfs_test_memory_alignment),
 	KUNIT_CASE(nvfs_test_constants_validation),
+	KUNIT_CASE(nvfs_test_shadow_alloc_gpu_order),
+	KUNIT_CASE(nvfs_test_shadow_alloc_order_fallback),
+	KUNIT_CASE(nvfs_test_shadow_alloc_alignment),
 	{}
 };
 
@@ -17,10 +17,13 @@
 #define GPU_PAGE_SIZE 65536
 #define NVFS_BLOCK_SIZE 4096
 #define NVFS_GPU_FOLIO_ORDER (16 - PAGE_SHIFT)  /* 64KB folios */
-#define NVFS_START_MAGIC 0xabc0cba1abc2cba3ULL
 #define NVFS_MIN_BASE_INDEX 0x100000000UL
-#define NVFS_MAX_SHADOW_PAGES_ORDER 12
-#define NVFS_MAX_SHADOW_PAGES (1 << NVFS_MAX_SHADOW_PAGES_ORDER)
+#define NVFS_MGROUP_MAGIC 0x6e7666736d677270ULL
+#define NVFS_PAGE_TO_BLOCK_ORDER ((int)ilog2(PAGE_SIZE / NVFS_BLOCK_SIZE))
+#define NVFS_MAX_SHADOW_SIZE_SHIFT 30	/* 1GB */
+#define NVFS_MAX_SHADOW_PAGES_ORDER (NVFS_MAX_SHADOW_SIZE_SHIFT - PAGE_SHIFT)
+#define NVFS_MAX_SHADOW_PAGES (1UL << NVFS_MAX_SHADOW_PAGES_ORDER)
+#define NVFS_DEFAULT_MAX_SHADOW_BUF_MB 16
 
 /* Mock NVFS structures for testing mmap operations */
 enum nvfs_block_state {
@@ -30,26 +33,56 @@ enum nvfs_block_state {
 	NVFS_IO_QUEUED,
 	NVFS_IO_DMA_START,
 	NVFS_IO_DONE,
-	NVFS_IO_DMA_ERROR
-};
-
-struct nvfs_io_metadata {
-	u64 nvfs_start_magic;
-	enum nvfs_block_state nvfs_state;
-	struct folio *folio;
-	unsigned int folio_offset;
+	NVFS_IO_DMA_ERROR,
+	NVFS_IO_LAST_STATE = NVFS_IO_DMA_ERROR,
 };
 
+/*
+ * Block metadata is one state byte per block, the folio of block i is
+ * nvfs_folios[i >> NVFS_PAGE_TO_BLOCK_ORDER] and the mgroup magic stands
+ * for all blocks.
+ */
 struct mock_nvfs_io_mgroup {
+	u64 magic;
 	unsigned long base_index;
 	atomic_t ref;
 	unsigned long nvfs_blocks_count;
-	unsigned long nvfs_folios_count;
 	struct folio **nvfs_folios;
-	struct nvfs_io_metadata *nvfs_metadata;
+	unsigned long nvfs_pages_count;
+	unsigned long nvfs_folios_count;
+	u8 *nvfs_block_state;
 	u64 cpu_base_vaddr;
 };
 
+static struct folio *mock_block_folio(struct mock_nvfs_io_mgroup *mgroup, unsigned long block)
+{
+	return mgroup->nvfs_folios[block >> NVFS_PAGE_TO_BLOCK_ORDER];
+}
+
+/* offset of a block in its folio, the folio index holds its first buffer page */
+static unsigned int mock_block_folio_offset(struct mock_nvfs_io_mgroup *mgroup, unsigned long block)
+{
+	struct folio *folio = mock_block_folio(mgroup, block);
+	unsigned long first_page = folio->index & (NVFS_MAX_SHADOW_PAGES - 1);
+
+	return (block - (first_page << NVFS_PAGE_TO_BLOCK_ORDER)) * NVFS_BLOCK_SIZE;
+}
+
+/* copy of nvfs_blocks_find_state_not() */
+static unsigned long nvfs_blocks_find_state_not(const u8 *blk_state, unsigned long start,
+						unsigned long end, unsigned int states)
+{
+	while (start < end) {
+		const u8 *next;
+
+		if (!(BIT(blk_state[start]) & states))
+			return start;
+		next = memchr_inv(blk_state + start, blk_state[start], end - start);
+		start = next ? next - blk_state : end;
+	}
+	return end;
+}
+
 /*
  * Test fixture for mmap operations
  */
@@ -79,33 +112,43 @@ static int nvfs_mmap_test_init(struct kunit *test)
 	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, fixture->mgroup);
 
 	/* Initialize mgroup */
+	fixture->mgroup->magic = NVFS_MGROUP_MAGIC;
 	fixture->mgroup->base_index = NVFS_MIN_BASE_INDEX + 0x1000;
 	atomic_set(&fixture->mgroup->ref, 1);
 	fixture->mgroup->nvfs_blocks_count = fixture->block_count;
+	fixture->mgroup->nvfs_pages_count = fixture->test_length >> PAGE_SHIFT;
 	fixture->mgroup->nvfs_folios_count = fixture->folio_count;
 
-	/* Allocate folio array */
-	fixture->mgroup->nvfs_folios = kunit_kcalloc(test, fixture->folio_count,
+	/* Allocate the per page folio table */
+	fixture->mgroup->nvfs_folios = kunit_kcalloc(test, fixture->mgroup->nvfs_pages_count,
 						      sizeof(struct folio *), GFP_KERNEL);
 	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, fixture->mgroup->nvfs_folios);
 
-	/* Allocate metadata array */
-	fixture->mgroup->nvfs_metadata = kunit_kcalloc(test, fixture->block_count,
-						       sizeof(struct nvfs_io_metadata), GFP_KERNEL);
-	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, fixture->mgroup->nvfs_metadata);
+	/* Allocate block states */
+	fixture->mgroup->nvfs_block_state = kunit_kzalloc(test, fixture->block_count, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, fixture->mgroup->nvfs_block_state);
+
+	fixture->test_folios = kunit_kcalloc(test, fixture->folio_count,
+					     sizeof(struct folio *), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, fixture->test_folios);
+	test->priv = fixture;
 
 	/* Allocate test folios */
 	for (i = 0; i < fixture->folio_count; i++) {
-		fixture->mgroup->nvfs_folios[i] = folio_alloc(GFP_USER | __GFP_ZERO, NVFS_GPU_FOLIO_ORDER);
-		if (fixture->mgroup->nvfs_folios[i]) {
-			fixture->mgroup->nvfs_folios[i]->index = (fixture->mgroup->base_index * NVFS_MAX_SHADOW_PAGES) + i;
-		} else {
+		unsigned long first_page = (unsigned long)i << NVFS_GPU_FOLIO_ORDER;
+		unsigned long j;
+
+		fixture->test_folios[i] = folio_alloc(GFP_USER | __GFP_ZERO, NVFS_GPU_FOLIO_ORDER);
+		if (!fixture->test_folios[i]) {
 			kunit_skip(test, "Failed to allocate GPU folios");
 			return -ENOMEM;
 		}
+		fixture->test_folios[i]->index =
+			(fixture->mgroup->base_index << NVFS_MAX_SHADOW_PAGES_ORDER) + first_page;
+		for (j = 0; j < folio_nr_pages(fixture->test_folios[i]); j++)
+			fixture->mgroup->nvfs_folios[first_page + j] = fixture->test_folios[i];
 	}
 
-	test->priv = fixture;
 	return 0;
 }
 
@@ -114,10 +157,10 @@ static void nvfs_mmap_test_exit(struct kunit *test)
 	struct nvfs_mmap_test_fixture *fixture = test->priv;
 	unsigned int i;
 
-	if (fixture && fixture->mgroup && fixture->mgroup->nvfs_folios) {
+	if (fixture && fixture->test_folios) {
 		for (i = 0; i < fixture->folio_count; i++) {
-			if (fixture->mgroup->nvfs_folios[i])
-				folio_put(fixture->mgroup->nvfs_folios[i]);
+			if (fixture->test_folios[i])
+				folio_put(fixture->test_folios[i]);
 		}
 	}
 }
@@ -131,26 +174,16 @@ static void nvfs_test_mmap_metadata_initialization(struct kunit *test)
 	struct mock_nvfs_io_mgroup *mgroup = fixture->mgroup;
 	unsigned int i;
 
-	/* Initialize metadata for each block */
-	for (i = 0; i < fixture->block_count; i++) {
-		unsigned int folio_idx = i / (GPU_PAGE_SIZE / NVFS_BLOCK_SIZE);
-		unsigned int block_in_folio = i % (GPU_PAGE_SIZE / NVFS_BLOCK_SIZE);
-
-		mgroup->nvfs_metadata[i].nvfs_start_magic = NVFS_START_MAGIC;
-		mgroup->nvfs_metadata[i].nvfs_state = NVFS_IO_ALLOC;
-		
-		if (folio_idx < mgroup->nvfs_folios_count) {
-			mgroup->nvfs_metadata[i].folio = mgroup->nvfs_folios[folio_idx];
-			mgroup->nvfs_metadata[i].folio_offset = block_in_folio * NVFS_BLOCK_SIZE;
-		}
-	}
+	/* Initialize metadata, the states fit in a byte */
+	KUNIT_EXPECT_LE(test, (int)NVFS_IO_LAST_STATE, U8_MAX);
+	memset(mgroup->nvfs_block_state, NVFS_IO_ALLOC, fixture->block_count);
 
 	/* Validate metadata initialization */
+	KUNIT_EXPECT_EQ(test, mgroup->magic, NVFS_MGROUP_MAGIC);
 	for (i = 0; i < fixture->block_count; i++) {
-		KUNIT_EXPECT_EQ(test, mgroup->nvfs_metadata[i].nvfs_start_magic, NVFS_START_MAGIC);
-		KUNIT_EXPECT_EQ(test, mgroup->nvfs_metadata[i].nvfs_state, NVFS_IO_ALLOC);
-		KUNIT_EXPECT_NOT_NULL(test, mgroup->nvfs_metadata[i].folio);
-		KUNIT_EXPECT_LT(test, mgroup->nvfs_metadata[i].folio_offset, GPU_PAGE_SIZE);
+		KUNIT_EXPECT_EQ(test, mgroup->nvfs_block_state[i], (u8)NVFS_IO_ALLOC);
+		KUNIT_EXPECT_NOT_NULL(test, mock_block_folio(mgroup, i));
+		KUNIT_EXPECT_LT(test, mock_block_folio_offset(mgroup, i), GPU_PAGE_SIZE);
 	}
 
 	kunit_info(test, "Mmap metadata: initialized %u blocks across %u folios",
@@ -201,16 +234,25 @@ static void nvfs_test_base_index_calculation(struct kunit *test)
 	/* Validate base index is in valid range */
 	KUNIT_EXPECT_GE(test, base_index, NVFS_MIN_BASE_INDEX);
 	
+	/* The base index, below 2^33, and the page index share folio->index */
+	KUNIT_EXPECT_LT(test, base_index, 1UL << 33);
+	KUNIT_EXPECT_LE(test, 33 + NVFS_MAX_SHADOW_PAGES_ORDER, BITS_PER_LONG);
+
 	/* Test folio index calculations */
 	for (i = 0; i < fixture->folio_count; i++) {
-		struct folio *folio = fixture->mgroup->nvfs_folios[i];
-		unsigned long expected_index = (base_index * NVFS_MAX_SHADOW_PAGES) + i;
+		struct folio *folio = fixture->test_folios[i];
+		unsigned long expected_index = (base_index << NVFS_MAX_SHADOW_PAGES_ORDER) +
+					       ((unsigned long)i << NVFS_GPU_FOLIO_ORDER);
 		unsigned long calculated_base = folio->index >> NVFS_MAX_SHADOW_PAGES_ORDER;
-		
+
 		KUNIT_EXPECT_EQ(test, folio->index, expected_index);
 		KUNIT_EXPECT_EQ(test, calculated_base, base_index);
 	}
 
+	/* The last page of the largest buffer does not spill into the base index */
+	KUNIT_EXPECT_EQ(test, ((base_index << NVFS_MAX_SHADOW_PAGES_ORDER) +
+			       NVFS_MAX_SHADOW_PAGES - 1) >> NVFS_MAX_SHADOW_PAGES_ORDER, base_index);
+
 	kunit_info(test, "Base index validation: 0x%lx maps to %u folios correctly",
 		   base_index, fixture->folio_count);
 }
@@ -286,7 +328,7 @@ static void nvfs_test_folio_boundary_in_mmap(struct kunit *test)
 	unsigned int i;
 
 	for (i = 0; i < fixture->folio_count; i++) {
-		struct folio *folio = fixture->mgroup->nvfs_folios[i];
+		struct folio *folio = fixture->test_folios[i];
 		unsigned long folio_start_addr = i * GPU_PAGE_SIZE;
 		unsigned long folio_end_addr = folio_start_addr + GPU_PAGE_SIZE - 1;
 		unsigned int blocks_in_folio = GPU_PAGE_SIZE / NVFS_BLOCK_SIZE;
@@ -300,7 +342,9 @@ static void nvfs_test_folio_boundary_in_mmap(struct kunit *test)
 			unsigned int block_idx = i * blocks_in_folio + j;
 			if (block_idx < fixture->block_count) {
 				unsigned int expected_offset = j * NVFS_BLOCK_SIZE;
-				KUNIT_EXPECT_EQ(test, fixture->mgroup->nvfs_metadata[block_idx].folio_offset,
+
+				KUNIT_EXPECT_PTR_EQ(test, mock_block_folio(fixture->mgroup, block_idx), folio);
+				KUNIT_EXPECT_EQ(test, mock_block_folio_offset(fixture->mgroup, block_idx),
 						expected_offset);
 			}
 		}
@@ -320,27 +364,26 @@ static void nvfs_test_mmap_state_transitions(struct kunit *test)
 
 	/* Test complete state transition sequence */
 	for (i = 0; i < fixture->block_count; i++) {
-		struct nvfs_io_metadata *metadata = &fixture->mgroup->nvfs_metadata[i];
+		u8 *state = &fixture->mgroup->nvfs_block_state[i];
 
 		/* Initialize */
-		metadata->nvfs_start_magic = NVFS_START_MAGIC;
-		metadata->nvfs_state = NVFS_IO_FREE;
-		
+		*state = NVFS_IO_FREE;
+
 		/* Transition through mmap states */
-		metadata->nvfs_state = NVFS_IO_ALLOC;
-		KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_ALLOC);
-		
-		metadata->nvfs_state = NVFS_IO_INIT;
-		KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_INIT);
-		
-		metadata->nvfs_state = NVFS_IO_QUEUED;
-		KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_QUEUED);
-		
-		metadata->nvfs_state = NVFS_IO_DMA_START;
-		KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_DMA_START);
-		
-		metadata->nvfs_state = NVFS_IO_DONE;
-		KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_DONE);
+		*state = NVFS_IO_ALLOC;
+		KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_ALLOC);
+
+		*state = NVFS_IO_INIT;
+		KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_INIT);
+
+		*state = NVFS_IO_QUEUED;
+		KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_QUEUED);
+
+		*state = NVFS_IO_DMA_START;
+		KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_DMA_START);
+
+		*state = NVFS_IO_DONE;
+		KUNIT_EXPECT_EQ(test, *state, (u8)NVFS_IO_DONE);
 	}
 
 	kunit_info(test, "State transitions: validated %u blocks through complete lifecycle",
@@ -356,27 +399,143 @@ static void nvfs_test_mmap_error_handling(struct kunit *test)
 	unsigned int i, error_count = 0;
 
 	/* Inject errors in some blocks */
+	memset(fixture->mgroup->nvfs_block_state, NVFS_IO_DMA_START, fixture->block_count);
 	for (i = 0; i < fixture->block_count; i += 5) {  /* Every 5th block */
-		fixture->mgroup->nvfs_metadata[i].nvfs_start_magic = NVFS_START_MAGIC;
-		fixture->mgroup->nvfs_metadata[i].nvfs_state = NVFS_IO_DMA_ERROR;
+		fixture->mgroup->nvfs_block_state[i] = NVFS_IO_DMA_ERROR;
 		error_count++;
 	}
 
-	/* Validate error detection */
+	/* Validate error detection, per block and per folio as the unmap path does */
 	for (i = 0; i < fixture->block_count; i++) {
-		struct nvfs_io_metadata *metadata = &fixture->mgroup->nvfs_metadata[i];
-		
-		if (i % 5 == 0) {
-			KUNIT_EXPECT_EQ(test, metadata->nvfs_state, NVFS_IO_DMA_ERROR);
-		}
+		u8 state = fixture->mgroup->nvfs_block_state[i];
+
+		if (i % 5 == 0)
+			KUNIT_EXPECT_EQ(test, state, (u8)NVFS_IO_DMA_ERROR);
+		else
+			KUNIT_EXPECT_EQ(test, state, (u8)NVFS_IO_DMA_START);
 	}
+	for (i = 0; i < fixture->block_count; i += GPU_PAGE_SIZE / NVFS_BLOCK_SIZE)
+		KUNIT_EXPECT_NOT_NULL(test, memchr(fixture->mgroup->nvfs_block_state + i,
+						   NVFS_IO_DMA_ERROR,
+						   GPU_PAGE_SIZE / NVFS_BLOCK_SIZE));
+
 
 	kunit_info(test, "Error handling: injected and validated %u error states",
 		   error_count);
 }
 
 /*
- * Test 9: Large mapping stress test
+ * Test 9: First block out of a set of states, over runs of equal states
+ */
+static void nvfs_test_blocks_find_state_not(struct kunit *test)
+{
+	struct nvfs_mmap_test_fixture *fixture = test->priv;
+	u8 *blk_state = fixture->mgroup->nvfs_block_state;
+	unsigned long n = fixture->block_count;
+	unsigned int dma_states = BIT(NVFS_IO_QUEUED) | BIT(NVFS_IO_DMA_START);
+
+	KUNIT_ASSERT_GE(test, n, 32UL);
+
+	/* single run */
+	memset(blk_state, NVFS_IO_QUEUED, n);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, n, dma_states), n);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, n, BIT(NVFS_IO_ALLOC)), 0UL);
+
+	/* empty range */
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 5, 5, 0), 5UL);
+
+	/* several runs in the mask, then a block out of it */
+	memset(blk_state + 10, NVFS_IO_DMA_START, 5);
+	blk_state[20] = NVFS_IO_DONE;
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, n, dma_states), 20UL);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 12, n, dma_states), 20UL);
+
+	/* a block past the end of the range is not reported */
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, 20, dma_states), 20UL);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, 15, dma_states), 15UL);
+
+	/* first and last block */
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 20, n, dma_states), 20UL);
+	memset(blk_state, NVFS_IO_QUEUED, n);
+	blk_state[n - 1] = NVFS_IO_DMA_ERROR;
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, n, dma_states), n - 1);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, n,
+							 dma_states | BIT(NVFS_IO_DMA_ERROR)), n);
+}
+
+/*
+ * Test 10: Block states of an IO window, the rest of the buffer untouched
+ */
+static void nvfs_test_block_state_window(struct kunit *test)
+{
+	struct nvfs_mmap_test_fixture *fixture = test->priv;
+	u8 *blk_state = fixture->mgroup->nvfs_block_state;
+	unsigned long blocks_per_folio = GPU_PAGE_SIZE / NVFS_BLOCK_SIZE;
+	unsigned long n = fixture->block_count;
+	unsigned long win_start = blocks_per_folio, win_end = 3 * blocks_per_folio;
+	unsigned long active_start = win_start + 3, active_end = win_end - 2;
+
+	KUNIT_ASSERT_LE(test, win_end, n);
+
+	/* buffer wide init, from ALLOC only */
+	memset(blk_state, NVFS_IO_ALLOC, n);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, n, BIT(NVFS_IO_ALLOC)), n);
+	memset(blk_state, NVFS_IO_INIT, n);
+
+	/* the window queues its active blocks, the others of the window are INIT */
+	memset(blk_state + active_start, NVFS_IO_QUEUED, active_end - active_start);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, win_start, win_end,
+							 BIT(NVFS_IO_INIT)), active_start);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, active_start, win_end,
+							 BIT(NVFS_IO_QUEUED)), active_end);
+
+	/* DMA starts on part of the active blocks */
+	memset(blk_state + active_start, NVFS_IO_DMA_START, 4);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, active_start, active_end,
+							 BIT(NVFS_IO_QUEUED) | BIT(NVFS_IO_DMA_START)),
+			active_end);
+
+	/* completion, blocks outside the window never left INIT */
+	memset(blk_state + active_start, NVFS_IO_DONE, active_end - active_start);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, 0, win_start,
+							 BIT(NVFS_IO_INIT)), win_start);
+	KUNIT_EXPECT_EQ(test, nvfs_blocks_find_state_not(blk_state, win_end, n,
+							 BIT(NVFS_IO_INIT)), n);
+	KUNIT_EXPECT_NULL(test, memchr(blk_state, NVFS_IO_DMA_ERROR, n));
+}
+
+/* mmap length check of nvfs_mgroup_mmap_internal() */
+static bool mock_mmap_length_ok(unsigned long length, unsigned int max_shadow_buf_mb)
+{
+	return length <= NVFS_MAX_SHADOW_PAGES * PAGE_SIZE &&
+	       length <= ((unsigned long)max_shadow_buf_mb << 20);
+}
+
+/*
+ * Test 11: Shadow buffer size limits, 16MB unless raised up to the index width
+ */
+static void nvfs_test_max_shadow_buf_size(struct kunit *test)
+{
+	unsigned long max_size = NVFS_MAX_SHADOW_PAGES * PAGE_SIZE;
+
+	KUNIT_EXPECT_EQ(test, max_size, 1UL << NVFS_MAX_SHADOW_SIZE_SHIFT);
+
+	/* default */
+	KUNIT_EXPECT_TRUE(test, mock_mmap_length_ok(16UL << 20, NVFS_DEFAULT_MAX_SHADOW_BUF_MB));
+	KUNIT_EXPECT_FALSE(test, mock_mmap_length_ok((16UL << 20) + GPU_PAGE_SIZE,
+						     NVFS_DEFAULT_MAX_SHADOW_BUF_MB));
+	KUNIT_EXPECT_FALSE(test, mock_mmap_length_ok(max_size, NVFS_DEFAULT_MAX_SHADOW_BUF_MB));
+
+	/* raised explicitly */
+	KUNIT_EXPECT_TRUE(test, mock_mmap_length_ok(max_size, max_size >> 20));
+	KUNIT_EXPECT_FALSE(test, mock_mmap_length_ok(max_size + GPU_PAGE_SIZE, UINT_MAX));
+
+	kunit_info(test, "Shadow buffer size: %uMB by default, up to %luMB",
+		   NVFS_DEFAULT_MAX_SHADOW_BUF_MB, max_size >> 20);
+}
+
+/*
+ * Test 12: Large mapping stress test
  */
 static void nvfs_test_large_mmap_stress(struct kunit *test)
 {
@@ -384,7 +543,7 @@ static void nvfs_test_large_mmap_stress(struct kunit *test)
 	unsigned long folio_count = DIV_ROUND_UP(large_size, GPU_PAGE_SIZE);
 	unsigned long block_count = DIV_ROUND_UP(large_size, NVFS_BLOCK_SIZE);
 	struct folio **folios;
-	struct nvfs_io_metadata *metadata;
+	u8 *metadata;
 	unsigned long i, successful_allocs = 0;
 
 	/* Attempt large allocation */
@@ -394,7 +553,7 @@ static void nvfs_test_large_mmap_stress(struct kunit *test)
 		return;
 	}
 
-	metadata = kcalloc(block_count, sizeof(struct nvfs_io_metadata), GFP_KERNEL);
+	metadata = kzalloc(block_count, GFP_KERNEL);
 	if (!metadata) {
 		kfree(folios);
 		kunit_skip(test, "Cannot allocate metadata for stress test");
@@ -438,6 +597,9 @@ static struct kunit_case nvfs_mmap_test_cases[] = {
 	KUNIT_CASE(nvfs_test_folio_boundary_in_mmap),
 	KUNIT_CASE(nvfs_test_mmap_state_transitions),
 	KUNIT_CASE(nvfs_test_mmap_error_handling),
+	KUNIT_CASE(nvfs_test_blocks_find_state_not),
+	KUNIT_CASE(nvfs_test_block_state_window),
+	KUNIT_CASE(nvfs_test_max_shadow_buf_size),
 	KUNIT_CASE(nvfs_test_large_mmap_stress),
 	{}
 };